@@ -8,6 +8,9 @@ function pretty_print_csv {
     perl -pe 's/((?<=,)|(?<=^)),/ ,/g;' "$@" | column -t -s, | less  -F -S -X -K
 }
 
+# the implementations of matrix_1 to matrix_6, by number
+implementation_names=( simple omp block vector strassen morton )
+
 multirun() {
   echo "metrics report  :  ${metrics_file}"
   local program
@@ -18,7 +21,8 @@ multirun() {
   for ((prognum=${prog_first}; prognum<=${prog_last}; prognum++)) do
     echo "- LOOP prog # $prognum "
     progname=matrix_${prognum}
-    program=${PROJECT_BIN_DIR}/${progname}
+    # the matrix driver runs the implementation of each matrix_N
+    program="${PROJECT_BIN_DIR}/matrix --impl ${implementation_names[prognum - 1]}"
     local thread_label=""
     echo "- LOOPING over threads from $min_threads up to $max_threads step = $thread_step"
     for ((t=${min_threads}; t<=${max_threads}; t+=${thread_step})) do
@@ -158,6 +162,10 @@ fi
 
 if [ -n "${MATRIX_RUN_PAPI}" ]; then
   papi_arg="--papi ${MATRIX_RUN_PAPI}"
+  # collect all the ! separated subsets in one run instead of one run per subset
+  if [ -n "${MATRIX_RUN_MULTIPLEX}" ]; then
+    papi_arg="${papi_arg} --multiplex"
+  fi
   papi_label="__papi_${MATRIX_RUN_PAPI}"
 else
   papi_arg=""
@@ -0,0 +1,229 @@
+#ifndef BINARY_SUPPORT_LOCAL
+#define BINARY_SUPPORT_LOCAL
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "matrix_config.h"
+#include "half_convert.h"
+
+/**
+ * Binary matrix files: much smaller and faster to load than the CSV files, and able to carry
+ * the reduced precision element types.
+ *
+ * A 16 byte header followed by the rows x cols elements in row-major order, all in the native byte
+ * order (so a file is only read back on a machine of the same endianness):
+ *   char     magic[4]  "MTXB"
+ *   uint32_t dtype     0 = f64, 1 = f32, 2 = fp16, 3 = bf16, 4 = c128 (re, im pairs of f64)
+ *   uint32_t rows
+ *   uint32_t cols
+ *
+ * Files are recognized by the magic, so -f, -t and -o take either format (-o writes binary
+ * when the name ends with .mtx, in the --storage type, or c128 for --complex).
+ */
+
+#define MATRIX_BINARY_MAGIC "MTXB"
+#define MATRIX_BINARY_SUFFIX ".mtx"
+
+enum matrix_dtype { DTYPE_F64, DTYPE_F32, DTYPE_FP16, DTYPE_BF16, DTYPE_C128, NUM_DTYPES };
+
+struct binary_header {
+    char magic[4];
+    uint32_t dtype;
+    uint32_t rows;
+    uint32_t cols;
+};
+
+size_t dtype_bytes(enum matrix_dtype dtype)
+{
+    switch (dtype) {
+        case DTYPE_F64: return sizeof(double);
+        case DTYPE_F32: return sizeof(float);
+        case DTYPE_C128: return 2 * sizeof(double);
+        default: return sizeof(uint16_t);
+    }
+}
+
+char *dtype_name(enum matrix_dtype dtype)
+{
+    switch (dtype) {
+        case DTYPE_F32: return "f32";
+        case DTYPE_FP16: return "fp16";
+        case DTYPE_BF16: return "bf16";
+        case DTYPE_C128: return "c128";
+        default: return "f64";
+    }
+}
+
+enum matrix_dtype storage_dtype(enum storage storage)
+{
+    switch (storage) {
+        case STORAGE_FP16: return DTYPE_FP16;
+        case STORAGE_BF16: return DTYPE_BF16;
+        default: return DTYPE_F64;
+    }
+}
+
+bool is_binary_file(char *file_name)
+{
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    char magic[4];
+    bool binary = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+                  && memcmp(magic, MATRIX_BINARY_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return binary;
+}
+
+bool has_binary_suffix(char *file_name)
+{
+    size_t length = strlen(file_name);
+    size_t suffix_length = strlen(MATRIX_BINARY_SUFFIX);
+    return length >= suffix_length && strcmp(file_name + length - suffix_length, MATRIX_BINARY_SUFFIX) == 0;
+}
+
+/**
+ * Read a binary matrix file, widening the elements to double
+ *
+ * The imaginary parts of a c128 file go to imag, and imag is zeroed for the real types.
+ * imag may be NULL to keep only the real parts.
+ *
+ * @return number of rows read (0 if the file does not hold an N x N matrix)
+ */
+int read_binary_complex_file(char *file_name, double real[][N], double imag[][N])
+{
+    FILE *file = fopen(file_name, "rb");
+    if (!file) {
+        fprintf(stderr, "Error: cannot read the input file at %s\n", file_name);
+        exit(1);
+    }
+    struct binary_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.dtype >= NUM_DTYPES) {
+        ERROR("%s is not a valid binary matrix file", file_name);
+        fclose(file);
+        return 0;
+    }
+    if (header.rows != N || header.cols != N) {
+        ERROR("The file must contain a square matrix of size %d: %s holds %u x %u", N, file_name,
+              header.rows, header.cols);
+        fclose(file);
+        return 0;
+    }
+    enum matrix_dtype dtype = header.dtype;
+    DEBUG("Reading %u x %u %s matrix from %s", header.rows, header.cols, dtype_name(dtype), file_name);
+    size_t row_bytes = N * dtype_bytes(dtype);
+    unsigned char *row = malloc(row_bytes);
+    float *widened = malloc(N * sizeof(float));
+    int rows = 0;
+    for (; rows < N && fread(row, row_bytes, 1, file) == 1; rows++) {
+        if (imag != NULL && dtype != DTYPE_C128) {
+            memset(imag[rows], 0, N * sizeof(double));
+        }
+        switch (dtype) {
+            case DTYPE_F64:
+                memcpy(real[rows], row, row_bytes);
+                continue;
+            case DTYPE_C128:
+                for (size_t j = 0; j < N; j++) {
+                    double pair[2];
+                    memcpy(pair, row + j * sizeof(pair), sizeof(pair));
+                    real[rows][j] = pair[0];
+                    if (imag != NULL) {
+                        imag[rows][j] = pair[1];
+                    }
+                }
+                continue;
+            case DTYPE_F32:
+                memcpy(widened, row, row_bytes);
+                break;
+            case DTYPE_FP16:
+                widen_fp16((uint16_t *)row, widened, N);
+                break;
+            default:
+                widen_bf16((uint16_t *)row, widened, N);
+                break;
+        }
+        for (size_t j = 0; j < N; j++) {
+            real[rows][j] = widened[j];
+        }
+    }
+    free(row);
+    free(widened);
+    fclose(file);
+    return rows;
+}
+
+int read_binary_file(char *file_name, double matrix[][N])
+{
+    return read_binary_complex_file(file_name, matrix, NULL);
+}
+
+/**
+ * Write a matrix to a binary file, narrowing the elements to the given type
+ *
+ * IF the file exists it is silently overwritten.
+ */
+void write_binary_file(char *file_name, double matrix[][N], enum matrix_dtype dtype)
+{
+    FILE *file = fopen(file_name, "wb");
+    if (!file) {
+        fprintf(stderr, "Error: cannot write to the output file at %s\n", file_name);
+        exit(1);
+    }
+    struct binary_header header = { .dtype = dtype, .rows = N, .cols = N };
+    memcpy(header.magic, MATRIX_BINARY_MAGIC, sizeof(header.magic));
+    fwrite(&header, sizeof(header), 1, file);
+    size_t row_bytes = N * dtype_bytes(dtype);
+    unsigned char *row = malloc(row_bytes);
+    float *narrowed = malloc(N * sizeof(float));
+    for (size_t i = 0; i < N; i++) {
+        if (dtype == DTYPE_F64) {
+            memcpy(row, matrix[i], row_bytes);
+        }
+        else {
+            for (size_t j = 0; j < N; j++) {
+                narrowed[j] = (float)matrix[i][j];
+            }
+            if (dtype == DTYPE_F32) memcpy(row, narrowed, row_bytes);
+            else if (dtype == DTYPE_FP16) narrow_fp16(narrowed, (uint16_t *)row, N);
+            else narrow_bf16(narrowed, (uint16_t *)row, N);
+        }
+        fwrite(row, row_bytes, 1, file);
+    }
+    free(row);
+    free(narrowed);
+    fclose(file);
+}
+
+/**
+ * Write a complex matrix to a c128 binary file, the real and imaginary parts of each element side by side
+ *
+ * IF the file exists it is silently overwritten.
+ */
+void write_binary_complex_file(char *file_name, double real[][N], double imag[][N])
+{
+    FILE *file = fopen(file_name, "wb");
+    if (!file) {
+        fprintf(stderr, "Error: cannot write to the output file at %s\n", file_name);
+        exit(1);
+    }
+    struct binary_header header = { .dtype = DTYPE_C128, .rows = N, .cols = N };
+    memcpy(header.magic, MATRIX_BINARY_MAGIC, sizeof(header.magic));
+    fwrite(&header, sizeof(header), 1, file);
+    double *row = malloc(2 * N * sizeof(double));
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            row[2 * j] = real[i][j];
+            row[2 * j + 1] = imag[i][j];
+        }
+        fwrite(row, 2 * N * sizeof(double), 1, file);
+    }
+    free(row);
+    fclose(file);
+}
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef BLOCK_KERNELS_LOCAL
+#define BLOCK_KERNELS_LOCAL
+#include <stddef.h>
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_epilogue.h"
+
+/**
+ * Block kernels specialized at compile time for the block sizes we run (-b 16, 32, 64, 128, 256),
+ * shared by the block and omp implementations, and on strided blocks by the leaves of strassen.
+ *
+ * multiply_block takes the block size as a run time value, so the compiler can neither unroll the
+ * loops nor tell how far they go. BLOCK_KERNEL stamps out a copy per size with the size a constant:
+ * each row of the A block is dotted with 4 rows of the B block at once (B is used transposed, as in
+ * multiply_block), the 4 sums kept in vector registers over the whole k loop. omp simd allows the
+ * sums to be reassociated into vector lanes, which -O3 alone does not do for doubles.
+ *
+ * The sums are stored through the epilogue (matrix_epilogue.h) at the first and last kk of the C tile,
+ * so scaling or not reading C, bias and activation happen while they are still in registers.
+ *
+ * select_block_kernel picks the kernel once for config->block_size, NULL for the other sizes, which
+ * run_block_kernel then hands to the generic multiply_block of the implementation between the tile
+ * stages of the epilogue.
+ *
+ * multiply_strided_block_S is the same kernel on blocks anywhere in memory, with their own leading
+ * dimensions, storing plain sums: the first kk block overwrites C and the others add to it.
+ */
+
+typedef void (*block_kernel)(int ii, int jj, int kk, size_t bsize,
+                             double matrix1[][N], double matrix2[][N], double result[][N]);
+typedef void (*fused_block_kernel)(int ii, int jj, int kk, double matrix1[][N], double matrix2[][N],
+                                   double result[][N], const struct epilogue *epilogue, unsigned stage);
+typedef void (*strided_block_kernel)(const double *restrict a, size_t lda, const double *restrict bt, size_t ldb,
+                                     double *restrict c, size_t ldc, bool first);
+
+// the sums of a row of the A block with 4 rows of the transposed B block, kept in vector registers
+#define BLOCK_DOT4(S, a, b0, b1, b2, b3) \
+    double sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0; \
+    _Pragma("omp simd reduction(+:sum0, sum1, sum2, sum3)") \
+    for (size_t k = 0; k < S; ++k) { \
+        sum0 += a[k] * b0[k]; \
+        sum1 += a[k] * b1[k]; \
+        sum2 += a[k] * b2[k]; \
+        sum3 += a[k] * b3[k]; \
+    }
+
+#define BLOCK_KERNEL(S) \
+static void multiply_block_##S(int ii, int jj, int kk, double matrix1[][N], double matrix2[][N], \
+                               double result[][N], const struct epilogue *epilogue, unsigned stage) \
+{ \
+    for (size_t i = ii; i < (size_t)ii + S; ++i) { \
+        const double *restrict a = &matrix1[i][kk]; \
+        for (size_t j = jj; j < (size_t)jj + S; j += 4) { \
+            const double *restrict b0 = &matrix2[j][kk]; \
+            const double *restrict b1 = &matrix2[j + 1][kk]; \
+            const double *restrict b2 = &matrix2[j + 2][kk]; \
+            const double *restrict b3 = &matrix2[j + 3][kk]; \
+            BLOCK_DOT4(S, a, b0, b1, b2, b3) \
+            epilogue_store(epilogue, stage, &result[i][j], sum0, i, j); \
+            epilogue_store(epilogue, stage, &result[i][j + 1], sum1, i, j + 1); \
+            epilogue_store(epilogue, stage, &result[i][j + 2], sum2, i, j + 2); \
+            epilogue_store(epilogue, stage, &result[i][j + 3], sum3, i, j + 3); \
+        } \
+    } \
+} \
+\
+static void multiply_strided_block_##S(const double *restrict a, size_t lda, const double *restrict bt, size_t ldb, \
+                                       double *restrict c, size_t ldc, bool first) \
+{ \
+    for (size_t i = 0; i < S; ++i) { \
+        const double *restrict a_row = a + i * lda; \
+        double *restrict c_row = c + i * ldc; \
+        for (size_t j = 0; j < S; j += 4) { \
+            const double *restrict b0 = bt + j * ldb; \
+            const double *restrict b1 = bt + (j + 1) * ldb; \
+            const double *restrict b2 = bt + (j + 2) * ldb; \
+            const double *restrict b3 = bt + (j + 3) * ldb; \
+            BLOCK_DOT4(S, a_row, b0, b1, b2, b3) \
+            c_row[j] = first ? sum0 : c_row[j] + sum0; \
+            c_row[j + 1] = first ? sum1 : c_row[j + 1] + sum1; \
+            c_row[j + 2] = first ? sum2 : c_row[j + 2] + sum2; \
+            c_row[j + 3] = first ? sum3 : c_row[j + 3] + sum3; \
+        } \
+    } \
+}
+
+BLOCK_KERNEL(16)
+BLOCK_KERNEL(32)
+BLOCK_KERNEL(64)
+BLOCK_KERNEL(128)
+BLOCK_KERNEL(256)
+
+static fused_block_kernel select_block_kernel(size_t bsize)
+{
+    switch (bsize) {
+        case 16: return multiply_block_16;
+        case 32: return multiply_block_32;
+        case 64: return multiply_block_64;
+        case 128: return multiply_block_128;
+        case 256: return multiply_block_256;
+        default: return NULL;
+    }
+}
+
+static strided_block_kernel select_strided_block_kernel(size_t bsize)
+{
+    switch (bsize) {
+        case 16: return multiply_strided_block_16;
+        case 32: return multiply_strided_block_32;
+        case 64: return multiply_strided_block_64;
+        case 128: return multiply_strided_block_128;
+        case 256: return multiply_strided_block_256;
+        default: return NULL;
+    }
+}
+
+/**
+ * The first and last kk of the blocks that are productive for the C tile at ii, jj: all of them but
+ * the all-zero ones of --sparse blocks (first > last when there are none)
+ */
+static void productive_blocks(size_t ii, size_t jj, size_t bsize, size_t *first, size_t *last)
+{
+    *first = N;
+    *last = 0;
+    for (size_t kk = 0; kk < N; kk += bsize) {
+        if (block_tiles_productive(ii, jj, kk)) {
+            *first = MIN(*first, kk);
+            *last = kk;
+        }
+    }
+}
+
+static unsigned tile_stage(size_t kk, size_t first, size_t last)
+{
+    return (kk == first ? TILE_FIRST : 0) | (kk == last ? TILE_LAST : 0);
+}
+
+/**
+ * C tile at ii, jj += A block at ii, kk . B block at jj, kk (B is used transposed) at the given stages of
+ * the epilogue: fused into the specialized kernel, else around the generic one
+ */
+static void run_block_kernel(fused_block_kernel fused, block_kernel generic, int ii, int jj, int kk, size_t bsize,
+                             double matrix1[][N], double matrix2[][N], double result[][N],
+                             const struct epilogue *epilogue, unsigned stage)
+{
+    if (fused != NULL) {
+        fused(ii, jj, kk, matrix1, matrix2, result, epilogue, stage);
+        return;
+    }
+    if (stage & TILE_FIRST) {
+        epilogue_begin_tile(epilogue, result, ii, jj, bsize, bsize);
+    }
+    generic(ii, jj, kk, bsize, matrix1, matrix2, result);
+    if (stage & TILE_LAST) {
+        epilogue_end_tile(epilogue, result, ii, jj, bsize, bsize);
+    }
+}
+
+/**
+ * Both stages of the epilogue on a C tile that no productive block reaches (--sparse blocks)
+ */
+static void empty_block_tile(int ii, int jj, size_t bsize, double result[][N], const struct epilogue *epilogue)
+{
+    epilogue_begin_tile(epilogue, result, ii, jj, bsize, bsize);
+    epilogue_end_tile(epilogue, result, ii, jj, bsize, bsize);
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef HALF_CONVERT_LOCAL
+#define HALF_CONVERT_LOCAL
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <immintrin.h>
+
+/**
+ * Conversions between float and the 16-bit storage formats, all rounding to nearest even:
+ *  - fp16 (IEEE binary16): 5 bit exponent, 10 bit mantissa, max 65504
+ *  - bf16 (bfloat16): the top half of a float, 8 bit exponent, 7 bit mantissa
+ *
+ * The array versions use the F16C instructions for fp16 when the compiler targets them
+ * (-march=native on x86) and the scalar software conversions otherwise.
+ * static inline as both the driver and matrix_half.c include this header.
+ */
+
+static inline uint16_t float_to_fp16(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    bits &= 0x7fffffff;
+    if (bits >= 0x47800000) { // 65536 and above overflow to infinity, NaN stays NaN
+        return sign | (bits > 0x7f800000 ? 0x7e00 : 0x7c00);
+    }
+    if (bits < 0x38800000) { // below the smallest normal fp16: subnormal or zero
+        // adding 0.5 lines the fp16 subnormal bits up at the bottom of the mantissa, rounding on the way
+        float shifted;
+        memcpy(&shifted, &bits, sizeof(shifted));
+        shifted += 0.5f;
+        uint32_t shifted_bits;
+        memcpy(&shifted_bits, &shifted, sizeof(shifted_bits));
+        return sign | (uint16_t)(shifted_bits - 0x3f000000);
+    }
+    uint32_t odd = (bits >> 13) & 1;
+    bits += ((uint32_t)(15 - 127) << 23) + 0xfff + odd; // rebias the exponent and round to nearest even
+    return sign | (uint16_t)(bits >> 13);
+}
+
+static inline float fp16_to_float(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13); // infinity or NaN
+    }
+    else if (exponent != 0) {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    else {
+        float subnormal = (float)mantissa / 16777216.0f; // mantissa x 2^-24
+        memcpy(&bits, &subnormal, sizeof(bits));
+        bits |= sign;
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline uint16_t float_to_bf16(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        return (uint16_t)((bits >> 16) | 0x40); // keep NaN quiet rather than rounding it to infinity
+    }
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return (uint16_t)(bits >> 16);
+}
+
+static inline float bf16_to_float(uint16_t bf16)
+{
+    uint32_t bits = (uint32_t)bf16 << 16;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline void widen_fp16(const uint16_t *src, float *dst, size_t count)
+{
+    size_t i = 0;
+#ifdef __F16C__
+    for (size_t vector_count = count & ~(size_t)7; i < vector_count; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = fp16_to_float(src[i]);
+    }
+}
+
+static inline void narrow_fp16(const float *src, uint16_t *dst, size_t count)
+{
+    size_t i = 0;
+#ifdef __F16C__
+    for (size_t vector_count = count & ~(size_t)7; i < vector_count; i += 8) {
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = float_to_fp16(src[i]);
+    }
+}
+
+// a shift per element, the compiler vectorizes it without help
+static inline void widen_bf16(const uint16_t *src, float *dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = bf16_to_float(src[i]);
+    }
+}
+
+static inline void narrow_bf16(const float *src, uint16_t *dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = float_to_bf16(src[i]);
+    }
+}
+
+#endif
@@ -31,6 +31,17 @@ int PAPI_create_eventset(int *EventSet) {
     return PAPI_OK;
 }
 
+/**< remove all PAPI events from an event set */
+int PAPI_cleanup_eventset(int EventSet) {
+    return PAPI_OK;
+}
+
+/**< deallocates memory associated with an empty PAPI event set */
+int PAPI_destroy_eventset(int *EventSet) {
+    *EventSet = PAPI_NULL;
+    return PAPI_OK;
+}
+
 /**< add array of PAPI preset or native hardware events to an event set */
 int PAPI_add_events(int EventSet, int *Events, int number) {
     printf("Add Events: EventSet [%d]  Num events [%d]\n", EventSet, number);
@@ -88,6 +99,21 @@ int PAPI_event_name_to_code(char *in, int *out) {
     return PAPI_OK;
 }
 
+/**< initialize multiplex support in the PAPI library */
+int PAPI_multiplex_init(void) {
+    return PAPI_OK;
+}
+
+/**< assign a component index to an existing but empty eventset */
+int PAPI_assign_eventset_component(int EventSet, int cidx) {
+    return PAPI_OK;
+}
+
+/**< convert a standard event set to a multiplexed event set */
+int PAPI_set_multiplex(int EventSet) {
+    return PAPI_OK;
+}
+
 /**< change the option settings of the PAPI library or a specific event set */
 int PAPI_set_opt(int option, PAPI_option_t * ptr) {
     return PAPI_OK;
@@ -2,13 +2,20 @@
 #include <stdlib.h>
 //#include <omp.h>
 #include "matrix.h"
-#include "matrix_support.c"
+#include "matrix_tiles.h"
+#include "matrix_epilogue.h"
+#include "matrix_plan.h"
+#include "matrix_support.h"
 #include <time.h>
 
-struct config *config;
+// the implementation of the executable, registered in libspeedmm (matrix_registry.c)
+#ifndef MATRIX_IMPLEMENTATION
+#define MATRIX_IMPLEMENTATION "simple"
+#endif
 
 /**
- * Perform a dot-multiplication on two square matrices of a given size in the speciied order
+ * Perform a dot-multiplication on two square matrices of a given size in the speciied order, with the
+ * implementation selected by select_implementation (matrix_registry.c)
  *
  * IMPORTANT: The result matrix must be zeroed for this function to succeed
  *
@@ -19,12 +26,128 @@ struct config *config;
  */
 extern long dot_multiply_matrices(enum loop_order order, double matrix1[][N], double matrix2[][N], double result[][N]);
 
+/**
+ * Same in reduced or mixed precision (matrix_precision.c, shared by all the implementations)
+ */
+extern long dot_multiply_matrices_precision(enum precision precision, double matrix1[][N], double matrix2[][N],
+                                            double result[][N]);
+
+/**
+ * Same on the fp16 or bf16 copies of the matrices made by prepare_half_storage (matrix_half.c)
+ */
+extern long dot_multiply_matrices_half(double result[][N]);
+
+/**
+ * Same on the int8 or int16 copies of the matrices made by prepare_int_storage (matrix_int.c)
+ */
+extern long dot_multiply_matrices_int(double result[][N]);
+
+/**
+ * Complex product of the copies of the matrices made by prepare_complex_storage (matrix_complex.c),
+ * the real part of it in result
+ */
+extern long dot_multiply_matrices_complex(enum complex_algorithm algorithm, double result[][N]);
+
+/**
+ * Same with the kernels made by prepare_jit_kernels (matrix_jit.c)
+ */
+extern long dot_multiply_matrices_jit(double matrix1[][N], double matrix2[][N], double result[][N]);
+
+/**
+ * Product of the first --a-rows rows of A and the first --b-cols columns of B (matrix_general.c)
+ */
+extern long dot_multiply_matrices_general(double matrix1[][N], double matrix2[][N], double result[][N]);
+
+/**
+ * One triangle of A . A^T, mirrored or not (matrix_syrk.c)
+ */
+extern long dot_multiply_matrices_syrk(enum triangle triangle, bool mirror, double matrix[][N], double result[][N]);
+
+/**
+ * Product of B by one triangle of A, and the solve of tri(A) . X = B (matrix_triangular.c)
+ */
+extern long dot_multiply_matrices_trmm(enum triangle triangle, double matrix1[][N], double matrix2[][N],
+                                       double result[][N]);
+extern long dot_multiply_matrices_trsm(enum triangle triangle, double matrix1[][N], double matrix2[][N],
+                                       double result[][N]);
+
+/**
+ * Product of the CSR or CSC copy of A made by prepare_sparse_storage with B (matrix_sparse.c)
+ */
+extern long dot_multiply_matrices_sparse(double matrix2[][N], double result[][N]);
+
+/**
+ * Product of the band of A made by prepare_band_storage with B (matrix_band.c)
+ */
+extern long dot_multiply_matrices_band(double matrix2[][N], double result[][N]);
+
+/**
+ * Product of the --chain planned by prepare_chain (matrix_chain.c)
+ */
+extern long dot_multiply_matrices_chain(double result[][N]);
+
+/**
+ * Product of A with the B packed for the --plan by prepare_gemm_plan (matrix_plan.c)
+ */
+extern long dot_multiply_matrices_plan(double matrix1[][N], double result[][N]);
+
+/**
+ * Batch of small products cut out of the matrices (matrix_batch.c)
+ */
+extern long dot_multiply_matrices_batch(size_t size, bool pointers, double matrix1[][N], double matrix2[][N],
+                                        double result[][N]);
+
 long measurable_work(double matrix_a[][N], double matrix_b[][N], double result[][N])
 {
     long counted_flops = 0;
     DEBUG("Multiplying matrices");
+    trace_start();
 //    counted_flops = 1 + 1 + 1 + 1 + 1 + 1 + 1;  does papi make sense?
-    counted_flops= dot_multiply_matrices(config->loop_order, matrix_a, matrix_b, result);
+    if (config->chain_matrices > 0) {
+        counted_flops = dot_multiply_matrices_chain(result); // on the chain made by prepare_chain
+    }
+    else if (config->syrk != TRIANGLE_NONE) {
+        counted_flops = dot_multiply_matrices_syrk(config->syrk, config->syrk_mirror, matrix_a, result);
+    }
+    else if (config->trmm != TRIANGLE_NONE) {
+        counted_flops = dot_multiply_matrices_trmm(config->trmm, matrix_a, matrix_b, result);
+    }
+    else if (config->trsm != TRIANGLE_NONE) {
+        counted_flops = dot_multiply_matrices_trsm(config->trsm, matrix_a, matrix_b, result);
+    }
+    else if (config->sparse == SPARSE_CSR || config->sparse == SPARSE_CSC) {
+        counted_flops = dot_multiply_matrices_sparse(matrix_b, result); // on the sparse copy of matrix_a
+    }
+    else if (config->sparse == SPARSE_BAND) {
+        counted_flops = dot_multiply_matrices_band(matrix_b, result); // on the band of matrix_a
+    }
+    else if (config->plan_file != NULL) {
+        counted_flops = dot_multiply_matrices_plan(matrix_a, result); // on the packed copy of matrix_b
+    }
+    else if (general_shape()) {
+        counted_flops = dot_multiply_matrices_general(matrix_a, matrix_b, result);
+    }
+    else if (config->jit) {
+        counted_flops = dot_multiply_matrices_jit(matrix_a, matrix_b, result);
+    }
+    else if (config->batch > 0) {
+        counted_flops = dot_multiply_matrices_batch(config->batch, config->batch_pointers, matrix_a, matrix_b, result);
+    }
+    else if (config->complex != COMPLEX_NONE) {
+        counted_flops = dot_multiply_matrices_complex(config->complex, result); // on the complex copies
+    }
+    else if (config->storage == STORAGE_INT8 || config->storage == STORAGE_INT16) {
+        counted_flops = dot_multiply_matrices_int(result); // on the quantized copies of matrix_a and matrix_b
+    }
+    else if (config->storage != STORAGE_DOUBLE) {
+        counted_flops = dot_multiply_matrices_half(result); // on the 16 bit copies of matrix_a and matrix_b
+    }
+    else if (config->precision == PRECISION_DOUBLE) {
+        counted_flops = dot_multiply_matrices(config->loop_order, matrix_a, matrix_b, result);
+    }
+    else {
+        counted_flops = dot_multiply_matrices_precision(config->precision, matrix_a, matrix_b, result);
+    }
     DEBUG("Matrix multiplication involved %ld FLOPs", counted_flops);
 
     switch (counted_flops) {
@@ -72,7 +195,7 @@ int run_timer_loops(unsigned timer_loop_count, struct metrics *metrics,
 {
     DEBUG("Running %u timer loops over matrix calculations", timer_loop_count);
     for (unsigned work_loop_index = 0; work_loop_index < timer_loop_count; work_loop_index++) {
-        fill_matrix_constant(dot_product, 0.0f);
+        prepare_result(dot_product);
         // start papi counters
         double start_time = omp_get_wtime();
         DEBUG("Started OMP at: %.3lf seconds", start_time);
@@ -102,7 +225,7 @@ int run_papi_loops(char* papi_arg, struct metrics *metrics, int *event_codes, lo
     char *subsets[MAX_PAPI_CODES];
     unsigned subset_count = split_string(papi_arg, "!", subsets);
     for (unsigned work_loop_index = 0; work_loop_index < subset_count; work_loop_index++) {
-        fill_matrix_constant(dot_product, 0.0f);
+        prepare_result(dot_product);
         clear_caches(); // clear caches betweeen each run by filling them
         bool measure_time = (work_loop_index == 0); // measure time on the first run only
         char *subset_arg = subsets[work_loop_index];
@@ -111,18 +234,18 @@ int run_papi_loops(char* papi_arg, struct metrics *metrics, int *event_codes, lo
         char *sub_events[MAX_PAPI_CODES];
         unsigned sub_events_count = split_string(subset_arg, ":", sub_events);
         for (unsigned event_j = 0; event_j < sub_events_count; event_j++) {
-            event_codes[total_event_count] = papi_code(sub_events[event_j]);
+            event_codes[total_event_count] = counter_code(sub_events[event_j]);
             DEBUG("event %u in subsset %u is %s with code: %#010x", event_j, work_loop_index,
                   sub_events[event_j], event_codes[total_event_count]);
             total_event_count++;
         }
         DEBUG("About to papi init events start:%u size:%u for subset:%s", subset_start, sub_events_count,
               subset_arg);
-        event_set = init_papi_events(subset_start, sub_events_count, event_codes,
-                                     failed_codes); // papi event set handle
+        event_set = init_counter_events(subset_start, sub_events_count, event_codes,
+                                        failed_codes); // papi (or perf) event set handle
 
         // start papi counters
-        long long start_time = start_papi(event_set);
+        long long start_time = start_counters(event_set);
         time_t alt_time_start;
         time(&alt_time_start);
         DEBUG("Started PAPI at: %lld microseconds", start_time);
@@ -131,7 +254,7 @@ int run_papi_loops(char* papi_arg, struct metrics *metrics, int *event_codes, lo
         long counted_flops = measurable_work(matrix_a, matrix_b, dot_product);
 
         // stop the counters
-        long long stop_time = stop_papi(event_set, subset_start, papi_results);
+        long long stop_time = stop_counters(event_set, subset_start, papi_results);
         DEBUG("Stopped PAPI at: %lld microseconds", stop_time);
 
         if (measure_time) {
@@ -141,10 +264,60 @@ int run_papi_loops(char* papi_arg, struct metrics *metrics, int *event_codes, lo
     return total_event_count;
 }
 
+/**
+ * Collect the events of all the sets in papi_arg in a single run of the matrix multiplication by multiplexing
+ * them over the hardware counters, so the counts and the timing come from the same execution
+ */
+int run_multiplexed_papi(char* papi_arg, struct metrics *metrics, int *event_codes, long long *papi_results,
+                         int *failed_codes, double matrix_a[][N], double matrix_b[][N], double dot_product[][N])
+{
+    unsigned total_event_count = 0;
+    char *subsets[MAX_PAPI_CODES];
+    unsigned subset_starts[MAX_PAPI_CODES];
+    unsigned subset_sizes[MAX_PAPI_CODES];
+    unsigned subset_count = split_string(papi_arg, "!", subsets);
+    for (unsigned subset = 0; subset < subset_count; subset++) {
+        char *sub_events[MAX_PAPI_CODES];
+        subset_starts[subset] = total_event_count;
+        subset_sizes[subset] = split_string(subsets[subset], ":", sub_events);
+        for (unsigned event_j = 0; event_j < subset_sizes[subset] && total_event_count < MAX_PAPI_CODES; event_j++) {
+            event_codes[total_event_count++] = counter_code(sub_events[event_j]);
+        }
+    }
+    DEBUG("Multiplexing %u events from %u subsets in a single run", total_event_count, subset_count);
+    int event_set = init_counter_events_multiplexed(subset_count, subset_starts, subset_sizes, total_event_count,
+                                                    event_codes, failed_codes);
+
+    prepare_result(dot_product);
+    clear_caches();
+    long long start_time = start_counters_multiplexed(event_set);
+    time_t alt_time_start;
+    time(&alt_time_start);
+
+    long counted_flops = measurable_work(matrix_a, matrix_b, dot_product);
+
+    long long stop_time = stop_counters_multiplexed(event_set, papi_results);
+    measure(metrics, start_time, stop_time, -1.0f, -1.0f, counted_flops, alt_time_start);
+    return total_event_count;
+}
+
 int main(int argc, char* argv []) {
     struct config local_config = parse_cli(argc, argv);
     // simplify config.size to n
     config = &local_config;
+    // --impl or --compare choose among all the implementations, else the executable runs its own
+    char *own_implementation[] = { MATRIX_IMPLEMENTATION };
+    char **implementation_names = config->implementation_count > 0 ? config->implementations : own_implementation;
+    int implementation_count = config->implementation_count > 0 ? config->implementation_count : 1;
+    if (!select_implementation(implementation_names[0])) {
+        ERROR("No implementation named %s", implementation_names[0]);
+        exit(1);
+    }
+    if (config->sparse == SPARSE_BLOCKS && !selected_implementation()->sparse_tiles) {
+        ERROR("--sparse blocks needs an implementation that skips the all-zero tiles (block or omp), not %s",
+              selected_implementation()->name);
+        exit(1);
+    }
 
     // names for use in output messages
     char *a_desc = "A";
@@ -160,17 +333,56 @@ int main(int argc, char* argv []) {
     // fill result with zero to eliminate that from matrix measurements
     fill_matrix_constant(dot_product, 0.0f);
 
+    // imaginary parts of A and B and of the result for --complex
+    double (* imag_a)[N] = NULL;
+    double (* imag_b)[N] = NULL;
+    double (* imag_product)[N] = NULL;
+    if (config->complex != COMPLEX_NONE) {
+        imag_a = malloc(N * N * sizeof(double));
+        imag_b = malloc(N * N * sizeof(double));
+        imag_product = malloc(N * N * sizeof(double));
+    }
+
     if (config->in_file) {
         char *csv_file_name = valid_file('f', config->in_file);
         INFO("Reading matrix A from %s", config->in_file);
         a_desc = "from file";
-        read_csv_file(csv_file_name, matrix_a);
+        if (config->complex != COMPLEX_NONE) {
+            read_complex_matrix_file(csv_file_name, matrix_a, imag_a);
+        }
+        else {
+            read_matrix_file(csv_file_name, matrix_a);
+        }
         INFO("Finished reading matrix A from %s", config->in_file);
     }
     else {
         INFO("Generating random data for matrix A");
         a_desc = "random";
-        fill_matrix_random(matrix_a);
+        if (config->a_density > 0) {
+            INFO("Keeping %.2f%% of the random elements of A, the others zero", config->a_density * 100);
+            fill_matrix_random_sparse(matrix_a, config->a_density);
+        }
+        else if (config->a_bandwidth >= 0) {
+            INFO("Keeping the random elements of A within %d diagonals of the main one", config->a_bandwidth);
+            fill_matrix_random_band(matrix_a, config->a_bandwidth);
+        }
+        else if (config->a_tile_density > 0) {
+            INFO("Keeping %.2f%% of the random tiles of A, the others zero", config->a_tile_density * 100);
+            fill_matrix_random_tiles(matrix_a, tile_block_size(), config->a_tile_density);
+        }
+        else {
+            fill_matrix_random(matrix_a);
+        }
+        if (config->complex != COMPLEX_NONE) {
+            fill_matrix_random(imag_a);
+        }
+        if (config->trsm != TRIANGLE_NONE) {
+            // a random triangle is badly conditioned: make it diagonally dominant
+            INFO("Adding %d to the diagonal of A so the --trsm system is well conditioned", N);
+            for (size_t i = 0; i < N; i++) {
+                matrix_a[i][i] += N;
+            }
+        }
         INFO("Finished generating random data for matrix A");
     }
 
@@ -178,74 +390,243 @@ int main(int argc, char* argv []) {
         INFO("Using identity matrix for matrix B (so A . B = A . I = A)");
         b_desc = "identity";
         fill_matrix_identity(matrix_b);
+        if (config->complex != COMPLEX_NONE) {
+            fill_matrix_constant(imag_b, 0.0f);
+        }
     }
     else {
         INFO("Using 1.0-filled matrix data for matrix B");
         b_desc = "all 1.0";
         fill_matrix_constant(matrix_b, 1.0f);
+        if (config->complex != COMPLEX_NONE) {
+            INFO("Using 1.0 imaginary parts for complex matrix B (so every column of A . B is the same)");
+            fill_matrix_constant(imag_b, 1.0f);
+        }
     }
 
-    struct metrics metrics = new_metrics(config);
-    metrics.size = N;
-    metrics.omp_max_threads = omp_get_max_threads();
-    // get kind: dynamic, static, auto.. and the chunk size
-    metrics.omp_schedule_kind = 0;//omp_schedule_kind(&metnrics.omp_chunk_size);
-
-    init_papi();
-
-    int event_codes[MAX_PAPI_CODES];
-    int failed_codes[MAX_PAPI_CODES];
-    // prepare an array to store the results
-    long long papi_results[MAX_PAPI_CODES];
-    unsigned total_event_count = 0;
-
-    if (config->papi_arg) {
-        total_event_count = run_papi_loops(config->papi_arg, &metrics, event_codes, papi_results, failed_codes,
-                                           matrix_a, matrix_b, dot_product);
+    double a_density = matrix_density(matrix_a);
+    if (config->sparse == SPARSE_AUTO) {
+        config->sparse = select_sparse_format(a_density, matrix_a, matrix_b);
     }
-    else {
-        // timer loops = config->timer_loops
-        run_timer_loops(1, &metrics, matrix_a, matrix_b, dot_product);
+    prepare_sparse_storage(config->sparse, matrix_a, matrix_b);
+    if (dense_product()) {
+        prepare_epilogue(config->alpha, config->beta, config->bias, config->activation);
     }
-
-    update_metrics(&metrics);
-
-// output file is not always written: sometimes we only run for metrics and compare with test data
-    if (config->out_file) {
-        INFO("Writing output to %s", config->out_file);
-        write_csv_file(config->out_file, dot_product);
+    if (config->chain_matrices > 0 && !prepare_chain(config->chain_matrices, config->chain)) {
+        exit(1);
+    }
+    if (config->plan_file != NULL && !prepare_gemm_plan(config->plan_file, config->plan_estimate, matrix_b)) {
+        exit(1);
+    }
+    if (config->jit) {
+        prepare_jit_kernels(); // outside the timed product: compiling takes seconds, loading from the cache not
+    }
+    if (config->batch_pointers) {
+        prepare_batch_pointers(config->batch, matrix_a, matrix_b, dot_product);
+    }
+    if (config->complex != COMPLEX_NONE) {
+        prepare_complex_storage(config->complex, config->complex_layout, matrix_a, imag_a, matrix_b, imag_b);
+    }
+    else if (config->storage == STORAGE_INT8 || config->storage == STORAGE_INT16) {
+        prepare_int_storage(config->storage, matrix_a, matrix_b);
+    }
+    else if (config->storage != STORAGE_DOUBLE) {
+        prepare_half_storage(config->storage, matrix_a, matrix_b);
     }
 
-    if (config->verbose) {
-        char a_label[200];
-        char b_label[200];
-        sprintf(a_label, "A (%s)", a_desc);
-        sprintf(b_label, "B (%s)", b_desc);
+    for (int run = 0; run < implementation_count; run++) {
+        const struct implementation *implementation = find_implementation(implementation_names[run]);
+        if (implementation->prepare != NULL) {
+            implementation->prepare(); // outside the timed product: the Strassen crossover is tuned here
+        }
     }
 
-    if (config->test_file) {
-        char* test_file_name = valid_file('t', config->test_file);
-        INFO("Comparing results against test file: %s", config->test_file);
-        metrics.test_result = test_results(config, test_file_name, dot_product);
+    struct roofline roofline_peaks = {0};
+    if (config->roofline) {
+        roofline_peaks = measure_roofline_peaks(); // the same machine for every run
     }
 
-    if (config->metrics_file) {
-        // metrics file may or may not already exist
-        INFO("Reporting metrics to: %s", config->metrics_file);
-        write_metrics_file(config->metrics_file, &metrics,
-                           total_event_count, event_codes, papi_results, failed_codes);
+    // --compare: one run, and one metrics row, per implementation, all on the A and B prepared above
+    for (int run = 0; run < implementation_count; run++) {
+        if (run > 0) {
+            select_implementation(implementation_names[run]);
+            INFO("Comparing the %s implementation", implementation_names[run]);
+        }
+        struct metrics metrics = new_metrics(config);
+        metrics.size = N;
+        metrics.a_density = a_density;
+        if (config->chain_matrices > 0) {
+            chain_metrics(&metrics);
+        }
+        if (config->plan_file != NULL) {
+            gemm_plan_metrics(&metrics);
+        }
+        metrics.omp_max_threads = omp_get_max_threads();
+        // get kind: dynamic, static, auto.. and the chunk size
+        metrics.omp_schedule_kind = 0;//omp_schedule_kind(&metnrics.omp_chunk_size);
+
+        init_counters();
+
+        int event_codes[MAX_PAPI_CODES];
+        int failed_codes[MAX_PAPI_CODES];
+        // prepare an array to store the results
+        long long papi_results[MAX_PAPI_CODES];
+        unsigned total_event_count = 0;
+
+        if (config->papi_arg && config->multiplex) {
+            total_event_count = run_multiplexed_papi(config->papi_arg, &metrics, event_codes, papi_results, failed_codes,
+                                                     matrix_a, matrix_b, dot_product);
+        }
+        else if (config->papi_arg) {
+            total_event_count = run_papi_loops(config->papi_arg, &metrics, event_codes, papi_results, failed_codes,
+                                               matrix_a, matrix_b, dot_product);
+        }
+        else {
+            // timer loops = config->timer_loops
+            run_timer_loops(1, &metrics, matrix_a, matrix_b, dot_product);
+        }
+
+        update_metrics(&metrics);
+        if (general_shape() && metrics.total_micro_seconds > 0) {
+            metrics.bytes_per_second = general_bytes() * 1e6 / (double)metrics.total_micro_seconds;
+        }
+
+        if (config->complex == COMPLEX_3M) {
+            INFO("Running the 4m complex product to measure the accuracy loss");
+            compare_complex_with_4m(&metrics);
+        }
+        else if (config->chain_matrices > 0) {
+            INFO("Multiplying the chain left to right to measure the accuracy of the planned order");
+            double (* reference)[N] = malloc(N * N * sizeof(double));
+            fill_matrix_constant(reference, 0.0f);
+            chain_reference(reference);
+            compare_with_double_path(&metrics, dot_product, reference);
+            free(reference);
+        }
+        else if (epilogue_configured()) {
+            INFO("Running the product with the epilogue in separate passes to measure the accuracy of the fused one");
+            double (* reference)[N] = malloc(N * N * sizeof(double));
+            struct epilogue fused = gemm_epilogue, accumulate = EPILOGUE_ACCUMULATE;
+            prepare_result(reference);
+            epilogue_begin(&fused, reference);
+            gemm_epilogue = accumulate;
+            dot_multiply_matrices(config->loop_order, matrix_a, matrix_b, reference);
+            gemm_epilogue = fused;
+            epilogue_end(&fused, reference);
+            compare_with_double_path(&metrics, dot_product, reference);
+            free(reference);
+        }
+        else if (config->trsm != TRIANGLE_NONE) {
+            INFO("Multiplying the solution by the triangle of A to measure the residual against B");
+            double (* reference)[N] = malloc(N * N * sizeof(double));
+            fill_matrix_constant(reference, 0.0f);
+            dot_multiply_matrices_trmm(config->trsm, matrix_a, dot_product, reference);
+            compare_with_double_path(&metrics, reference, matrix_b);
+            free(reference);
+        }
+        else if (accuracy_compared()) {
+            INFO("Running the double path to measure the accuracy loss");
+            double (* reference)[N] = malloc(N * N * sizeof(double));
+            fill_matrix_constant(reference, 0.0f);
+            dot_multiply_matrices(config->loop_order, matrix_a, matrix_b, reference);
+            compare_with_double_path(&metrics, dot_product, reference);
+            free(reference);
+        }
+        if (config->complex != COMPLEX_NONE) {
+            complex_result(dot_product, imag_product);
+        }
+
+        if (config->roofline) {
+            long long l3_misses = counted_event("PAPI_L3_TCM", total_event_count, event_codes, papi_results, failed_codes);
+            place_roofline(&metrics, &roofline_peaks, l3_misses);
+        }
+
+        // output file is not always written: sometimes we only run for metrics and compare with test data
+        if (config->out_file) {
+            INFO("Writing output to %s", config->out_file);
+            if (config->complex != COMPLEX_NONE) {
+                write_complex_matrix_file(config->out_file, dot_product, imag_product);
+            }
+            else {
+                write_matrix_file(config->out_file, dot_product);
+            }
+        }
+
+        if (config->verbose) {
+            char a_label[200];
+            char b_label[200];
+            sprintf(a_label, "A (%s)", a_desc);
+            sprintf(b_label, "B (%s)", b_desc);
+        }
+
+        if (config->test_file) {
+            char* test_file_name = valid_file('t', config->test_file);
+            INFO("Comparing results against test file: %s", config->test_file);
+            if (config->complex != COMPLEX_NONE) {
+                metrics.test_result = test_complex_results(config, test_file_name, dot_product, imag_product);
+            }
+            else {
+                metrics.test_result = test_results(config, test_file_name, dot_product);
+            }
+        }
+
+        if (config->trace_file) {
+            // one trace per implementation with --compare, named after it
+            write_trace_file(config->trace_file, implementation_count > 1 ? implementation_names[run] : NULL);
+        }
+
+        if (config->metrics_file) {
+            // metrics file may or may not already exist
+            INFO("Reporting metrics to: %s", config->metrics_file);
+            write_metrics_file(config->metrics_file, &metrics,
+                               total_event_count, event_codes, papi_results, failed_codes);
+        }
+
+        if (!config->silent) {
+            print_metrics_headers(stdout, total_event_count, event_codes);
+            print_metrics(stdout, &metrics, total_event_count, papi_results);
+            describe_counter_events(total_event_count, event_codes, papi_results, failed_codes);
+            if (config->thread_counters) {
+                describe_thread_counters(total_event_count, event_codes);
+            }
+            printf("\n");
+            if (metrics.implementation[0] != '\0') {
+                printf("Implementation   : %s\n", metrics.implementation);
+            }
+            printf("Time to multiply : %0lld microseconds (%.2f s)\n", metrics.total_micro_seconds, metrics.total_seconds);
+            printf("FLOPs counted    : %ld\n", metrics.flops);
+            printf("FLOPs/second     : %0f\n", metrics.flops_per_second);
+            if (general_shape() && general_streaming()) {
+                printf("Bandwidth        : %.3f GB/s (A, B and the result once / time)\n", metrics.bytes_per_second / 1e9);
+            }
+            else {
+                printf("Effective GFLOP/s: %.3f (%s / time)\n", effective_gflops(&metrics),
+                       general_shape() ? "2 rows cols N" : config->batch > 0 ? "2N^2 x batch"
+                       : config->chain_matrices > 0 ? "left to right chain"
+                       : config->trmm != TRIANGLE_NONE || config->trsm != TRIANGLE_NONE ? "N^3"
+                       : config->syrk != TRIANGLE_NONE ? "N^2(N+1)"
+                       : config->complex != COMPLEX_NONE ? "8N^3" : "2N^3");
+            }
+            if (config->roofline) {
+                describe_roofline(&metrics.roofline);
+            }
+            printf("\n");
+            printf("(hide these messages with --silent)\n");
+            printf("\n");
+        }
+        release_counters();
     }
 
-    if (!config->silent) {
-        print_metrics_headers(stdout, total_event_count, event_codes);
-        print_metrics(stdout, &metrics, total_event_count, papi_results);
-        describe_papi_events(total_event_count, event_codes, papi_results, failed_codes);
-        printf("\nTime to multiply : %0lld microseconds (%.2f s)\n", metrics.total_micro_seconds, metrics.total_seconds);
-        printf("FLOPs counted    : %ld\n", metrics.flops);
-        printf("FLOPs/second     : %0f\n", metrics.flops_per_second);
-        printf("\n");
-        printf("(hide these messages with --silent)\n");
-        printf("\n");
+    release_half_storage();
+    release_int_storage();
+    release_batch_pointers();
+    release_jit_kernels();
+    release_sparse_storage();
+    release_chain();
+    release_gemm_plan();
+    release_epilogue();
+    if (config->complex != COMPLEX_NONE) {
+        release_complex_storage();
     }
 
     INFO("Matrix run completed");
@@ -6,6 +6,7 @@
 #include <getopt.h>
 #include <omp.h>
 #include <string.h>
+#include <stdint.h>
 #include "matrix_types.h"
 
 
@@ -16,6 +17,14 @@ extern struct config new_config();
 extern struct metrics new_metrics();
 extern void usage();
 
+extern char* precision_name(enum precision precision);
+extern char* storage_name(enum storage storage);
+extern char* complex_name(enum complex_algorithm complex);
+extern char* triangle_name(enum triangle triangle);
+extern char* sparse_format_name(enum sparse_format format);
+extern char* bias_name(enum bias_vector bias);
+extern char* activation_name(enum activation activation);
+extern char* complex_layout_name(enum complex_layout layout);
 extern char* valid_file(char opt, char *filename);
 extern int valid_count(char opt, char *arg);
 extern void validate_config(struct config config);
@@ -26,6 +35,70 @@ extern void progress_end(int rows);
 
 extern struct config parse_cli(int argc, char *argv[]);
 
+// mark the phases of a kernel for the per-thread counters (no-ops unless --thread-counters)
+extern void phase_begin(enum counter_phase phase);
+extern void phase_end(enum counter_phase phase);
+
+// record tiles for the --trace timeline (trace_now returns 0 unless tracing)
+extern double trace_now();
+extern void trace_tile(double created, double start, int ii, int jj, int kk);
+
+// 16 bit copies of A and B for --storage fp16|bf16 (matrix_half.c)
+extern void prepare_half_storage(enum storage storage, double matrix1[][N], double matrix2[][N]);
+extern void release_half_storage();
+
+// quantized copies of A and B for --storage int8|int16 (matrix_int.c)
+extern void prepare_int_storage(enum storage storage, double matrix1[][N], double matrix2[][N]);
+extern void release_int_storage();
+
+// complex copies of A and B for --complex 4m|3m in the --complex-layout (matrix_complex.c)
+extern void prepare_complex_storage(enum complex_algorithm algorithm, enum complex_layout layout,
+                                    double a_real[][N], double a_imag[][N], double b_real[][N], double b_imag[][N]);
+extern void complex_result(double real[][N], double imag[][N]);
+extern void compare_complex_with_4m(struct metrics *metrics);
+extern void release_complex_storage();
+
+// tiles of A, B and the result for the --batch-pointers products (matrix_batch.c)
+extern void prepare_batch_pointers(size_t size, double matrix1[][N], double matrix2[][N], double result[][N]);
+extern void release_batch_pointers();
+
+// kernels generated for the shape for --jit (matrix_jit.c), false when they are not available
+extern bool prepare_jit_kernels();
+extern void release_jit_kernels();
+// FNV-1a hash of the CPU model and flags, which names the cached kernels and tags the saved plans
+extern uint64_t jit_hash_cpu(uint64_t hash);
+
+// the shape of the --a-rows / --b-cols product (matrix_general.c)
+extern bool general_streaming();
+extern double general_bytes();
+
+// density of A and its CSR / CSC copy or the map of its non-zero tiles for --sparse (matrix_sparse.c)
+extern double matrix_density(double matrix[][N]);
+extern enum sparse_format select_sparse_format(double density, double matrix1[][N], double matrix2[][N]);
+extern void prepare_sparse_storage(enum sparse_format format, double matrix1[][N], double matrix2[][N]);
+extern void release_sparse_storage();
+// diagonals of A and B for --sparse band (matrix_band.c)
+extern void matrix_bandwidth(double matrix[][N], size_t *lower, size_t *upper);
+extern double band_relative_cost(double matrix1[][N], double matrix2[][N]);
+extern void prepare_band_storage(double matrix1[][N], double matrix2[][N]);
+extern void release_band_storage();
+// the planned --chain of random matrices and its workspace (matrix_chain.c)
+extern bool prepare_chain(int count, const int dims[]);
+extern void chain_metrics(struct metrics *metrics);
+extern void chain_reference(double reference[][N]);
+extern void release_chain();
+// the implementations of the double A . B, side by side, and the one dot_multiply_matrices runs (matrix_registry.c)
+extern const struct implementation *implementations(int *count);
+extern const struct implementation *find_implementation(const char *name);
+extern bool select_implementation(const char *name);
+extern const struct implementation *selected_implementation();
+// the --plan of the double A . B and B packed for it (matrix_plan.c)
+extern bool prepare_gemm_plan(const char *path, bool estimate, double matrix2[][N]);
+extern void gemm_plan_metrics(struct metrics *metrics);
+extern void release_gemm_plan();
+// false when --sparse blocks found the A tile (ii, kk) or the B tile read for (kk, jj) all zero
+extern bool block_tiles_productive(size_t ii, size_t jj, size_t kk);
+
 // help with debugging OMP
 #ifdef MATRIX_OMP
 extern int omp_schedule_kind(int *chunk_size);
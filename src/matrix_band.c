@@ -0,0 +1,184 @@
+#include "matrix.h"
+#include "matrix_types.h"
+
+/*
+ * Banded A for --sparse band, linked into every implementation.
+ *
+ * A matrix is banded when its non-zeros lie within lower diagonals below and upper diagonals above the
+ * main one: identity and diagonal matrices, finite-difference operators. The band is stored row by row,
+ * lower + upper + 1 values per row, element (i, k) at values[i * width + k - i + lower]. Both the
+ * bandwidths are found by scanning the loaded matrices, so the files need no format of their own.
+ *
+ * A banded times a dense B adds the in-band a_ik B[k] to each row i: 2 N^2 width flops. When B is banded
+ * too (the identity) the product is banded with the sum of the bandwidths, and each in-band a_ik only
+ * adds the in-band part of row k of B: 2 N width_a width_b flops. Every row of the band costs the same
+ * (but the few rows at the corners), so the rows are split statically into one contiguous range per
+ * thread.
+ */
+
+// bands of B up to this fraction of N run band x band, wider ones band x dense
+#define BAND_MAX_B_FRACTION 0.5
+// speed of the band kernels relative to the blocked dense ones: the rows of B a row of the band reads
+// are mostly the ones the previous row read, so they come from the caches (measured about 0.9)
+#define BAND_RELATIVE_RATE 0.8
+
+struct band_matrix {
+    size_t lower;
+    size_t upper;
+    size_t width; // lower + upper + 1
+    double *values;
+};
+
+static struct {
+    struct band_matrix a;
+    struct band_matrix b; // values NULL when B runs dense
+} band = { { 0, 0, 0, NULL }, { 0, 0, 0, NULL } };
+
+/**
+ * Find the number of diagonals below and above the main one that hold the non-zeros of the matrix
+ */
+void matrix_bandwidth(double matrix[][N], size_t *lower, size_t *upper)
+{
+    size_t below = 0, above = 0;
+#pragma omp parallel for reduction(max:below, above)
+    for (size_t i = 0; i < N; i++) {
+        size_t first = 0, last = N;
+        while (first < N && matrix[i][first] == 0) {
+            first++;
+        }
+        while (last > first && matrix[i][last - 1] == 0) {
+            last--;
+        }
+        if (first < last) {
+            below = MAX(below, first < i ? i - first : 0);
+            above = MAX(above, last - 1 > i ? last - 1 - i : 0);
+        }
+    }
+    *lower = below;
+    *upper = above;
+}
+
+static struct band_matrix band_storage(double matrix[][N], size_t lower, size_t upper)
+{
+    struct band_matrix stored = { lower, upper, lower + upper + 1, NULL };
+    stored.values = calloc(N * stored.width, sizeof(double));
+    for (size_t i = 0; i < N; i++) {
+        size_t first = i > lower ? i - lower : 0, last = MIN(i + upper + 1, (size_t)N);
+        for (size_t k = first; k < last; k++) {
+            stored.values[i * stored.width + k + lower - i] = matrix[i][k];
+        }
+    }
+    return stored;
+}
+
+/**
+ * Estimated cost of the band product relative to the dense one: the in-band flops at BAND_RELATIVE_RATE
+ */
+double band_relative_cost(double matrix1[][N], double matrix2[][N])
+{
+    size_t a_lower, a_upper, b_lower, b_upper;
+    matrix_bandwidth(matrix1, &a_lower, &a_upper);
+    matrix_bandwidth(matrix2, &b_lower, &b_upper);
+    double width_a = (double)(a_lower + a_upper + 1), width_b = (double)(b_lower + b_upper + 1);
+    if (width_b <= BAND_MAX_B_FRACTION * N) {
+        return width_a * width_b / ((double)N * N) / BAND_RELATIVE_RATE;
+    }
+    return width_a / N / BAND_RELATIVE_RATE;
+}
+
+void release_band_storage()
+{
+    free(band.a.values);
+    free(band.b.values);
+    memset(&band, 0, sizeof(band));
+}
+
+/**
+ * Store the band of A, and of B when it is narrow enough for the band x band product
+ */
+void prepare_band_storage(double matrix1[][N], double matrix2[][N])
+{
+    release_band_storage();
+    size_t lower, upper;
+    matrix_bandwidth(matrix1, &lower, &upper);
+    band.a = band_storage(matrix1, lower, upper);
+    matrix_bandwidth(matrix2, &lower, &upper);
+    if (lower + upper + 1 <= BAND_MAX_B_FRACTION * N) {
+        band.b = band_storage(matrix2, lower, upper);
+        INFO("Stored A with %zu lower and %zu upper diagonals, B with %zu and %zu", band.a.lower, band.a.upper,
+             band.b.lower, band.b.upper);
+    }
+    else {
+        INFO("Stored A with %zu lower and %zu upper diagonals, B dense", band.a.lower, band.a.upper);
+    }
+}
+
+static void band_times_dense(size_t first, size_t last, double matrix2[][N], double result[][N])
+{
+    struct band_matrix a = band.a;
+    for (size_t i = first; i < last; i++) {
+        size_t k_first = i > a.lower ? i - a.lower : 0, k_last = MIN(i + a.upper + 1, (size_t)N);
+        const double *a_row = &a.values[i * a.width + a.lower - i]; // a_row[k] is A[i][k]
+        double *restrict c = result[i];
+        for (size_t k = k_first; k < k_last; k++) {
+            double a_ik = a_row[k];
+            const double *restrict b = matrix2[k];
+#pragma omp simd
+            for (size_t j = 0; j < N; j++) {
+                c[j] += a_ik * b[j];
+            }
+        }
+    }
+}
+
+static void band_times_band(size_t first, size_t last, double result[][N])
+{
+    struct band_matrix a = band.a, b = band.b;
+    for (size_t i = first; i < last; i++) {
+        size_t k_first = i > a.lower ? i - a.lower : 0, k_last = MIN(i + a.upper + 1, (size_t)N);
+        const double *a_row = &a.values[i * a.width + a.lower - i];
+        double *restrict c = result[i];
+        for (size_t k = k_first; k < k_last; k++) {
+            double a_ik = a_row[k];
+            size_t j_first = k > b.lower ? k - b.lower : 0, j_last = MIN(k + b.upper + 1, (size_t)N);
+            const double *restrict b_row = &b.values[k * b.width + b.lower - k]; // b_row[j] is B[k][j]
+#pragma omp simd
+            for (size_t j = j_first; j < j_last; j++) {
+                c[j] += a_ik * b_row[j];
+            }
+        }
+    }
+}
+
+/**
+ * Multiply the band of A made by prepare_band_storage by B, or by the band of B
+ *
+ * IMPORTANT: The result matrix must be zeroed for this function to succeed
+ *
+ * @param result preallocated zeroed matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_band(double matrix2[][N], double result[][N])
+{
+    if (band.a.values == NULL) {
+        ERROR("The band of A was not prepared");
+        return MATRIX_FAILED;
+    }
+    INFO("Running matrix_mult %d x %d on the band of A (%zu diagonals) times %s", N, N, band.a.width,
+         band.b.values != NULL ? "the band of B" : "B");
+#pragma omp parallel
+    {
+        // one contiguous range of rows per thread: the rows cost the same
+        size_t threads = omp_get_num_threads(), thread = omp_get_thread_num();
+        size_t first = N * thread / threads, last = N * (thread + 1) / threads;
+        phase_begin(PHASE_KERNEL);
+        if (band.b.values != NULL) {
+            band_times_band(first, last, result);
+        }
+        else {
+            band_times_dense(first, last, matrix2, result);
+        }
+        phase_end(PHASE_KERNEL);
+    }
+    return 1; // forget about flops - we'll add it from known values
+}
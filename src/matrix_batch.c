@@ -0,0 +1,199 @@
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_batch.h"
+
+/*
+ * Batched small matrix products for --batch, linked into every implementation.
+ *
+ * One call of dot_multiply_matrices per 4 x 4 product would be all overhead: the parallel region,
+ * the checks and the loop set up of a kernel written for 4096 x 4096. Here the kernel is chosen once
+ * per batch and the batch is spread over the threads in a single parallel loop, each product running
+ * start to end on one thread with no synchronization.
+ *
+ * The kernels for the common sizes (4, 8, 16, 32 and 64) are stamped out by BATCH_KERNEL with the
+ * size as a compile time constant, so the compiler fully unrolls the j loop into vector registers:
+ * a row of C is accumulated in registers over the k loop and stored once. Other sizes run the same
+ * code with the size as a variable.
+ *
+ * The driver cuts A and B into (N / size)^2 small matrices: contiguous size x size matrices back to back
+ * for the strided API (the usual packed batch layout) or the size x size tiles of A and B in place for
+ * the array of pointers API (--batch-pointers).
+ */
+
+typedef void (*batch_kernel)(size_t size, const double *restrict a, const double *restrict b,
+                             double *restrict c, size_t ld);
+
+#define BATCH_KERNEL(S) \
+static void batch_kernel_##S(size_t size, const double *restrict a, const double *restrict b, \
+                             double *restrict c, size_t ld) \
+{ \
+    (void)size; \
+    for (size_t i = 0; i < S; i++) { \
+        double row[S]; \
+        for (size_t j = 0; j < S; j++) { \
+            row[j] = a[i * ld] * b[j]; \
+        } \
+        for (size_t k = 1; k < S; k++) { \
+            double a_ik = a[i * ld + k]; \
+            const double *b_row = b + k * ld; \
+            for (size_t j = 0; j < S; j++) { \
+                row[j] += a_ik * b_row[j]; \
+            } \
+        } \
+        for (size_t j = 0; j < S; j++) { \
+            c[i * ld + j] = row[j]; \
+        } \
+    } \
+}
+
+BATCH_KERNEL(4)
+BATCH_KERNEL(8)
+BATCH_KERNEL(16)
+BATCH_KERNEL(32)
+BATCH_KERNEL(64)
+
+static void batch_kernel_generic(size_t size, const double *restrict a, const double *restrict b,
+                                 double *restrict c, size_t ld)
+{
+    for (size_t i = 0; i < size; i++) {
+        double *c_row = c + i * ld;
+        for (size_t j = 0; j < size; j++) {
+            c_row[j] = a[i * ld] * b[j];
+        }
+        for (size_t k = 1; k < size; k++) {
+            double a_ik = a[i * ld + k];
+            const double *b_row = b + k * ld;
+            for (size_t j = 0; j < size; j++) {
+                c_row[j] += a_ik * b_row[j];
+            }
+        }
+    }
+}
+
+static batch_kernel select_batch_kernel(size_t size)
+{
+    switch (size) {
+        case 4: return batch_kernel_4;
+        case 8: return batch_kernel_8;
+        case 16: return batch_kernel_16;
+        case 32: return batch_kernel_32;
+        case 64: return batch_kernel_64;
+        default: return batch_kernel_generic;
+    }
+}
+
+int batch_specialized(size_t size)
+{
+    return select_batch_kernel(size) != batch_kernel_generic;
+}
+
+void batch_gemm(size_t size, size_t count, const double *const a[], const double *const b[],
+                double *const c[], size_t ld)
+{
+    batch_kernel kernel = select_batch_kernel(size);
+#pragma omp parallel
+    {
+        phase_begin(PHASE_KERNEL);
+#pragma omp for schedule(static)
+        for (size_t t = 0; t < count; t++) {
+            kernel(size, a[t], b[t], c[t], ld);
+        }
+        phase_end(PHASE_KERNEL);
+    }
+}
+
+void batch_gemm_strided(size_t size, size_t count, const double *a, const double *b, double *c,
+                        size_t ld, size_t stride)
+{
+    batch_kernel kernel = select_batch_kernel(size);
+#pragma omp parallel
+    {
+        phase_begin(PHASE_KERNEL);
+#pragma omp for schedule(static)
+        for (size_t t = 0; t < count; t++) {
+            kernel(size, a + t * stride, b + t * stride, c + t * stride, ld);
+        }
+        phase_end(PHASE_KERNEL);
+    }
+}
+
+static struct {
+    size_t count;
+    const double **a;
+    const double **b;
+    double **c;
+} batch_pointers = { 0, NULL, NULL, NULL };
+
+static size_t batch_count(size_t size)
+{
+    return (N / size) * (N / size);
+}
+
+/**
+ * Build the arrays of pointers to the size x size tiles of A, B and the result for --batch-pointers
+ */
+void prepare_batch_pointers(size_t size, double matrix1[][N], double matrix2[][N], double result[][N])
+{
+    release_batch_pointers();
+    size_t tiles = N / size;
+    batch_pointers.count = batch_count(size);
+    batch_pointers.a = malloc(batch_pointers.count * sizeof(double *));
+    batch_pointers.b = malloc(batch_pointers.count * sizeof(double *));
+    batch_pointers.c = malloc(batch_pointers.count * sizeof(double *));
+    if (batch_pointers.a == NULL || batch_pointers.b == NULL || batch_pointers.c == NULL) {
+        ERROR("Could not allocate the pointers to the %zu batch matrices", batch_pointers.count);
+        exit(1);
+    }
+    for (size_t ti = 0; ti < tiles; ti++) {
+        for (size_t tj = 0; tj < tiles; tj++) {
+            size_t t = ti * tiles + tj;
+            batch_pointers.a[t] = &matrix1[ti * size][tj * size];
+            batch_pointers.b[t] = &matrix2[ti * size][tj * size];
+            batch_pointers.c[t] = &result[ti * size][tj * size];
+        }
+    }
+}
+
+void release_batch_pointers()
+{
+    free(batch_pointers.a);
+    free(batch_pointers.b);
+    free(batch_pointers.c);
+    batch_pointers.a = NULL;
+    batch_pointers.b = NULL;
+    batch_pointers.c = NULL;
+    batch_pointers.count = 0;
+}
+
+/**
+ * Run the batch of (N / size)^2 products of size x size matrices cut out of A and B
+ *
+ * Strided: A, B and the result are read as contiguous size x size matrices one after the other.
+ * Pointers: the tiles of A, B and the result listed by prepare_batch_pointers.
+ * The result does not need to be zeroed: it is overwritten.
+ *
+ * @param result preallocated matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_batch(size_t size, bool pointers, double matrix1[][N], double matrix2[][N],
+                                 double result[][N])
+{
+    if (size == 0 || N % size != 0) {
+        ERROR("The batch matrix size %zu must divide %d", size, N);
+        return MATRIX_FAILED;
+    }
+    size_t count = batch_count(size);
+    INFO("Running a batch of %zu matrix_mult %zu x %zu (%s, %s kernel)", count, size, size,
+         pointers ? "array of pointers" : "strided", batch_specialized(size) ? "unrolled" : "generic");
+    if (pointers) {
+        if (batch_pointers.count != count) {
+            ERROR("No batch pointers for size %zu: call prepare_batch_pointers first", size);
+            return MATRIX_FAILED;
+        }
+        batch_gemm(size, count, batch_pointers.a, batch_pointers.b, batch_pointers.c, N);
+    }
+    else {
+        batch_gemm_strided(size, count, &matrix1[0][0], &matrix2[0][0], &result[0][0], size, size * size);
+    }
+    return 1; // forget about flops - we'll add it from known values
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Batched products of many independent small square matrices (4 x 4 to 64 x 64). See matrix_batch.c.
+ *
+ * Each product is C = A . B (C is overwritten) with the matrices size x size, row-major with a
+ * leading dimension ld >= size. The batch is spread over the threads, each product runs on one thread.
+ */
+
+// array of pointers: product t is c[t] = a[t] . b[t]
+extern void batch_gemm(size_t size, size_t count, const double *const a[], const double *const b[],
+                       double *const c[], size_t ld);
+
+// strided batch: product t is at a + t * stride, b + t * stride and c + t * stride
+extern void batch_gemm_strided(size_t size, size_t count, const double *a, const double *b, double *c,
+                               size_t ld, size_t stride);
+
+// true when size has an unrolled kernel
+extern int batch_specialized(size_t size);
@@ -0,0 +1,294 @@
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_tiles.h"
+
+/*
+ * Matrix chain products for --chain d0,d1,...,dn, linked into every implementation: the product of n
+ * random matrices, the i-th of d(i-1) x d(i), into the top left d0 x dn of the result.
+ *
+ * The order of the products changes the work by orders of magnitude when the dimensions differ, so it is
+ * planned by dynamic programming over the sub-chains: the cost of a sub-chain is the best over its split
+ * points of the costs of the two halves plus their product, the flops 2 rows inner cols and the traffic
+ * of the intermediate result (written once, read once), at CHAIN_FLOPS_PER_BYTE, so of two orders with
+ * the same flops the one with the smaller intermediates wins.
+ *
+ * The products run in post order of the plan on tile_gemm, the intermediates in a single workspace arena.
+ * Each intermediate lives from the product that makes it to the one that reads it, and the intermediates
+ * whose lives overlap must not share memory: their offsets are assigned largest first, each at the lowest
+ * offset clear of the overlapping ones already placed, so the arena is usually far smaller than the sum
+ * of the intermediates. The last product is written straight into the result.
+ *
+ * The planned cost is reported against the naive left to right order, which is also the reference the
+ * result is checked against.
+ */
+
+#define CHAIN_FLOPS_PER_BYTE 4.0 // flops worth one byte of intermediate traffic, about a machine balance
+
+// an operand of a product: input matrix i for i >= 0, else the result of step -(operand + 1)
+#define CHAIN_INPUT(i) (i)
+#define CHAIN_STEP(s) (-(s) - 1)
+
+struct chain_step {
+    int left;
+    int right;
+    size_t rows;
+    size_t inner;
+    size_t cols;
+    int consumer; // step that reads the result, the number of steps for the final one
+    size_t offset; // in the arena, in doubles
+};
+
+static struct {
+    int count;
+    size_t dims[CHAIN_MAX_MATRICES + 1];
+    int split[CHAIN_MAX_MATRICES][CHAIN_MAX_MATRICES];
+    double *inputs[CHAIN_MAX_MATRICES];
+    struct chain_step steps[CHAIN_MAX_MATRICES];
+    int step_count;
+    double *arena;
+    size_t arena_size; // doubles
+    double planned_flops;
+    double naive_flops;
+    double intermediate_bytes; // sum of the intermediates of the plan, without reuse
+    double naive_bytes;        // sum of the intermediates of the left to right order
+    char order[CHAIN_ORDER_LENGTH];
+} chain;
+
+static double product_flops(size_t rows, size_t inner, size_t cols)
+{
+    return 2.0 * (double)rows * (double)inner * (double)cols;
+}
+
+/**
+ * Fill split[i][j] with the best split point of the sub-chain of the matrices i to j
+ */
+static void plan_order()
+{
+    double cost[CHAIN_MAX_MATRICES][CHAIN_MAX_MATRICES];
+    int n = chain.count;
+    for (int i = 0; i < n; i++) {
+        cost[i][i] = 0;
+    }
+    for (int length = 2; length <= n; length++) {
+        for (int i = 0; i + length - 1 < n; i++) {
+            int j = i + length - 1;
+            cost[i][j] = -1;
+            for (int k = i; k < j; k++) {
+                double rows = chain.dims[i], inner = chain.dims[k + 1], cols = chain.dims[j + 1];
+                double traffic = length < n ? 2 * rows * cols * sizeof(double) : 0; // the final one is not
+                double total = cost[i][k] + cost[k + 1][j] + product_flops(rows, inner, cols)
+                               + CHAIN_FLOPS_PER_BYTE * traffic;
+                if (cost[i][j] < 0 || total < cost[i][j]) {
+                    cost[i][j] = total;
+                    chain.split[i][j] = k;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Append the products of the sub-chain i to j to the steps in post order, and its parenthesization
+ * to the order string
+ *
+ * @return the operand holding the product of the sub-chain
+ */
+static int plan_steps(int i, int j, size_t *order_length)
+{
+    if (i == j) {
+        *order_length += snprintf(chain.order + *order_length, sizeof(chain.order) - *order_length, "A%d", i + 1);
+        return CHAIN_INPUT(i);
+    }
+    int k = chain.split[i][j];
+    *order_length += snprintf(chain.order + *order_length, sizeof(chain.order) - *order_length, "(");
+    int left = plan_steps(i, k, order_length);
+    int right = plan_steps(k + 1, j, order_length);
+    *order_length += snprintf(chain.order + *order_length, sizeof(chain.order) - *order_length, ")");
+    int step = chain.step_count++;
+    struct chain_step planned = { left, right, chain.dims[i], chain.dims[k + 1], chain.dims[j + 1], 0, 0 };
+    chain.steps[step] = planned;
+    chain.planned_flops += product_flops(planned.rows, planned.inner, planned.cols);
+    for (int operand = 0; operand < 2; operand++) {
+        int read = operand == 0 ? left : right;
+        if (read < 0) {
+            chain.steps[-read - 1].consumer = step;
+        }
+    }
+    return CHAIN_STEP(step);
+}
+
+static size_t step_size(int step)
+{
+    return chain.steps[step].rows * chain.steps[step].cols;
+}
+
+/**
+ * Place the intermediates in the arena, largest first, each at the lowest offset clear of the placed
+ * intermediates whose lives overlap its own
+ */
+static void plan_arena()
+{
+    int intermediates = chain.step_count - 1; // the last step writes the result
+    int by_size[CHAIN_MAX_MATRICES];
+    bool placed[CHAIN_MAX_MATRICES] = { false };
+    for (int s = 0; s < intermediates; s++) {
+        by_size[s] = s;
+        chain.intermediate_bytes += (double)step_size(s) * sizeof(double);
+    }
+    for (int a = 1; a < intermediates; a++) {
+        for (int b = a; b > 0 && step_size(by_size[b]) > step_size(by_size[b - 1]); b--) {
+            int swap = by_size[b];
+            by_size[b] = by_size[b - 1];
+            by_size[b - 1] = swap;
+        }
+    }
+    chain.arena_size = 0;
+    for (int p = 0; p < intermediates; p++) {
+        int s = by_size[p];
+        size_t size = step_size(s), offset = 0;
+        bool moved = true;
+        while (moved) {
+            moved = false;
+            for (int other = 0; other < intermediates; other++) {
+                bool overlapping_lives = s <= chain.steps[other].consumer && other <= chain.steps[s].consumer;
+                size_t other_end = chain.steps[other].offset + step_size(other);
+                if (placed[other] && overlapping_lives && offset < other_end
+                    && chain.steps[other].offset < offset + size) {
+                    offset = other_end;
+                    moved = true;
+                }
+            }
+        }
+        chain.steps[s].offset = offset;
+        placed[s] = true;
+        chain.arena_size = MAX(chain.arena_size, offset + size);
+    }
+}
+
+void release_chain()
+{
+    for (int i = 0; i < chain.count; i++) {
+        free(chain.inputs[i]);
+    }
+    free(chain.arena);
+    memset(&chain, 0, sizeof(chain));
+}
+
+/**
+ * Plan the product of the chain of matrices of the given dimensions and make random matrices for it
+ *
+ * @param count number of matrices, dims has count + 1 entries
+ * @return false if the memory could not be allocated
+ */
+bool prepare_chain(int count, const int dims[])
+{
+    release_chain();
+    chain.count = count;
+    for (int i = 0; i <= count; i++) {
+        chain.dims[i] = dims[i];
+    }
+    for (int i = 1; i < count; i++) {
+        chain.naive_flops += product_flops(chain.dims[0], chain.dims[i], chain.dims[i + 1]);
+        if (i + 1 < count) {
+            chain.naive_bytes += (double)chain.dims[0] * chain.dims[i + 1] * sizeof(double);
+        }
+    }
+    plan_order();
+    size_t order_length = 0;
+    plan_steps(0, count - 1, &order_length);
+    chain.steps[chain.step_count - 1].consumer = chain.step_count;
+    plan_arena();
+
+    for (int i = 0; i < count; i++) {
+        chain.inputs[i] = malloc(chain.dims[i] * chain.dims[i + 1] * sizeof(double));
+        if (chain.inputs[i] == NULL) {
+            ERROR("Could not allocate matrix %d of the chain", i + 1);
+            return false;
+        }
+        for (size_t e = 0; e < chain.dims[i] * chain.dims[i + 1]; e++) {
+            chain.inputs[i][e] = ((double) rand()) / ((float) RAND_MAX);
+        }
+    }
+    chain.arena = malloc(MAX(chain.arena_size, 1) * sizeof(double));
+    if (chain.arena == NULL) {
+        ERROR("Could not allocate the %zu MB chain arena", chain.arena_size * sizeof(double) >> 20);
+        return false;
+    }
+    INFO("Chain of %d matrices in the order %s: %.3f GFLOPs (left to right %.3f), arena %.3f MB "
+         "(intermediates %.3f MB, left to right %.3f MB)", count, chain.order, chain.planned_flops / 1e9,
+         chain.naive_flops / 1e9, (double)chain.arena_size * sizeof(double) / 1e6, chain.intermediate_bytes / 1e6,
+         chain.naive_bytes / 1e6);
+    return true;
+}
+
+/**
+ * Report the plan in the metrics
+ */
+void chain_metrics(struct metrics *metrics)
+{
+    strcpy(metrics->chain_order, chain.order);
+    metrics->chain_flops = chain.planned_flops;
+    metrics->chain_naive_flops = chain.naive_flops;
+    metrics->chain_arena_bytes = (double)chain.arena_size * sizeof(double);
+    metrics->chain_naive_bytes = chain.naive_bytes;
+}
+
+static struct tile_matrix operand_view(int operand, size_t cols)
+{
+    struct tile_matrix view = { operand >= 0 ? chain.inputs[operand] : chain.arena + chain.steps[-operand - 1].offset,
+                                cols, 1 };
+    return view;
+}
+
+/**
+ * Multiply the chain planned by prepare_chain into the top left d0 x dn of result
+ *
+ * IMPORTANT: The result matrix must be zeroed for this function to succeed
+ *
+ * @param result preallocated zeroed matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_chain(double result[][N])
+{
+    if (chain.arena == NULL) {
+        ERROR("The chain was not prepared");
+        return MATRIX_FAILED;
+    }
+    INFO("Running the chain of %d matrices as %s", chain.count, chain.order);
+    for (int s = 0; s < chain.step_count; s++) {
+        struct chain_step *step = &chain.steps[s];
+        struct tile_matrix a = operand_view(step->left, step->inner);
+        struct tile_matrix b = operand_view(step->right, step->cols);
+        struct tile_matrix c = { &result[0][0], N, 1 };
+        if (s + 1 < chain.step_count) {
+            c.data = chain.arena + step->offset;
+            c.ld = step->cols;
+            memset(c.data, 0, step->rows * step->cols * sizeof(double));
+        }
+        tile_gemm(step->rows, step->cols, step->inner, 1.0, a, b, c);
+    }
+    return 1; // forget about flops - we'll add it from known values
+}
+
+/**
+ * Multiply the chain left to right into reference, for the accuracy of the planned order
+ */
+void chain_reference(double reference[][N])
+{
+    size_t rows = chain.dims[0];
+    double *product = malloc(rows * chain.dims[1] * sizeof(double));
+    memcpy(product, chain.inputs[0], rows * chain.dims[1] * sizeof(double));
+    for (int i = 1; i < chain.count; i++) {
+        size_t inner = chain.dims[i], cols = chain.dims[i + 1];
+        double *next = calloc(rows * cols, sizeof(double));
+        struct tile_matrix a = { product, inner, 1 }, b = { chain.inputs[i], cols, 1 }, c = { next, cols, 1 };
+        tile_gemm(rows, cols, inner, 1.0, a, b, c);
+        free(product);
+        product = next;
+    }
+    size_t cols = chain.dims[chain.count];
+    for (size_t i = 0; i < rows; i++) {
+        memcpy(reference[i], &product[i * cols], cols * sizeof(double));
+    }
+    free(product);
+}
@@ -0,0 +1,256 @@
+#include <math.h>
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_tiles.h"
+
+/*
+ * Complex double products (ZGEMM) for --complex 4m|3m, linked into every implementation.
+ *
+ * A, B and C are held in one of two layouts (--complex-layout):
+ *  - interleaved: each row is re, im, re, im, ... (the C99 / Fortran complex layout)
+ *  - split: a plane of real parts followed by a plane of imaginary parts
+ * Both are handed to the shared tile GEMM as strided views of the real and imaginary parts, so the
+ * packing stage gathers the parts and the kernels only ever see contiguous real tiles.
+ *
+ * 4m: Cr = Ar.Br - Ai.Bi, Ci = Ar.Bi + Ai.Br as 4 real products
+ * 3m: T1 = Ar.Br, T2 = Ai.Bi, Ci = (Ar + Ai).(Br + Bi) - T1 - T2, Cr = T1 - T2: 3 real products for
+ *     25% fewer flops, at the price of larger rounding errors in Ci (compared against 4m by the driver)
+ */
+
+static struct {
+    enum complex_layout layout;
+    double *a;
+    double *b;
+    double *c;
+    // 3m workspace, allocated with the operands so the product does not malloc
+    double *a_sum;
+    double *b_sum;
+    double *t1;
+    double *t2;
+} complex_operands = { LAYOUT_INTERLEAVED, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+
+/**
+ * Strided view of the real (part 0) or imaginary (part 1) values of a complex matrix in the layout
+ */
+static struct tile_matrix complex_part(double *matrix, int part)
+{
+    struct tile_matrix view;
+    if (complex_operands.layout == LAYOUT_INTERLEAVED) {
+        view.data = matrix + part;
+        view.ld = 2 * N;
+        view.step = 2;
+    }
+    else {
+        view.data = matrix + (size_t)part * N * N;
+        view.ld = N;
+        view.step = 1;
+    }
+    return view;
+}
+
+static struct tile_matrix real_plane(double *plane)
+{
+    struct tile_matrix view = { plane, N, 1 };
+    return view;
+}
+
+#define AT(view, i, j) ((view).data[(i) * (view).ld + (j) * (view).step])
+
+static void store_complex(double *matrix, double real[][N], double imag[][N])
+{
+    struct tile_matrix re = complex_part(matrix, 0), im = complex_part(matrix, 1);
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            AT(re, i, j) = real[i][j];
+            AT(im, i, j) = imag[i][j];
+        }
+    }
+}
+
+void release_complex_storage()
+{
+    free(complex_operands.a);
+    free(complex_operands.b);
+    free(complex_operands.c);
+    free(complex_operands.a_sum);
+    free(complex_operands.b_sum);
+    free(complex_operands.t1);
+    free(complex_operands.t2);
+    complex_operands.a = complex_operands.b = complex_operands.c = NULL;
+    complex_operands.a_sum = complex_operands.b_sum = complex_operands.t1 = complex_operands.t2 = NULL;
+}
+
+/**
+ * Keep complex copies of A = a_real + i a_imag and B = b_real + i b_imag in the layout
+ */
+void prepare_complex_storage(enum complex_algorithm algorithm, enum complex_layout layout,
+                             double a_real[][N], double a_imag[][N], double b_real[][N], double b_imag[][N])
+{
+    release_complex_storage();
+    size_t plane = (size_t)N * N * sizeof(double);
+    complex_operands.layout = layout;
+    complex_operands.a = malloc(2 * plane);
+    complex_operands.b = malloc(2 * plane);
+    complex_operands.c = malloc(2 * plane);
+    bool failed = complex_operands.a == NULL || complex_operands.b == NULL || complex_operands.c == NULL;
+    if (algorithm == COMPLEX_3M) {
+        complex_operands.a_sum = malloc(plane);
+        complex_operands.b_sum = malloc(plane);
+        complex_operands.t1 = malloc(plane);
+        complex_operands.t2 = malloc(plane);
+        failed = failed || complex_operands.a_sum == NULL || complex_operands.b_sum == NULL
+                 || complex_operands.t1 == NULL || complex_operands.t2 == NULL;
+    }
+    if (failed) {
+        ERROR("Could not allocate the complex matrices");
+        exit(1);
+    }
+    store_complex(complex_operands.a, a_real, a_imag);
+    store_complex(complex_operands.b, b_real, b_imag);
+    INFO("Stored A and B as %s complex doubles", complex_layout_name(layout));
+}
+
+static void multiply_4m(double *c)
+{
+    struct tile_matrix ar = complex_part(complex_operands.a, 0), ai = complex_part(complex_operands.a, 1);
+    struct tile_matrix br = complex_part(complex_operands.b, 0), bi = complex_part(complex_operands.b, 1);
+    struct tile_matrix cr = complex_part(c, 0), ci = complex_part(c, 1);
+    tile_gemm(N, N, N, 1.0, ar, br, cr);
+    tile_gemm(N, N, N, -1.0, ai, bi, cr);
+    tile_gemm(N, N, N, 1.0, ar, bi, ci);
+    tile_gemm(N, N, N, 1.0, ai, br, ci);
+}
+
+static void multiply_3m(double *c)
+{
+    struct tile_matrix ar = complex_part(complex_operands.a, 0), ai = complex_part(complex_operands.a, 1);
+    struct tile_matrix br = complex_part(complex_operands.b, 0), bi = complex_part(complex_operands.b, 1);
+    struct tile_matrix cr = complex_part(c, 0), ci = complex_part(c, 1);
+    double *a_sum = complex_operands.a_sum, *b_sum = complex_operands.b_sum;
+    double *t1 = complex_operands.t1, *t2 = complex_operands.t2;
+
+#pragma omp parallel
+    {
+        phase_begin(PHASE_PACK_A);
+#pragma omp for schedule(static) nowait
+        for (size_t i = 0; i < N; i++) {
+            for (size_t j = 0; j < N; j++) {
+                a_sum[i * N + j] = AT(ar, i, j) + AT(ai, i, j);
+                t1[i * N + j] = 0;
+            }
+        }
+        phase_end(PHASE_PACK_A);
+        phase_begin(PHASE_PACK_B);
+#pragma omp for schedule(static)
+        for (size_t i = 0; i < N; i++) {
+            for (size_t j = 0; j < N; j++) {
+                b_sum[i * N + j] = AT(br, i, j) + AT(bi, i, j);
+                t2[i * N + j] = 0;
+            }
+        }
+        phase_end(PHASE_PACK_B);
+    }
+    tile_gemm(N, N, N, 1.0, ar, br, real_plane(t1));
+    tile_gemm(N, N, N, 1.0, ai, bi, real_plane(t2));
+    tile_gemm(N, N, N, 1.0, real_plane(a_sum), real_plane(b_sum), ci);
+#pragma omp parallel
+    {
+        phase_begin(PHASE_REDUCE);
+#pragma omp for schedule(static)
+        for (size_t i = 0; i < N; i++) {
+            for (size_t j = 0; j < N; j++) {
+                AT(cr, i, j) = t1[i * N + j] - t2[i * N + j];
+                AT(ci, i, j) -= t1[i * N + j] + t2[i * N + j];
+            }
+        }
+        phase_end(PHASE_REDUCE);
+    }
+}
+
+static void complex_product(enum complex_algorithm algorithm, double *c)
+{
+    memset(c, 0, 2 * (size_t)N * N * sizeof(double));
+    if (algorithm == COMPLEX_3M) {
+        multiply_3m(c);
+    }
+    else {
+        multiply_4m(c);
+    }
+}
+
+/**
+ * Multiply the complex copies of A and B made by prepare_complex_storage
+ *
+ * The real part of the product goes to result, the whole product stays in the complex storage
+ * for complex_result. Uses the block size from the global config (-b, default 64).
+ *
+ * @param result preallocated matrix into which to store the real part of the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_complex(enum complex_algorithm algorithm, double result[][N])
+{
+    if (complex_operands.a == NULL || (algorithm == COMPLEX_3M && complex_operands.t1 == NULL)) {
+        ERROR("No complex copies of the matrices: call prepare_complex_storage first");
+        return MATRIX_FAILED;
+    }
+    INFO("Running %s complex matrix_mult %d x %d on %s storage", complex_name(algorithm), N, N,
+         complex_layout_name(complex_operands.layout));
+    complex_product(algorithm, complex_operands.c);
+    struct tile_matrix cr = complex_part(complex_operands.c, 0);
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            result[i][j] = AT(cr, i, j);
+        }
+    }
+    return 1; // forget about flops - we'll add it from known values
+}
+
+/**
+ * Copy the last complex product out as real and imaginary parts
+ */
+void complex_result(double real[][N], double imag[][N])
+{
+    struct tile_matrix cr = complex_part(complex_operands.c, 0), ci = complex_part(complex_operands.c, 1);
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            real[i][j] = AT(cr, i, j);
+            imag[i][j] = AT(ci, i, j);
+        }
+    }
+}
+
+/**
+ * Measure the accuracy lost by the 3m product against the 4m product
+ *
+ * Errors are on the complex moduli: max |C - C_4m| / |C_4m| and ||C - C_4m|| / ||C_4m||.
+ */
+void compare_complex_with_4m(struct metrics *metrics)
+{
+    double *reference = malloc(2 * (size_t)N * N * sizeof(double));
+    if (reference == NULL) {
+        ERROR("Could not allocate the 4m reference product");
+        return;
+    }
+    complex_product(COMPLEX_4M, reference);
+    struct tile_matrix cr = complex_part(complex_operands.c, 0), ci = complex_part(complex_operands.c, 1);
+    struct tile_matrix rr = complex_part(reference, 0), ri = complex_part(reference, 1);
+    double max_rel_error = 0, diff_norm = 0, reference_norm = 0;
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            double diff = hypot(AT(cr, i, j) - AT(rr, i, j), AT(ci, i, j) - AT(ri, i, j));
+            double modulus = hypot(AT(rr, i, j), AT(ri, i, j));
+            if (modulus > 0) {
+                max_rel_error = MAX(max_rel_error, diff / modulus);
+            }
+            diff_norm += diff * diff;
+            reference_norm += modulus * modulus;
+        }
+    }
+    free(reference);
+    metrics->max_rel_error = max_rel_error;
+    metrics->norm_rel_error = reference_norm > 0 ? sqrt(diff_norm / reference_norm) : sqrt(diff_norm);
+    INFO("Accuracy loss of 3m against 4m: max relative error %.3e, normwise relative error %.3e",
+         metrics->max_rel_error, metrics->norm_rel_error);
+}
@@ -3,15 +3,55 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <getopt.h>
 #include <unistd.h>
+#include "matrix.h"
 #include "matrix_types.h"
+#include "matrix_epilogue.h"
+#include "matrix_support.h"
 
 #define OPT_SILENT 299
 #define OPT_IDENTITY 300
 #define OPT_TEST_EQUAL_COLS 302
 #define OPT_TEST_REVERSE_ROWS 303
 #define OPT_GIGA 304
+#define OPT_PERF 305
+#define OPT_MULTIPLEX 306
+#define OPT_THREAD_COUNTERS 307
+#define OPT_TRACE 308
+#define OPT_ROOFLINE 309
+#define OPT_CUTOFF 310
+#define OPT_PRECISION 311
+#define OPT_STORAGE 312
+#define OPT_COMPLEX 313
+#define OPT_COMPLEX_LAYOUT 314
+#define OPT_BATCH 315
+#define OPT_BATCH_POINTERS 316
+#define OPT_JIT 317
+#define OPT_JIT_CACHE 318
+#define OPT_A_ROWS 319
+#define OPT_B_COLS 320
+#define OPT_SYRK 321
+#define OPT_SYRK_NO_MIRROR 322
+#define OPT_TRMM 323
+#define OPT_TRSM 324
+#define OPT_SPARSE 325
+#define OPT_A_DENSITY 326
+#define OPT_A_TILE_DENSITY 327
+#define OPT_A_BANDWIDTH 328
+#define OPT_CHAIN 329
+#define OPT_ALPHA 330
+#define OPT_BETA 331
+#define OPT_BIAS 332
+#define OPT_ACTIVATION 333
+#define OPT_PLAN 334
+#define OPT_PLAN_ESTIMATE 335
+#define OPT_IMPL 336
+#define OPT_COMPARE 337
+
+// counted per thread and phase by --thread-counters when no --papi events are given
+#define DEFAULT_THREAD_COUNTER_EVENTS "PAPI_TOT_CYC:PAPI_L1_DCM:PAPI_L3_TCM"
 
 #define L3_CACHE_MIB 30
 
@@ -27,12 +67,41 @@ struct config new_config()
     new_config.out_file = NULL;
     new_config.test_file = NULL;
     new_config.metrics_file = NULL;
+    new_config.trace_file = NULL;
     new_config.test_equal_cols = false;
     new_config.test_reverse_rows = false;
     new_config.identity = false;
     new_config.label = "no-label";
     new_config.size = N;
     new_config.block_size = 0;
+    new_config.cutoff = 0;
+    new_config.precision = PRECISION_DOUBLE;
+    new_config.storage = STORAGE_DOUBLE;
+    new_config.complex = COMPLEX_NONE;
+    new_config.complex_layout = LAYOUT_INTERLEAVED;
+    new_config.batch = 0;
+    new_config.batch_pointers = false;
+    new_config.jit = false;
+    new_config.jit_cache = NULL;
+    new_config.a_rows = 0;
+    new_config.b_cols = 0;
+    new_config.syrk = TRIANGLE_NONE;
+    new_config.syrk_mirror = true;
+    new_config.trmm = TRIANGLE_NONE;
+    new_config.trsm = TRIANGLE_NONE;
+    new_config.sparse = SPARSE_DENSE; // auto only when asked: it would run CSR or band instead of the implementation
+    new_config.a_density = 0;
+    new_config.a_tile_density = 0;
+    new_config.a_bandwidth = -1;
+    new_config.chain_matrices = 0;
+    new_config.alpha = 1;
+    new_config.beta = 0;
+    new_config.bias = BIAS_NONE;
+    new_config.activation = ACTIVATION_NONE;
+    new_config.plan_file = NULL;
+    new_config.plan_estimate = false;
+    new_config.implementation_count = 0;
+    new_config.compare = false;
     new_config.loop_order = ijk;
     new_config.silent = false;
     new_config.verbose = false;
@@ -40,6 +109,14 @@ struct config new_config()
     new_config.quiet = false;
     new_config.papi_arg = NULL;
     new_config.papi_ignore = false;
+    new_config.multiplex = false;
+    new_config.thread_counters = false;
+    new_config.roofline = false;
+#ifdef NO_PAPI
+    new_config.perf = true; // built without the PAPI library so perf_event_open is the only backend
+#else
+    new_config.perf = false;
+#endif
     return new_config;
 }
 
@@ -50,8 +127,41 @@ struct metrics new_metrics(struct config *config)
 {
     struct metrics new_metrics;
     new_metrics.label = config->label;
+    // empty when another engine (--syrk, --sparse csr, --plan...) runs instead of the implementation
+    new_metrics.implementation = dense_product() && config->plan_file == NULL ? selected_implementation()->name : "";
     new_metrics.loop_order = config->loop_order;
     new_metrics.block_size = config->block_size;
+    new_metrics.precision = config->precision;
+    new_metrics.storage = config->storage;
+    new_metrics.complex = config->complex;
+    new_metrics.complex_layout = config->complex_layout;
+    new_metrics.batch = config->batch;
+    new_metrics.a_rows = config->a_rows;
+    new_metrics.b_cols = config->b_cols;
+    new_metrics.bytes_per_second = -1;
+    new_metrics.syrk = config->syrk;
+    new_metrics.trmm = config->trmm;
+    new_metrics.trsm = config->trsm;
+    new_metrics.sparse = config->sparse;
+    new_metrics.a_density = -1;
+    new_metrics.chain_matrices = config->chain_matrices;
+    new_metrics.chain_order[0] = '\0';
+    new_metrics.chain_flops = 0;
+    new_metrics.chain_naive_flops = 0;
+    new_metrics.chain_arena_bytes = 0;
+    new_metrics.chain_naive_bytes = 0;
+    new_metrics.alpha = config->alpha;
+    new_metrics.beta = config->beta;
+    new_metrics.bias = config->bias;
+    new_metrics.activation = config->activation;
+    new_metrics.plan_kernel = PLAN_KERNEL_IKJ;
+    new_metrics.plan_block = 0;
+    new_metrics.plan_schedule = PLAN_STATIC;
+    new_metrics.plan_loaded = false;
+    new_metrics.plan_seconds = 0;
+    new_metrics.pack_seconds = 0;
+    new_metrics.max_rel_error = -1;
+    new_metrics.norm_rel_error = -1;
     new_metrics.flops = 0;
     new_metrics.total_seconds = 0;
     new_metrics.total_micro_seconds = 0;
@@ -92,11 +202,62 @@ void usage()
     fprintf(stderr, "Options include:\n");
     fprintf(stderr, "    -s SIZE for a SIZExSIZE matrix: IGNORED IN THIS VERSION - FIXED AS CONSTANT: %d)\n", N);
     fprintf(stderr, "    -b BLOCK_SIZE for blocking MUST be an integral factor of the size (default: 0)\n");
+    fprintf(stderr, "    --cutoff SIZE Strassen crossover to the classical kernel, 16 to N (default: tuned at run time)\n");
+    fprintf(stderr, "    --precision double|single|mixed|refine arithmetic of the product (default double)\n");
+    fprintf(stderr, "        single: float, mixed: float inputs and double sums, refine: mixed plus a correction pass\n");
+    fprintf(stderr, "    --storage double|fp16|bf16|int8|int16 element type of A and B for the product (default double)\n");
+    fprintf(stderr, "        fp16 and bf16 are widened to float while packing and accumulated in float\n");
+    fprintf(stderr, "        int8 and int16 are quantized with a scale per row of A and column of B, accumulated in int32\n");
+    fprintf(stderr, "    --complex 4m|3m complex double product with 4 real products or 3 and extra additions (default real)\n");
+    fprintf(stderr, "        A gets a random imaginary part, B is 1+i (ones) or I (identity); 3m is compared against 4m\n");
+    fprintf(stderr, "    --complex-layout interleaved|split store re,im pairs or separate real and imaginary planes\n");
+    fprintf(stderr, "    --batch SIZE run (N/SIZE)^2 independent SIZE x SIZE products cut out of A and B instead of one N x N\n");
+    fprintf(stderr, "        SIZE must divide N, 4, 8, 16, 32 and 64 have unrolled kernels\n");
+    fprintf(stderr, "    --batch-pointers batch through the array of pointers API on the tiles of A and B (default strided)\n");
+    fprintf(stderr, "    --jit generate, compile ($CC or cc) and cache kernels for N and -b (default 64) and their remainders\n");
+    fprintf(stderr, "    --jit-cache DIR private directory of the compiled kernels (default ~/.cache/speedmm, none without HOME)\n");
+    fprintf(stderr, "    --a-rows ROWS --b-cols COLS multiply only the first ROWS rows of A by the first COLS columns of B\n");
+    fprintf(stderr, "        up to 4 rows or columns run bandwidth bound GEMV / GEVM kernels and report bytes/s\n");
+    fprintf(stderr, "    --syrk upper|lower compute A . A^T (B is not used) as one triangle, copied to the other half\n");
+    fprintf(stderr, "    --syrk-no-mirror leave the other triangle of the --syrk result zero\n");
+    fprintf(stderr, "    --trmm upper|lower multiply B by the upper or lower triangle of A (the other one is not read)\n");
+    fprintf(stderr, "    --trsm upper|lower solve tri(A) . X = B for X, a random A gets N added to its diagonal\n");
+    fprintf(stderr, "    --sparse auto|dense|csr|csc|blocks|band storage of A for the product (default dense)\n");
+    fprintf(stderr, "        auto picks the cheapest estimate for this A, which may not run the implementation at all\n");
+    fprintf(stderr, "        blocks skips the all-zero tiles of A and B with the omp and block implementations (matrix_2, matrix_3)\n");
+    fprintf(stderr, "        band stores the diagonals of A (and of B when it is banded too) found by scanning them\n");
+    fprintf(stderr, "    --a-density FRACTION keep only this fraction of the random elements of A, the others zero\n");
+    fprintf(stderr, "    --a-bandwidth W keep only the random elements of A within W diagonals of the main one\n");
+    fprintf(stderr, "    --a-tile-density FRACTION keep only this fraction of the random -b tiles of A, the others zero\n");
+    fprintf(stderr, "    --chain D0,D1,...,Dn multiply n random matrices, the i-th Di-1 x Di (up to %d), in the order of least\n",
+            CHAIN_MAX_MATRICES);
+    fprintf(stderr, "        flops and intermediate traffic, intermediates in one reused workspace; D0 x Dn of the result\n");
+    fprintf(stderr, "    --alpha X --beta Y C = X A.B + Y C for the double A . B (default 1 and 0: C is overwritten)\n");
+    fprintf(stderr, "        with --beta C starts as all %.1f\n", EPILOGUE_INITIAL_C);
+    fprintf(stderr, "    --bias row|col add a random value per row or per column of C\n");
+    fprintf(stderr, "    --activation relu|sigmoid|tanh|gelu apply to every element of C, after the bias\n");
+    fprintf(stderr, "        the blocked implementations apply all these in their kernels, the others in passes over C\n");
+    fprintf(stderr, "    --plan FILE run the double A . B on the plan saved in FILE, or plan it and save it there when\n");
+    fprintf(stderr, "        FILE is missing or for another size, thread count or CPU; B is packed once before the runs\n");
+    fprintf(stderr, "    --plan-estimate make the --plan from the defaults instead of timing the candidate kernels\n");
+    fprintf(stderr, "    --impl NAME run the double A . B with this implementation instead of the one of the executable:\n");
+    int count;
+    const struct implementation *registered = implementations(&count);
+    for (int i = 0; i < count; i++) {
+        fprintf(stderr, "        %-9s %s%s\n", registered[i].name, registered[i].description,
+                registered[i].blocked ? " (needs -b)" : "");
+    }
+    fprintf(stderr, "    --compare all|NAME,NAME,... run each implementation in turn on the same A and B, one metrics row each\n");
     fprintf(stderr, "    --ijk | --ikj | --jki for the loop interchange order (default ijk)\n");
-    fprintf(stderr, "    -f INFILE.CSV to read matrix A from a file (default is random generated matrix)\n");
-    fprintf(stderr, "    -o OUTFILE.CSV to write the result matrix to a file (default is none)\n");
+    fprintf(stderr, "    -f INFILE.CSV to read matrix A from a file, CSV or binary (default is random generated matrix)\n");
+    fprintf(stderr, "    -o OUTFILE.CSV to write the result matrix to a file, binary in the --storage type if named *.mtx\n");
+    fprintf(stderr, "        (complex results as re+imi cells, or c128 if named *.mtx)\n");
     fprintf(stderr, "    -t TEST.CSV compare result with TEST.CSV (only useful when -f, not random)\n");
     fprintf(stderr, "    -m METRICS.CSV append metrics to this CSV file (creates it if it does not exist)\n");
+    fprintf(stderr, "        (to METRICS.1.CSV, METRICS.2.CSV... when it has other columns, such as an older layout)\n");
+    fprintf(stderr, "    --roofline measure peak FMA throughput and memory bandwidth and report the run against them\n");
+    fprintf(stderr, "    --trace TRACE.json write a Chrome/Perfetto trace of the tiles run by each thread\n");
+    fprintf(stderr, "        with --compare one trace per implementation, TRACE.NAME.json\n");
     fprintf(stderr, "    --test-equals-cols validate that the columns are all the same in the result\n");
     fprintf(stderr, "    --test-reverse-rows also perform B. A and validate that the rows are all the same in the result\n");
     fprintf(stderr, "    --identity use an identity matrix (I) intead of a ones-matrix for creating test dta\n");
@@ -106,6 +267,9 @@ void usage()
     fprintf(stderr, "    --debug debug messages (includes verbose)\n");
     fprintf(stderr, "    --papi-ignore do not fail if papi produces errors\n");
     fprintf(stderr, "    --papi, -p PAPI_CTR_1,PAPI_CTR2, measure specified PAPI counters, comma separated list\n");
+    fprintf(stderr, "    --perf count the --papi events with Linux perf_event_open instead of PAPI (default without PAPI)\n");
+    fprintf(stderr, "    --multiplex collect all the ! separated --papi subsets in one multiplexed run\n");
+    fprintf(stderr, "    --thread-counters per-thread and per-phase breakdown of the counters (implies --perf)\n");
     fprintf(stderr, "    -h print this help and exit\n");
     fprintf(stderr, "\n");
     exit(1);
@@ -119,6 +283,235 @@ char* loop_order_name(enum loop_order loop_order) {
     }
 }
 
+char* precision_name(enum precision precision) {
+    switch (precision) {
+        case PRECISION_SINGLE: return "single";
+        case PRECISION_MIXED: return "mixed";
+        case PRECISION_REFINE: return "refine";
+        default: return "double";
+    }
+}
+
+char* storage_name(enum storage storage) {
+    switch (storage) {
+        case STORAGE_FP16: return "fp16";
+        case STORAGE_BF16: return "bf16";
+        case STORAGE_INT8: return "int8";
+        case STORAGE_INT16: return "int16";
+        default: return "double";
+    }
+}
+
+char* complex_name(enum complex_algorithm complex) {
+    switch (complex) {
+        case COMPLEX_4M: return "4m";
+        case COMPLEX_3M: return "3m";
+        default: return "none";
+    }
+}
+
+char* complex_layout_name(enum complex_layout layout) {
+    return layout == LAYOUT_SPLIT ? "split" : "interleaved";
+}
+
+char* triangle_name(enum triangle triangle) {
+    switch (triangle) {
+        case TRIANGLE_UPPER: return "upper";
+        case TRIANGLE_LOWER: return "lower";
+        default: return "none";
+    }
+}
+
+char* bias_name(enum bias_vector bias) {
+    switch (bias) {
+        case BIAS_ROW: return "row";
+        case BIAS_COL: return "col";
+        default: return "none";
+    }
+}
+
+char* activation_name(enum activation activation) {
+    switch (activation) {
+        case ACTIVATION_RELU: return "relu";
+        case ACTIVATION_SIGMOID: return "sigmoid";
+        case ACTIVATION_TANH: return "tanh";
+        case ACTIVATION_GELU: return "gelu";
+        default: return "none";
+    }
+}
+
+char* sparse_format_name(enum sparse_format format) {
+    switch (format) {
+        case SPARSE_DENSE: return "dense";
+        case SPARSE_CSR: return "csr";
+        case SPARSE_CSC: return "csc";
+        case SPARSE_BLOCKS: return "blocks";
+        case SPARSE_BAND: return "band";
+        default: return "auto";
+    }
+}
+
+enum sparse_format valid_sparse_format(char *arg)
+{
+    for (enum sparse_format format = SPARSE_AUTO; format <= SPARSE_BAND; format++) {
+        if (strcmp(arg, sparse_format_name(format)) == 0) {
+            return format;
+        }
+    }
+    fprintf(stderr, "Error: The option --sparse expects auto, dense, csr, csc, blocks or band (got %s)\n", arg);
+    usage();
+    return SPARSE_AUTO;
+}
+
+enum triangle valid_triangle(char *option, char *arg)
+{
+    for (enum triangle triangle = TRIANGLE_UPPER; triangle <= TRIANGLE_LOWER; triangle++) {
+        if (strcmp(arg, triangle_name(triangle)) == 0) {
+            return triangle;
+        }
+    }
+    fprintf(stderr, "Error: The option --%s expects upper or lower (got %s)\n", option, arg);
+    usage();
+    return TRIANGLE_NONE;
+}
+
+/**
+ * Parse the implementation names of --impl (one) or --compare (comma separated, or all) into names
+ *
+ * @return the number of names
+ */
+int valid_implementations(int opt, char *arg, char *names[COMPARE_MAX_IMPLEMENTATIONS])
+{
+    char *option = opt == OPT_IMPL ? "--impl" : "--compare";
+    int count = 0;
+    if (opt == OPT_COMPARE && strcmp(arg, "all") == 0) {
+        const struct implementation *registered = implementations(&count);
+        for (int i = 0; i < count; i++) {
+            names[i] = registered[i].name;
+        }
+        return count;
+    }
+    for (char *name = strtok(arg, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (find_implementation(name) == NULL) {
+            fprintf(stderr, "Error: The option %s got an unknown implementation %s (see --impl below)\n", option, name);
+            usage();
+        }
+        int most = opt == OPT_IMPL ? 1 : COMPARE_MAX_IMPLEMENTATIONS;
+        if (count == most) {
+            fprintf(stderr, "Error: The option %s expects up to %d implementation names\n", option, most);
+            usage();
+        }
+        names[count++] = name;
+    }
+    if (count == 0) {
+        fprintf(stderr, "Error: The option %s expects implementation names\n", option);
+        usage();
+    }
+    return count;
+}
+
+/**
+ * Parse the comma separated dimensions of --chain into dims
+ *
+ * @return the number of matrices of the chain
+ */
+int valid_chain(char *arg, int dims[CHAIN_MAX_MATRICES + 1])
+{
+    int count = 0;
+    char *next = arg;
+    while (count <= CHAIN_MAX_MATRICES) {
+        char *end;
+        long dim = strtol(next, &end, 10);
+        if (end == next || dim <= 0 || dim > N || (*end != ',' && *end != '\0')) {
+            break;
+        }
+        dims[count++] = (int)dim;
+        if (*end == '\0') {
+            if (count >= 3) {
+                return count - 1;
+            }
+            break;
+        }
+        next = end + 1;
+    }
+    fprintf(stderr, "Error: The option --chain expects 3 to %d comma separated dimensions of 1 to %d (got %s)\n",
+            CHAIN_MAX_MATRICES + 1, N, arg);
+    usage();
+    return 0;
+}
+
+enum complex_algorithm valid_complex(char *arg)
+{
+    for (enum complex_algorithm complex = COMPLEX_4M; complex <= COMPLEX_3M; complex++) {
+        if (strcmp(arg, complex_name(complex)) == 0) {
+            return complex;
+        }
+    }
+    fprintf(stderr, "Error: The option --complex expects 4m or 3m (got %s)\n", arg);
+    usage();
+    return COMPLEX_NONE;
+}
+
+enum bias_vector valid_bias(char *arg)
+{
+    for (enum bias_vector bias = BIAS_ROW; bias <= BIAS_COL; bias++) {
+        if (strcmp(arg, bias_name(bias)) == 0) {
+            return bias;
+        }
+    }
+    fprintf(stderr, "Error: The option --bias expects row or col (got %s)\n", arg);
+    usage();
+    return BIAS_NONE;
+}
+
+enum activation valid_activation(char *arg)
+{
+    for (enum activation activation = ACTIVATION_RELU; activation <= ACTIVATION_GELU; activation++) {
+        if (strcmp(arg, activation_name(activation)) == 0) {
+            return activation;
+        }
+    }
+    fprintf(stderr, "Error: The option --activation expects relu, sigmoid, tanh or gelu (got %s)\n", arg);
+    usage();
+    return ACTIVATION_NONE;
+}
+
+enum complex_layout valid_complex_layout(char *arg)
+{
+    for (enum complex_layout layout = LAYOUT_INTERLEAVED; layout <= LAYOUT_SPLIT; layout++) {
+        if (strcmp(arg, complex_layout_name(layout)) == 0) {
+            return layout;
+        }
+    }
+    fprintf(stderr, "Error: The option --complex-layout expects interleaved or split (got %s)\n", arg);
+    usage();
+    return LAYOUT_INTERLEAVED;
+}
+
+enum storage valid_storage(char *arg)
+{
+    for (enum storage storage = STORAGE_DOUBLE; storage <= STORAGE_INT16; storage++) {
+        if (strcmp(arg, storage_name(storage)) == 0) {
+            return storage;
+        }
+    }
+    fprintf(stderr, "Error: The option --storage expects double, fp16, bf16, int8 or int16 (got %s)\n", arg);
+    usage();
+    return STORAGE_DOUBLE;
+}
+
+enum precision valid_precision(char *arg)
+{
+    for (enum precision precision = PRECISION_DOUBLE; precision <= PRECISION_REFINE; precision++) {
+        if (strcmp(arg, precision_name(precision)) == 0) {
+            return precision;
+        }
+    }
+    fprintf(stderr, "Error: The option --precision expects double, single, mixed or refine (got %s)\n", arg);
+    usage();
+    return PRECISION_DOUBLE;
+}
+
 char* valid_file(char opt, char *filename)
 {
     if (access(filename, F_OK ) == -1 ) {
@@ -147,10 +540,32 @@ void validate_config(struct config config)
         printf("Output file       : %-10s\n", config.out_file);
         printf("Test file         : %-10s\n", config.test_file);
         printf("Metrics file      : %-10s\n", config.metrics_file);
+        printf("Trace file        : %-10s\n", config.trace_file);
         printf("Matrix size       : %-10d\n", config.size);
         printf("Loop order        : %s\n", loop_order_names[config.loop_order]);
         printf("Identity (vs ones): %d\n", config.identity);
         printf("Block size        : %d\n", config.block_size);
+        printf("Strassen cutoff   : %d\n", config.cutoff);
+        printf("Precision         : %s\n", precision_name(config.precision));
+        printf("Storage           : %s\n", storage_name(config.storage));
+        printf("Complex           : %s (%s)\n", complex_name(config.complex), complex_layout_name(config.complex_layout));
+        printf("Batch             : %d (%s)\n", config.batch, config.batch_pointers ? "pointers" : "strided");
+        printf("JIT kernels       : %d (cache %s)\n", config.jit, config.jit_cache != NULL ? config.jit_cache : "~/.cache/speedmm");
+        printf("A rows x B cols   : %d x %d\n", config.a_rows > 0 ? config.a_rows : N, config.b_cols > 0 ? config.b_cols : N);
+        printf("SYRK              : %s%s\n", triangle_name(config.syrk), config.syrk_mirror ? "" : " (not mirrored)");
+        printf("TRMM / TRSM       : %s / %s\n", triangle_name(config.trmm), triangle_name(config.trsm));
+        printf("Sparse A          : %s (density %.4f, tile density %.4f, bandwidth %d)\n",
+               sparse_format_name(config.sparse), config.a_density, config.a_tile_density, config.a_bandwidth);
+        printf("Chain             : %d matrices\n", config.chain_matrices);
+        printf("Epilogue          : alpha %g beta %g bias %s activation %s\n", config.alpha, config.beta,
+               bias_name(config.bias), activation_name(config.activation));
+        printf("Plan              : %s%s\n", config.plan_file != NULL ? config.plan_file : "none",
+               config.plan_estimate ? " (estimate)" : "");
+        printf("Implementations   :");
+        for (int i = 0; i < config.implementation_count; i++) {
+            printf(" %s", config.implementations[i]);
+        }
+        printf("%s\n", config.implementation_count == 0 ? " of the executable" : config.compare ? " (compared)" : "");
         printf("Test equal cols   : %d\n", config.test_equal_cols);
         printf("Test reverse rows : %d\n", config.test_reverse_rows);
         printf("Flags: \n");
@@ -159,6 +574,10 @@ void validate_config(struct config config)
         printf("silent      : %d\n", config.silent);
         printf("verbose     : %d\n", config.verbose);
         printf("papi_ignore : %d\n", config.papi_ignore);
+        printf("perf        : %d\n", config.perf);
+        printf("multiplex   : %d\n", config.multiplex);
+        printf("thread ctrs : %d\n", config.thread_counters);
+        printf("roofline    : %d\n", config.roofline);
         printf("\n");
     }
 }
@@ -182,6 +601,39 @@ struct config parse_cli(int argc, char *argv[])
             {"silent", no_argument, NULL, OPT_SILENT },
             {"papi-ignore", no_argument, NULL, 'i' },
             {"papi", required_argument, NULL, 'p'},
+            {"perf", no_argument, NULL, OPT_PERF },
+            {"multiplex", no_argument, NULL, OPT_MULTIPLEX },
+            {"thread-counters", no_argument, NULL, OPT_THREAD_COUNTERS },
+            {"trace", required_argument, NULL, OPT_TRACE },
+            {"roofline", no_argument, NULL, OPT_ROOFLINE },
+            {"cutoff", required_argument, NULL, OPT_CUTOFF },
+            {"precision", required_argument, NULL, OPT_PRECISION },
+            {"storage", required_argument, NULL, OPT_STORAGE },
+            {"complex", required_argument, NULL, OPT_COMPLEX },
+            {"complex-layout", required_argument, NULL, OPT_COMPLEX_LAYOUT },
+            {"batch", required_argument, NULL, OPT_BATCH },
+            {"batch-pointers", no_argument, NULL, OPT_BATCH_POINTERS },
+            {"jit", no_argument, NULL, OPT_JIT },
+            {"jit-cache", required_argument, NULL, OPT_JIT_CACHE },
+            {"a-rows", required_argument, NULL, OPT_A_ROWS },
+            {"b-cols", required_argument, NULL, OPT_B_COLS },
+            {"syrk", required_argument, NULL, OPT_SYRK },
+            {"syrk-no-mirror", no_argument, NULL, OPT_SYRK_NO_MIRROR },
+            {"trmm", required_argument, NULL, OPT_TRMM },
+            {"trsm", required_argument, NULL, OPT_TRSM },
+            {"sparse", required_argument, NULL, OPT_SPARSE },
+            {"a-density", required_argument, NULL, OPT_A_DENSITY },
+            {"a-tile-density", required_argument, NULL, OPT_A_TILE_DENSITY },
+            {"a-bandwidth", required_argument, NULL, OPT_A_BANDWIDTH },
+            {"chain", required_argument, NULL, OPT_CHAIN },
+            {"alpha", required_argument, NULL, OPT_ALPHA },
+            {"beta", required_argument, NULL, OPT_BETA },
+            {"bias", required_argument, NULL, OPT_BIAS },
+            {"activation", required_argument, NULL, OPT_ACTIVATION },
+            {"plan", required_argument, NULL, OPT_PLAN },
+            {"plan-estimate", no_argument, NULL, OPT_PLAN_ESTIMATE },
+            {"impl", required_argument, NULL, OPT_IMPL },
+            {"compare", required_argument, NULL, OPT_COMPARE },
             {"verbose", no_argument, NULL, 'v' },
             {"debug", no_argument, NULL, 'd' },
             {"identity", no_argument, NULL, OPT_IDENTITY },
@@ -213,6 +665,141 @@ struct config parse_cli(int argc, char *argv[])
             case 'i':
                 config.papi_ignore = true;
                 break;
+            case OPT_PERF:
+                config.perf = true;
+                break;
+            case OPT_ROOFLINE:
+                config.roofline = true;
+                break;
+            case OPT_COMPLEX:
+                config.complex = valid_complex(optarg);
+                break;
+            case OPT_COMPLEX_LAYOUT:
+                config.complex_layout = valid_complex_layout(optarg);
+                break;
+            case OPT_BATCH:
+                config.batch = atoi(optarg);
+                if (config.batch <= 0) {
+                    fprintf(stderr, "Error: The option --batch expects a counting number (got %s)\n", optarg);
+                    usage();
+                }
+                break;
+            case OPT_BATCH_POINTERS:
+                config.batch_pointers = true;
+                break;
+            case OPT_A_ROWS:
+                config.a_rows = atoi(optarg);
+                if (config.a_rows <= 0 || config.a_rows > N) {
+                    fprintf(stderr, "Error: The option --a-rows expects 1 to %d (got %s)\n", N, optarg);
+                    usage();
+                }
+                break;
+            case OPT_B_COLS:
+                config.b_cols = atoi(optarg);
+                if (config.b_cols <= 0 || config.b_cols > N) {
+                    fprintf(stderr, "Error: The option --b-cols expects 1 to %d (got %s)\n", N, optarg);
+                    usage();
+                }
+                break;
+            case OPT_SYRK:
+                config.syrk = valid_triangle("syrk", optarg);
+                break;
+            case OPT_SYRK_NO_MIRROR:
+                config.syrk_mirror = false;
+                break;
+            case OPT_TRMM:
+                config.trmm = valid_triangle("trmm", optarg);
+                break;
+            case OPT_TRSM:
+                config.trsm = valid_triangle("trsm", optarg);
+                break;
+            case OPT_SPARSE:
+                config.sparse = valid_sparse_format(optarg);
+                break;
+            case OPT_A_BANDWIDTH:
+                config.a_bandwidth = atoi(optarg);
+                if (config.a_bandwidth < 0 || config.a_bandwidth >= N) {
+                    fprintf(stderr, "Error: The option --a-bandwidth expects 0 to %d (got %s)\n", N - 1, optarg);
+                    usage();
+                }
+                break;
+            case OPT_ALPHA:
+                config.alpha = atof(optarg);
+                if (config.alpha == 0) {
+                    fprintf(stderr, "Error: The option --alpha expects a non-zero number (got %s)\n", optarg);
+                    usage();
+                }
+                break;
+            case OPT_BETA:
+                config.beta = atof(optarg);
+                break;
+            case OPT_BIAS:
+                config.bias = valid_bias(optarg);
+                break;
+            case OPT_ACTIVATION:
+                config.activation = valid_activation(optarg);
+                break;
+            case OPT_PLAN:
+                config.plan_file = optarg;
+                break;
+            case OPT_PLAN_ESTIMATE:
+                config.plan_estimate = true;
+                break;
+            case OPT_IMPL:
+            case OPT_COMPARE:
+                if (config.implementation_count > 0) {
+                    fprintf(stderr, "Error: only one of --impl and --compare can be given, once\n");
+                    usage();
+                }
+                config.implementation_count = valid_implementations(opt, optarg, config.implementations);
+                config.compare = opt == OPT_COMPARE;
+                break;
+            case OPT_CHAIN:
+                config.chain_matrices = valid_chain(optarg, config.chain);
+                break;
+            case OPT_A_TILE_DENSITY:
+                config.a_tile_density = atof(optarg);
+                if (config.a_tile_density <= 0 || config.a_tile_density > 1) {
+                    fprintf(stderr, "Error: The option --a-tile-density expects a fraction in (0, 1] (got %s)\n", optarg);
+                    usage();
+                }
+                break;
+            case OPT_A_DENSITY:
+                config.a_density = atof(optarg);
+                if (config.a_density <= 0 || config.a_density > 1) {
+                    fprintf(stderr, "Error: The option --a-density expects a fraction in (0, 1] (got %s)\n", optarg);
+                    usage();
+                }
+                break;
+            case OPT_JIT:
+                config.jit = true;
+                break;
+            case OPT_JIT_CACHE:
+                config.jit = true;
+                config.jit_cache = optarg;
+                break;
+            case OPT_STORAGE:
+                config.storage = valid_storage(optarg);
+                break;
+            case OPT_PRECISION:
+                config.precision = valid_precision(optarg);
+                break;
+            case OPT_CUTOFF:
+                config.cutoff = atoi(optarg);
+                if (config.cutoff < 16 || config.cutoff > N) {
+                    fprintf(stderr, "Error: The option --cutoff expects 16 to %d (got %s)\n", N, optarg);
+                    usage();
+                }
+                break;
+            case OPT_TRACE:
+                config.trace_file = optarg;
+                break;
+            case OPT_THREAD_COUNTERS:
+                config.thread_counters = true;
+                break;
+            case OPT_MULTIPLEX:
+                config.multiplex = true;
+                break;
             case OPT_SILENT:
                 config.silent = true;
                 break;
@@ -274,6 +861,151 @@ struct config parse_cli(int argc, char *argv[])
     if (config.silent) {
         config.quiet = true; // silent implies quiet
     }
+    if (config.thread_counters) {
+        // PAPI only counts the thread that started it, so the breakdown needs the perf backend
+        config.perf = true;
+        if (config.papi_arg == NULL) {
+            config.papi_arg = DEFAULT_THREAD_COUNTER_EVENTS;
+        }
+    }
+    if (config.storage != STORAGE_DOUBLE && config.precision != PRECISION_DOUBLE) {
+        fprintf(stderr, "Error: --storage %s sets its own accumulation, it cannot be combined with --precision\n",
+                storage_name(config.storage));
+        usage();
+    }
+    if (config.complex != COMPLEX_NONE
+        && (config.storage != STORAGE_DOUBLE || config.precision != PRECISION_DOUBLE)) {
+        fprintf(stderr, "Error: --complex is in double only, it cannot be combined with --storage or --precision\n");
+        usage();
+    }
+    if (config.batch > 0
+        && (config.complex != COMPLEX_NONE || config.storage != STORAGE_DOUBLE || config.precision != PRECISION_DOUBLE)) {
+        fprintf(stderr, "Error: --batch runs double products, it cannot be combined with --complex, --storage or --precision\n");
+        usage();
+    }
+    if (config.jit && (config.batch > 0 || config.complex != COMPLEX_NONE || config.storage != STORAGE_DOUBLE
+                       || config.precision != PRECISION_DOUBLE)) {
+        fprintf(stderr, "Error: --jit generates the kernels of the double product, it cannot be combined with "
+                        "--batch, --complex, --storage or --precision\n");
+        usage();
+    }
+    if ((config.a_rows > 0 || config.b_cols > 0)
+        && (config.jit || config.batch > 0 || config.complex != COMPLEX_NONE || config.storage != STORAGE_DOUBLE
+            || config.precision != PRECISION_DOUBLE)) {
+        fprintf(stderr, "Error: --a-rows and --b-cols run double products, they cannot be combined with "
+                        "--jit, --batch, --complex, --storage or --precision\n");
+        usage();
+    }
+    if (config.syrk != TRIANGLE_NONE
+        && (config.a_rows > 0 || config.b_cols > 0 || config.jit || config.batch > 0 || config.complex != COMPLEX_NONE
+            || config.storage != STORAGE_DOUBLE || config.precision != PRECISION_DOUBLE)) {
+        fprintf(stderr, "Error: --syrk runs the double A . A^T, it cannot be combined with --a-rows, --b-cols, "
+                        "--jit, --batch, --complex, --storage or --precision\n");
+        usage();
+    }
+    if ((config.syrk != TRIANGLE_NONE) + (config.trmm != TRIANGLE_NONE) + (config.trsm != TRIANGLE_NONE) > 1) {
+        fprintf(stderr, "Error: only one of --syrk, --trmm and --trsm can be given\n");
+        usage();
+    }
+    if ((config.trmm != TRIANGLE_NONE || config.trsm != TRIANGLE_NONE)
+        && (config.a_rows > 0 || config.b_cols > 0 || config.jit || config.batch > 0 || config.complex != COMPLEX_NONE
+            || config.storage != STORAGE_DOUBLE || config.precision != PRECISION_DOUBLE)) {
+        fprintf(stderr, "Error: --trmm and --trsm run in double on the tiles, they cannot be combined with --a-rows, "
+                        "--b-cols, --jit, --batch, --complex, --storage or --precision\n");
+        usage();
+    }
+    if (config.chain_matrices > 0
+        && (config.syrk != TRIANGLE_NONE || config.trmm != TRIANGLE_NONE || config.trsm != TRIANGLE_NONE
+            || config.a_rows > 0 || config.b_cols > 0 || config.jit || config.batch > 0
+            || config.complex != COMPLEX_NONE || config.storage != STORAGE_DOUBLE
+            || config.precision != PRECISION_DOUBLE || config.in_file != NULL || config.test_file != NULL)) {
+        fprintf(stderr, "Error: --chain multiplies its own random matrices in double, it cannot be combined with "
+                        "--syrk, --trmm, --trsm, --a-rows, --b-cols, --jit, --batch, --complex, --storage, "
+                        "--precision, -f or -t\n");
+        usage();
+    }
+    bool other_engine = config.chain_matrices > 0 || config.syrk != TRIANGLE_NONE || config.trmm != TRIANGLE_NONE
+                        || config.trsm != TRIANGLE_NONE || config.a_rows > 0 || config.b_cols > 0 || config.jit || config.batch > 0
+                        || config.complex != COMPLEX_NONE || config.storage != STORAGE_DOUBLE
+                        || config.precision != PRECISION_DOUBLE;
+    bool epilogue = config.alpha != 1 || config.beta != 0 || config.bias != BIAS_NONE
+                    || config.activation != ACTIVATION_NONE;
+    if (epilogue && (other_engine || config.sparse == SPARSE_CSR || config.sparse == SPARSE_CSC
+                     || config.sparse == SPARSE_BAND)) {
+        fprintf(stderr, "Error: --alpha, --beta, --bias and --activation apply to the dense double A . B, they cannot "
+                        "be combined with --chain, --syrk, --trmm, --trsm, --a-rows, --b-cols, --jit, --batch, "
+                        "--complex, --storage, --precision or --sparse csr|csc|band\n");
+        usage();
+    }
+    if (config.sparse == SPARSE_AUTO && epilogue) {
+        config.sparse = SPARSE_DENSE; // auto could pick csr, csc or band
+    }
+    if (config.sparse != SPARSE_AUTO && config.sparse != SPARSE_DENSE && other_engine) {
+        fprintf(stderr, "Error: --sparse %s runs the double A . B, it cannot be combined with --chain, --syrk, --trmm, "
+                        "--trsm, --a-rows, --b-cols, --jit, --batch, --complex, --storage or --precision\n",
+                sparse_format_name(config.sparse));
+        usage();
+    }
+    if (config.sparse == SPARSE_AUTO && other_engine) {
+        config.sparse = SPARSE_DENSE; // the other engines work on dense A
+    }
+    if (config.plan_estimate && config.plan_file == NULL) {
+        fprintf(stderr, "Error: --plan-estimate needs --plan FILE\n");
+        usage();
+    }
+    if (config.plan_file != NULL && (other_engine || (config.sparse != SPARSE_AUTO && config.sparse != SPARSE_DENSE))) {
+        fprintf(stderr, "Error: --plan runs the dense double A . B, it cannot be combined with --chain, --syrk, --trmm, "
+                        "--trsm, --a-rows, --b-cols, --jit, --batch, --complex, --storage, --precision or "
+                        "--sparse csr|csc|blocks|band\n");
+        usage();
+    }
+    if (config.plan_file != NULL) {
+        config.sparse = SPARSE_DENSE; // auto could pick another storage
+    }
+    if (config.implementation_count > 0 && (other_engine || config.plan_file != NULL || config.sparse == SPARSE_CSR
+                                            || config.sparse == SPARSE_CSC || config.sparse == SPARSE_BAND)) {
+        fprintf(stderr, "Error: --impl and --compare run the implementations of the dense double A . B, they cannot be "
+                        "combined with --chain, --syrk, --trmm, --trsm, --a-rows, --b-cols, --jit, --batch, --complex, "
+                        "--storage, --precision, --plan or --sparse csr|csc|band\n");
+        usage();
+    }
+    if (config.compare && (config.out_file != NULL || config.sparse == SPARSE_BLOCKS)) {
+        fprintf(stderr, "Error: --compare cannot be combined with -o (one result for all the runs) or --sparse blocks "
+                        "(only some implementations skip the tiles)\n");
+        usage();
+    }
+    if (config.implementation_count > 0 && config.sparse == SPARSE_AUTO) {
+        config.sparse = SPARSE_DENSE; // auto could pick a storage that does not run the implementations
+    }
+    for (int i = 0; i < config.implementation_count; i++) {
+        if (find_implementation(config.implementations[i])->blocked
+            && (config.block_size < 1 || N % config.block_size != 0)) {
+            fprintf(stderr, "Error: the %s implementation needs a block size -b dividing %d\n",
+                    config.implementations[i], N);
+            usage();
+        }
+    }
+    int a_patterns = (config.a_density > 0) + (config.a_tile_density > 0) + (config.a_bandwidth >= 0);
+    if (a_patterns > 0 && config.in_file != NULL) {
+        fprintf(stderr, "Error: --a-density, --a-tile-density and --a-bandwidth apply to the random A, "
+                        "they cannot be combined with -f\n");
+        usage();
+    }
+    if (a_patterns > 1) {
+        fprintf(stderr, "Error: only one of --a-density, --a-tile-density and --a-bandwidth can be given\n");
+        usage();
+    }
+    if (!config.syrk_mirror && config.syrk == TRIANGLE_NONE) {
+        fprintf(stderr, "Error: --syrk-no-mirror needs --syrk upper|lower\n");
+        usage();
+    }
+    if (config.batch > 0 && N % config.batch != 0) {
+        fprintf(stderr, "Error: --batch %d must divide the matrix size %d\n", config.batch, N);
+        usage();
+    }
+    if (config.batch_pointers && config.batch == 0) {
+        config.batch = 16;
+    }
     if (config.debug) {
         config.verbose = true; // debug includes verbose messages
         config.silent = false; // just in case it was accidentally set on command line
@@ -0,0 +1,112 @@
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_epilogue.h"
+
+/*
+ * Epilogues of the double A . B: --alpha, --beta, --bias row|col and --activation, linked into every
+ * implementation.
+ *
+ * Without them a product needs a zeroing pass over C before the kernels, and every post-processing step
+ * another pass after them. The blocked implementations (matrix_2, matrix_3) run both stages inside their
+ * kernels, on the sums of each C tile while they are still in registers, and the vector one on each tile
+ * while it is in cache: C is then read and written once per block along k, and beta 0 does not read it
+ * at all. The other implementations run the stages as the passes here, so they give the same results.
+ */
+
+struct epilogue gemm_epilogue = EPILOGUE_ACCUMULATE;
+
+static double *bias_values = NULL;
+
+/**
+ * Set the epilogue the implementations apply, with a random bias vector for --bias
+ */
+void prepare_epilogue(double alpha, double beta, enum bias_vector bias, enum activation activation)
+{
+    release_epilogue();
+    struct epilogue epilogue = { alpha, beta, beta / alpha, NULL, NULL, activation };
+    if (bias != BIAS_NONE) {
+        bias_values = malloc(N * sizeof(double));
+        for (size_t i = 0; i < N; i++) {
+            bias_values[i] = ((double) rand()) / ((float) RAND_MAX) - 0.5;
+        }
+        if (bias == BIAS_ROW) {
+            epilogue.row_bias = bias_values;
+        }
+        else {
+            epilogue.col_bias = bias_values;
+        }
+    }
+    gemm_epilogue = epilogue;
+}
+
+void release_epilogue()
+{
+    struct epilogue accumulate = EPILOGUE_ACCUMULATE;
+    gemm_epilogue = accumulate;
+    free(bias_values);
+    bias_values = NULL;
+}
+
+static bool finish_needed(const struct epilogue *epilogue)
+{
+    return epilogue->alpha != 1 || epilogue->row_bias != NULL || epilogue->col_bias != NULL
+           || epilogue->activation != ACTIVATION_NONE;
+}
+
+void epilogue_begin_tile(const struct epilogue *epilogue, double result[][N], size_t ii, size_t jj,
+                         size_t rows, size_t cols)
+{
+    if (epilogue->c_scale == 1) {
+        return;
+    }
+    for (size_t i = ii; i < ii + rows; i++) {
+        double *restrict c = &result[i][jj];
+        if (epilogue->c_scale == 0) {
+            memset(c, 0, cols * sizeof(double));
+            continue;
+        }
+#pragma omp simd
+        for (size_t j = 0; j < cols; j++) {
+            c[j] *= epilogue->c_scale;
+        }
+    }
+}
+
+void epilogue_end_tile(const struct epilogue *epilogue, double result[][N], size_t ii, size_t jj,
+                       size_t rows, size_t cols)
+{
+    if (!finish_needed(epilogue)) {
+        return;
+    }
+    for (size_t i = ii; i < ii + rows; i++) {
+        for (size_t j = jj; j < jj + cols; j++) {
+            result[i][j] = epilogue_finish(epilogue, result[i][j], i, j);
+        }
+    }
+}
+
+void epilogue_begin(const struct epilogue *epilogue, double result[][N])
+{
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < N; i++) {
+        epilogue_begin_tile(epilogue, result, i, 0, 1, N);
+    }
+}
+
+void epilogue_end(const struct epilogue *epilogue, double result[][N])
+{
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < N; i++) {
+        epilogue_end_tile(epilogue, result, i, 0, 1, N);
+    }
+}
+
+void epilogue_merge(const struct epilogue *epilogue, double product[][N], double result[][N])
+{
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            epilogue_store(epilogue, TILE_FIRST | TILE_LAST, &result[i][j], product[i][j], i, j);
+        }
+    }
+}
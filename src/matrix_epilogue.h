@@ -0,0 +1,97 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include "matrix_types.h"
+
+/*
+ * Epilogue of the double A . B of the implementations: C = activation(alpha A . B + beta C + bias),
+ * the bias one value per row or per column. See matrix_epilogue.c.
+ *
+ * The kernels accumulate their partial sums into C, so the epilogue comes in two stages: before the
+ * first partial sum C is scaled by c_scale = beta / alpha (not read at all when beta is 0, so it needs
+ * no zeroing), and after the last one it is multiplied by alpha, the bias added and the activation
+ * applied. The blocked kernels run the stages on each C tile as they store their sums (epilogue_store),
+ * the others as passes over C.
+ */
+
+// stages of a C tile: the product of its first and of its last blocks along k
+#define TILE_FIRST 1
+#define TILE_LAST 2
+
+// the initial C of a driver run with --beta
+#define EPILOGUE_INITIAL_C 1.0
+
+struct epilogue {
+    double alpha;
+    double beta;
+    double c_scale;         // beta / alpha, C is scaled by it before the product is accumulated
+    const double *row_bias; // N values, row_bias[i] added to row i, or NULL
+    const double *col_bias; // N values, col_bias[j] added to column j, or NULL
+    enum activation activation;
+};
+
+// C += A . B, what the kernels did before epilogues: the default for every engine
+#define EPILOGUE_ACCUMULATE { 1.0, 1.0, 1.0, NULL, NULL, ACTIVATION_NONE }
+
+// the epilogue the implementations apply to their dot_multiply_matrices result
+extern struct epilogue gemm_epilogue;
+
+extern void prepare_epilogue(double alpha, double beta, enum bias_vector bias, enum activation activation);
+extern void release_epilogue();
+
+// the stages on a rows x cols tile of C at ii, jj, for the kernels that do not store through epilogue_store
+extern void epilogue_begin_tile(const struct epilogue *epilogue, double result[][N], size_t ii, size_t jj,
+                                size_t rows, size_t cols);
+extern void epilogue_end_tile(const struct epilogue *epilogue, double result[][N], size_t ii, size_t jj,
+                              size_t rows, size_t cols);
+// the stages as passes over the whole of C
+extern void epilogue_begin(const struct epilogue *epilogue, double result[][N]);
+extern void epilogue_end(const struct epilogue *epilogue, double result[][N]);
+// C = activation(alpha product + beta C + bias), for the implementations that overwrite C
+extern void epilogue_merge(const struct epilogue *epilogue, double product[][N], double result[][N]);
+
+static inline double epilogue_activation(enum activation activation, double x)
+{
+    switch (activation) {
+        case ACTIVATION_RELU: return x > 0 ? x : 0;
+        case ACTIVATION_SIGMOID: return 1.0 / (1.0 + exp(-x));
+        case ACTIVATION_TANH: return tanh(x);
+        case ACTIVATION_GELU: return 0.5 * x * (1.0 + tanh(0.7978845608028654 * (x + 0.044715 * x * x * x)));
+        default: return x;
+    }
+}
+
+/**
+ * The last stage on the accumulated value of C(i, j)
+ */
+static inline double epilogue_finish(const struct epilogue *epilogue, double value, size_t i, size_t j)
+{
+    value *= epilogue->alpha;
+    if (epilogue->row_bias != NULL) {
+        value += epilogue->row_bias[i];
+    }
+    if (epilogue->col_bias != NULL) {
+        value += epilogue->col_bias[j];
+    }
+    return epilogue_activation(epilogue->activation, value);
+}
+
+/**
+ * Store a partial sum of A . B to C(i, j) at the given stages of its tile, while it is still in a register
+ */
+static inline void epilogue_store(const struct epilogue *epilogue, unsigned stage, double *c, double sum,
+                                  size_t i, size_t j)
+{
+    double value = sum;
+    if (!(stage & TILE_FIRST)) {
+        value += *c;
+    }
+    else if (epilogue->c_scale != 0) {
+        value += epilogue->c_scale * *c;
+    }
+    if (stage & TILE_LAST) {
+        value = epilogue_finish(epilogue, value, i, j);
+    }
+    *c = value;
+}
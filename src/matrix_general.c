@@ -0,0 +1,207 @@
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_tiles.h"
+#if defined(GEMV_NT_PREFETCH) && defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Products of general shapes for --a-rows and --b-cols, linked into every implementation:
+ * the first a_rows rows of A times the first b_cols columns of B.
+ *
+ * When one side is a few vectors the product reads each element of the matrix once and does 2 flops
+ * with it, so it is bound by memory bandwidth and the blocked GEMM machinery (packing, tiles) only
+ * gets in the way. These shapes take the bandwidth paths:
+ *  - GEMV, b_cols <= GEMV_MAX_VECTORS: y = A.x, the rows of A split into one contiguous range per
+ *    thread, each thread streaming its rows once and dotting them with the (cached) vectors
+ *  - GEVM, a_rows <= GEMV_MAX_VECTORS: y = x.B, the columns of B split into one range per thread,
+ *    each thread streaming its slice of every row of B into the (cached) output rows
+ * The matrix is streamed in contiguous runs that the hardware prefetchers follow. Building with
+ * -DGEMV_NT_PREFETCH adds non-temporal prefetches ahead of the loads, so the matrix (used once) does not
+ * evict the vectors from the caches: measured on an AVX-512 server they cost half the bandwidth of the
+ * plain loads, so they are off by default. These runs report bytes/s rather than FLOP/s.
+ * Other shapes run the tile GEMM.
+ */
+
+#define GEMV_MAX_VECTORS 4
+#define GEMV_CHUNK 512    // doubles streamed per step (4 KiB)
+#define GEMV_PREFETCH 2048 // doubles ahead of the loads (16 KiB)
+
+static size_t general_rows()
+{
+    return config->a_rows > 0 ? (size_t)config->a_rows : N;
+}
+
+static size_t general_cols()
+{
+    return config->b_cols > 0 ? (size_t)config->b_cols : N;
+}
+
+/**
+ * @return true when the shape takes a bandwidth bound path (GEMV or GEVM)
+ */
+bool general_streaming()
+{
+    return general_cols() <= GEMV_MAX_VECTORS || general_rows() <= GEMV_MAX_VECTORS;
+}
+
+/**
+ * Compulsory memory traffic of the product: A, B and the result once each
+ */
+double general_bytes()
+{
+    return (double)(general_rows() * N + N * general_cols() + general_rows() * general_cols()) * sizeof(double);
+}
+
+/**
+ * Hint that the cache lines of the next chunk of a stream are used once (with -DGEMV_NT_PREFETCH)
+ */
+static inline void stream_ahead(const double *next, const double *end)
+{
+#if defined(GEMV_NT_PREFETCH) && defined(__SSE__)
+    for (const double *line = next; line < next + GEMV_CHUNK && line < end; line += 8) {
+        _mm_prefetch((const char *)line, _MM_HINT_NTA);
+    }
+#else
+    (void)next;
+    (void)end;
+#endif
+}
+
+/**
+ * y[i] = A[i] . x for the rows of A in [first, last), one vector
+ */
+static void gemv_1(size_t first, size_t last, double matrix[][N], const double *restrict x, double result[][N])
+{
+    const double *end = &matrix[last - 1][N - 1] + 1;
+    for (size_t i = first; i < last; i++) {
+        const double *restrict row = matrix[i];
+        double sum = 0;
+        for (size_t kk = 0; kk < N; kk += GEMV_CHUNK) {
+            size_t depth = MIN((size_t)GEMV_CHUNK, N - kk);
+            stream_ahead(row + kk + GEMV_PREFETCH, end);
+#pragma omp simd reduction(+:sum)
+            for (size_t k = kk; k < kk + depth; k++) {
+                sum += row[k] * x[k];
+            }
+        }
+        result[i][0] = sum;
+    }
+}
+
+/**
+ * y[i][v] = A[i] . x[v] for the rows of A in [first, last), up to GEMV_MAX_VECTORS vectors
+ * (the missing ones are zero in x)
+ */
+static void gemv_4(size_t first, size_t last, size_t vectors, double matrix[][N], const double *restrict x,
+                   double result[][N])
+{
+    const double *end = &matrix[last - 1][N - 1] + 1;
+    const double *restrict x0 = x, *restrict x1 = x + N, *restrict x2 = x + 2 * N, *restrict x3 = x + 3 * N;
+    for (size_t i = first; i < last; i++) {
+        const double *restrict row = matrix[i];
+        double sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+        for (size_t kk = 0; kk < N; kk += GEMV_CHUNK) {
+            size_t depth = MIN((size_t)GEMV_CHUNK, N - kk);
+            stream_ahead(row + kk + GEMV_PREFETCH, end);
+#pragma omp simd reduction(+:sum0, sum1, sum2, sum3)
+            for (size_t k = kk; k < kk + depth; k++) {
+                sum0 += row[k] * x0[k];
+                sum1 += row[k] * x1[k];
+                sum2 += row[k] * x2[k];
+                sum3 += row[k] * x3[k];
+            }
+        }
+        double sums[GEMV_MAX_VECTORS] = { sum0, sum1, sum2, sum3 };
+        for (size_t v = 0; v < vectors; v++) {
+            result[i][v] = sums[v];
+        }
+    }
+}
+
+static long gemv(size_t rows, size_t vectors, double matrix1[][N], double matrix2[][N], double result[][N])
+{
+    // the columns of B as contiguous vectors, padded with zero vectors for gemv_4
+    double *x = calloc(GEMV_MAX_VECTORS * N, sizeof(double));
+    if (x == NULL) {
+        ERROR("Could not allocate the vectors");
+        return MATRIX_FAILED;
+    }
+    for (size_t k = 0; k < N; k++) {
+        for (size_t v = 0; v < vectors; v++) {
+            x[v * N + k] = matrix2[k][v];
+        }
+    }
+#pragma omp parallel
+    {
+        // one contiguous range of rows per thread, so each streams a single run of A
+        size_t threads = omp_get_num_threads(), thread = omp_get_thread_num();
+        size_t first = rows * thread / threads, last = rows * (thread + 1) / threads;
+        phase_begin(PHASE_KERNEL);
+        if (first < last) {
+            if (vectors == 1) {
+                gemv_1(first, last, matrix1, x, result);
+            }
+            else {
+                gemv_4(first, last, vectors, matrix1, x, result);
+            }
+        }
+        phase_end(PHASE_KERNEL);
+    }
+    free(x);
+    return 1;
+}
+
+static long gevm(size_t vectors, size_t cols, double matrix1[][N], double matrix2[][N], double result[][N])
+{
+#pragma omp parallel
+    {
+        // one range of columns per thread, a multiple of 8 doubles so the threads do not share cache lines
+        size_t threads = omp_get_num_threads(), thread = omp_get_thread_num();
+        size_t lines = (cols + 7) / 8;
+        size_t first = MIN(lines * thread / threads * 8, cols), last = MIN(lines * (thread + 1) / threads * 8, cols);
+        phase_begin(PHASE_KERNEL);
+        for (size_t v = 0; v < vectors; v++) {
+            memset(&result[v][first], 0, (last - first) * sizeof(double));
+        }
+        for (size_t k = 0; k < N && first < last; k++) {
+            const double *restrict b = &matrix2[k][first];
+            if (k + 1 < N) {
+                stream_ahead(&matrix2[k + 1][first], &matrix2[k + 1][last]);
+            }
+            for (size_t v = 0; v < vectors; v++) {
+                double x = matrix1[v][k];
+                double *restrict y = &result[v][first];
+#pragma omp simd
+                for (size_t j = 0; j < last - first; j++) {
+                    y[j] += x * b[j];
+                }
+            }
+        }
+        phase_end(PHASE_KERNEL);
+    }
+    return 1;
+}
+
+/**
+ * Multiply the first --a-rows rows of A by the first --b-cols columns of B into the top left of result
+ *
+ * @param result preallocated zeroed matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_general(double matrix1[][N], double matrix2[][N], double result[][N])
+{
+    size_t rows = general_rows(), cols = general_cols();
+    if (cols <= GEMV_MAX_VECTORS) {
+        INFO("Running GEMV %zu x %d . %d x %zu, streaming A", rows, N, N, cols);
+        return gemv(rows, cols, matrix1, matrix2, result);
+    }
+    if (rows <= GEMV_MAX_VECTORS) {
+        INFO("Running GEVM %zu x %d . %d x %zu, streaming B", rows, N, N, cols);
+        return gevm(rows, cols, matrix1, matrix2, result);
+    }
+    INFO("Running matrix_mult %zu x %d . %d x %zu on the tiles", rows, N, N, cols);
+    struct tile_matrix a = { &matrix1[0][0], N, 1 }, b = { &matrix2[0][0], N, 1 }, c = { &result[0][0], N, 1 };
+    tile_gemm(rows, cols, N, 1.0, a, b, c);
+    return 1; // forget about flops - we'll add it from known values
+}
@@ -0,0 +1,152 @@
+#include "matrix.h"
+#include "matrix_types.h"
+#include "half_convert.h"
+
+/*
+ * Products on fp16 or bf16 storage for --storage, linked into every implementation.
+ *
+ * A and B are narrowed to 16 bits once when the data is loaded (prepare_half_storage, outside the
+ * measured time), which quarters their footprint and the bytes the product streams. The product
+ * widens panels of them to float while packing (F16C for fp16 on x86) and accumulates in float:
+ * for each block of rows of A, the A panel is widened once, then each panel of rows of B in turn.
+ */
+
+#define HALF_DEFAULT_BLOCK 64
+
+static enum storage half_storage = STORAGE_DOUBLE;
+static uint16_t *half_a = NULL;
+static uint16_t *half_b = NULL;
+
+static void narrow_matrix(enum storage storage, double matrix[][N], uint16_t *narrowed)
+{
+#pragma omp parallel
+    {
+        float *row = malloc(N * sizeof(float));
+#pragma omp for schedule(static)
+        for (size_t i = 0; i < N; i++) {
+            for (size_t j = 0; j < N; j++) {
+                row[j] = (float)matrix[i][j];
+            }
+            if (storage == STORAGE_FP16) {
+                narrow_fp16(row, narrowed + i * N, N);
+            }
+            else {
+                narrow_bf16(row, narrowed + i * N, N);
+            }
+        }
+        free(row);
+    }
+}
+
+static void widen_panel(const uint16_t *src, float *dst, size_t count)
+{
+    if (half_storage == STORAGE_FP16) {
+        widen_fp16(src, dst, count);
+    }
+    else {
+        widen_bf16(src, dst, count);
+    }
+}
+
+/**
+ * Keep 16 bit copies of A and B for the products that follow
+ */
+void prepare_half_storage(enum storage storage, double matrix1[][N], double matrix2[][N])
+{
+    release_half_storage();
+    half_storage = storage;
+    half_a = malloc((size_t)N * N * sizeof(uint16_t));
+    half_b = malloc((size_t)N * N * sizeof(uint16_t));
+    if (half_a == NULL || half_b == NULL) {
+        ERROR("Could not allocate the %s copies of the matrices", storage_name(storage));
+        exit(1);
+    }
+    narrow_matrix(storage, matrix1, half_a);
+    narrow_matrix(storage, matrix2, half_b);
+    INFO("Stored A and B as %s: %zu MiB each instead of %zu MiB", storage_name(storage),
+         (size_t)N * N * sizeof(uint16_t) >> 20, (size_t)N * N * sizeof(double) >> 20);
+}
+
+void release_half_storage()
+{
+    free(half_a);
+    free(half_b);
+    half_a = NULL;
+    half_b = NULL;
+}
+
+/**
+ * Multiply the 16 bit copies of A and B made by prepare_half_storage
+ *
+ * Uses the block size from the global config (-b, default 64) for the panel height.
+ * The result does not need to be zeroed: it is overwritten.
+ *
+ * @param result preallocated matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_half(double result[][N])
+{
+    if (half_a == NULL || half_b == NULL) {
+        ERROR("No 16 bit copies of the matrices: call prepare_half_storage first");
+        return MATRIX_FAILED;
+    }
+    size_t bsize = config->block_size > 0 ? (size_t)config->block_size : HALF_DEFAULT_BLOCK;
+    bsize = MIN(bsize, (size_t)N);
+    INFO("Running %s storage matrix_mult %d x %d with panels of %zu rows", storage_name(half_storage), N, N, bsize);
+    bool failed = false;
+#pragma omp parallel shared(result, bsize, failed)
+    {
+        float *a_panel = malloc(bsize * N * sizeof(float));
+        float *b_panel = malloc(bsize * N * sizeof(float));
+        float *c_panel = malloc(bsize * N * sizeof(float));
+        if (a_panel == NULL || b_panel == NULL || c_panel == NULL) {
+#pragma omp atomic write
+            failed = true;
+        }
+#pragma omp barrier
+        // every thread takes the same branch so they all reach the worksharing loop or none do
+        if (!failed) {
+#pragma omp for schedule(dynamic)
+            for (size_t ii = 0; ii < N; ii += bsize) {
+                size_t rows = MIN(bsize, N - ii);
+                phase_begin(PHASE_PACK_A);
+                widen_panel(half_a + ii * N, a_panel, rows * N);
+                phase_end(PHASE_PACK_A);
+                memset(c_panel, 0, rows * N * sizeof(float));
+                for (size_t kk = 0; kk < N; kk += bsize) {
+                    size_t depth = MIN(bsize, N - kk);
+                    phase_begin(PHASE_PACK_B);
+                    widen_panel(half_b + kk * N, b_panel, depth * N);
+                    phase_end(PHASE_PACK_B);
+                    phase_begin(PHASE_KERNEL);
+                    for (size_t i = 0; i < rows; i++) {
+                        float *restrict c = c_panel + i * N;
+                        for (size_t k = 0; k < depth; k++) {
+                            float a_ik = a_panel[i * N + kk + k];
+                            const float *restrict b = b_panel + k * N;
+                            for (size_t j = 0; j < N; j++) {
+                                c[j] += a_ik * b[j];
+                            }
+                        }
+                    }
+                    phase_end(PHASE_KERNEL);
+                }
+                phase_begin(PHASE_WRITE_BACK);
+                for (size_t i = 0; i < rows; i++) {
+                    for (size_t j = 0; j < N; j++) {
+                        result[ii + i][j] = c_panel[i * N + j];
+                    }
+                }
+                phase_end(PHASE_WRITE_BACK);
+            }
+        }
+        free(a_panel);
+        free(b_panel);
+        free(c_panel);
+    }
+    if (failed) {
+        ERROR("Could not allocate the float panels");
+        return MATRIX_FAILED;
+    }
+    return 1; // forget about flops - we'll add it from known values
+}
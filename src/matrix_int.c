@@ -0,0 +1,407 @@
+#include <math.h>
+#include <stdint.h>
+#include "matrix.h"
+#include "matrix_types.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INT_GEMM_X86
+#endif
+
+/*
+ * Quantized integer products for --storage int8|int16, linked into every implementation.
+ *
+ * When the data is loaded (prepare_int_storage, outside the measured time) each row of A and each
+ * column of B is quantized symmetrically with its own scale: q = round(x / scale) with
+ * scale = max |x| / QMAX. The product accumulates q_a . q_b in int32 and dequantizes on the way out:
+ * C[i][j] = scale_a[i] * scale_b[j] * sum_k q_a[i][k] q_b[k][j].
+ *
+ * B is stored transposed so both operands of each dot product are contiguous, and the rows are
+ * zero-padded to a multiple of 64 bytes for the vector loops. The kernel is picked at run time:
+ *  - avx512-vnni / avx-vnni: vpdpbusd (int8) and vpdpwssd (int16) multiply and sum into int32 in
+ *    one instruction. vpdpbusd takes unsigned A bytes, so A is stored offset by +128 and the
+ *    128 * column sum of B is subtracted at the end
+ *  - avx2: sign extend to int16 and vpmaddwd, which sums pairs of products into int32. This also
+ *    serves int8: vpmaddubsw would saturate its int16 pair sums at full int8 range
+ *  - generic C loops otherwise
+ *
+ * int16 is quantized to a range whose worst case sum of N products still fits in int32 (+/-724 at
+ * N = 4096), which is 3 more bits than int8.
+ */
+
+#define INT_ROW_ALIGN 64 // bytes: one zmm register
+#define INT_COLUMNS 4    // columns of B per pass, sharing each load of the A row
+#define INT_BLOCK_ROWS 16
+#define INT_BLOCK_COLS 64
+
+enum int_kernel { INT_KERNEL_GENERIC, INT_KERNEL_AVX2, INT_KERNEL_AVX_VNNI, INT_KERNEL_AVX512_VNNI };
+
+static struct {
+    enum storage storage;
+    enum int_kernel kernel;
+    size_t length;          // padded row length in elements
+    int qmax;               // largest quantized magnitude
+    void *a;                // quantized rows of A (offset by +128 as uint8 for the int8 vnni kernels)
+    void *bt;               // quantized columns of B, one per row
+    double *a_scales;
+    double *b_scales;
+    int32_t *b_sums;        // sum of each quantized column of B, for the +128 offset of A
+} int_operands = { STORAGE_DOUBLE, INT_KERNEL_GENERIC, 0, 0, NULL, NULL, NULL, NULL, NULL };
+
+char *int_kernel_name(enum int_kernel kernel)
+{
+    switch (kernel) {
+        case INT_KERNEL_AVX2: return "avx2 vpmaddwd";
+        case INT_KERNEL_AVX_VNNI: return "avx-vnni";
+        case INT_KERNEL_AVX512_VNNI: return "avx512-vnni";
+        default: return "generic";
+    }
+}
+
+static size_t int_element_bytes(enum storage storage)
+{
+    return storage == STORAGE_INT8 ? sizeof(int8_t) : sizeof(int16_t);
+}
+
+/**
+ * Largest quantized magnitude: 127 for int8; for int16 the largest q with N q^2 within int32
+ */
+int int_quantized_max(enum storage storage)
+{
+    if (storage == STORAGE_INT8) {
+        return 127;
+    }
+    int qmax = (int)sqrt((double)INT32_MAX / N);
+    return MIN(qmax, INT16_MAX);
+}
+
+/**
+ * Quantize count vectors of length elements, each with its own scale (per-row scales)
+ *
+ * Element e of vector v is at src[v * vector_stride + e * element_stride], so the same helper
+ * quantizes the rows of A (stride N, 1) and the columns of B (stride 1, N).
+ * Quantized vectors are written padded_length apart with zeros after length.
+ */
+void quantize_vectors(enum storage storage, int qmax, const double *src, size_t count, size_t length,
+                      size_t vector_stride, size_t element_stride, void *quantized, size_t padded_length,
+                      double *scales)
+{
+#pragma omp parallel for schedule(static)
+    for (size_t v = 0; v < count; v++) {
+        const double *vector = src + v * vector_stride;
+        double max_abs = 0;
+        for (size_t e = 0; e < length; e++) {
+            max_abs = MAX(max_abs, fabs(vector[e * element_stride]));
+        }
+        double scale = max_abs > 0 ? max_abs / qmax : 1.0;
+        scales[v] = scale;
+        for (size_t e = 0; e < padded_length; e++) {
+            long q = e < length ? lrint(vector[e * element_stride] / scale) : 0;
+            q = MAX(-qmax, MIN(qmax, q));
+            if (storage == STORAGE_INT8) {
+                ((int8_t *)quantized)[v * padded_length + e] = (int8_t)q;
+            }
+            else {
+                ((int16_t *)quantized)[v * padded_length + e] = (int16_t)q;
+            }
+        }
+    }
+}
+
+/**
+ * Dequantize an int32 accumulator: the inverse of quantize_vectors for a product of two vectors
+ */
+static inline double dequantize(int32_t accumulator, double a_scale, double b_scale)
+{
+    return (double)accumulator * a_scale * b_scale;
+}
+
+/*
+ * Kernels: accumulators for row a against INT_COLUMNS columns of B, acc[c] = a . bt[c]
+ */
+
+static void int8_generic(const void *a_row, const void *bt[INT_COLUMNS], size_t length, int32_t acc[INT_COLUMNS])
+{
+    const int8_t *a = a_row;
+    for (int c = 0; c < INT_COLUMNS; c++) {
+        const int8_t *b = bt[c];
+        int32_t sum = 0;
+        for (size_t k = 0; k < length; k++) {
+            sum += (int32_t)a[k] * b[k];
+        }
+        acc[c] = sum;
+    }
+}
+
+static void int16_generic(const void *a_row, const void *bt[INT_COLUMNS], size_t length, int32_t acc[INT_COLUMNS])
+{
+    const int16_t *a = a_row;
+    for (int c = 0; c < INT_COLUMNS; c++) {
+        const int16_t *b = bt[c];
+        int32_t sum = 0;
+        for (size_t k = 0; k < length; k++) {
+            sum += (int32_t)a[k] * b[k];
+        }
+        acc[c] = sum;
+    }
+}
+
+#ifdef INT_GEMM_X86
+__attribute__((target("avx2")))
+static inline int32_t hsum_epi32_256(__m256i v)
+{
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2")))
+static void int8_avx2(const void *a_row, const void *bt[INT_COLUMNS], size_t length, int32_t acc[INT_COLUMNS])
+{
+    const int8_t *a = a_row;
+    __m256i sums[INT_COLUMNS];
+    for (int c = 0; c < INT_COLUMNS; c++) sums[c] = _mm256_setzero_si256();
+    for (size_t k = 0; k < length; k += 16) {
+        __m256i a16 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + k)));
+        for (int c = 0; c < INT_COLUMNS; c++) {
+            __m256i b16 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)((const int8_t *)bt[c] + k)));
+            sums[c] = _mm256_add_epi32(sums[c], _mm256_madd_epi16(a16, b16));
+        }
+    }
+    for (int c = 0; c < INT_COLUMNS; c++) acc[c] = hsum_epi32_256(sums[c]);
+}
+
+__attribute__((target("avx2")))
+static void int16_avx2(const void *a_row, const void *bt[INT_COLUMNS], size_t length, int32_t acc[INT_COLUMNS])
+{
+    const int16_t *a = a_row;
+    __m256i sums[INT_COLUMNS];
+    for (int c = 0; c < INT_COLUMNS; c++) sums[c] = _mm256_setzero_si256();
+    for (size_t k = 0; k < length; k += 16) {
+        __m256i a16 = _mm256_loadu_si256((const __m256i *)(a + k));
+        for (int c = 0; c < INT_COLUMNS; c++) {
+            __m256i b16 = _mm256_loadu_si256((const __m256i *)((const int16_t *)bt[c] + k));
+            sums[c] = _mm256_add_epi32(sums[c], _mm256_madd_epi16(a16, b16));
+        }
+    }
+    for (int c = 0; c < INT_COLUMNS; c++) acc[c] = hsum_epi32_256(sums[c]);
+}
+
+// a_row holds the int8 values offset by +128 as uint8
+__attribute__((target("avx2,avxvnni")))
+static void int8_avx_vnni(const void *a_row, const void *bt[INT_COLUMNS], size_t length, int32_t acc[INT_COLUMNS])
+{
+    const uint8_t *a = a_row;
+    __m256i sums[INT_COLUMNS];
+    for (int c = 0; c < INT_COLUMNS; c++) sums[c] = _mm256_setzero_si256();
+    for (size_t k = 0; k < length; k += 32) {
+        __m256i a8 = _mm256_loadu_si256((const __m256i *)(a + k));
+        for (int c = 0; c < INT_COLUMNS; c++) {
+            __m256i b8 = _mm256_loadu_si256((const __m256i *)((const int8_t *)bt[c] + k));
+            sums[c] = _mm256_dpbusd_avx_epi32(sums[c], a8, b8);
+        }
+    }
+    for (int c = 0; c < INT_COLUMNS; c++) acc[c] = hsum_epi32_256(sums[c]);
+}
+
+__attribute__((target("avx2,avxvnni")))
+static void int16_avx_vnni(const void *a_row, const void *bt[INT_COLUMNS], size_t length, int32_t acc[INT_COLUMNS])
+{
+    const int16_t *a = a_row;
+    __m256i sums[INT_COLUMNS];
+    for (int c = 0; c < INT_COLUMNS; c++) sums[c] = _mm256_setzero_si256();
+    for (size_t k = 0; k < length; k += 16) {
+        __m256i a16 = _mm256_loadu_si256((const __m256i *)(a + k));
+        for (int c = 0; c < INT_COLUMNS; c++) {
+            __m256i b16 = _mm256_loadu_si256((const __m256i *)((const int16_t *)bt[c] + k));
+            sums[c] = _mm256_dpwssd_avx_epi32(sums[c], a16, b16);
+        }
+    }
+    for (int c = 0; c < INT_COLUMNS; c++) acc[c] = hsum_epi32_256(sums[c]);
+}
+
+// a_row holds the int8 values offset by +128 as uint8
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static void int8_avx512_vnni(const void *a_row, const void *bt[INT_COLUMNS], size_t length, int32_t acc[INT_COLUMNS])
+{
+    const uint8_t *a = a_row;
+    __m512i sums[INT_COLUMNS];
+    for (int c = 0; c < INT_COLUMNS; c++) sums[c] = _mm512_setzero_si512();
+    for (size_t k = 0; k < length; k += 64) {
+        __m512i a8 = _mm512_loadu_si512((const void *)(a + k));
+        for (int c = 0; c < INT_COLUMNS; c++) {
+            __m512i b8 = _mm512_loadu_si512((const void *)((const int8_t *)bt[c] + k));
+            sums[c] = _mm512_dpbusd_epi32(sums[c], a8, b8);
+        }
+    }
+    for (int c = 0; c < INT_COLUMNS; c++) acc[c] = _mm512_reduce_add_epi32(sums[c]);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static void int16_avx512_vnni(const void *a_row, const void *bt[INT_COLUMNS], size_t length, int32_t acc[INT_COLUMNS])
+{
+    const int16_t *a = a_row;
+    __m512i sums[INT_COLUMNS];
+    for (int c = 0; c < INT_COLUMNS; c++) sums[c] = _mm512_setzero_si512();
+    for (size_t k = 0; k < length; k += 32) {
+        __m512i a16 = _mm512_loadu_si512((const void *)(a + k));
+        for (int c = 0; c < INT_COLUMNS; c++) {
+            __m512i b16 = _mm512_loadu_si512((const void *)((const int16_t *)bt[c] + k));
+            sums[c] = _mm512_dpwssd_epi32(sums[c], a16, b16);
+        }
+    }
+    for (int c = 0; c < INT_COLUMNS; c++) acc[c] = _mm512_reduce_add_epi32(sums[c]);
+}
+#endif
+
+/**
+ * Pick the fastest kernel the CPU reports
+ */
+enum int_kernel detect_int_kernel()
+{
+#ifdef INT_GEMM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw")) {
+        return INT_KERNEL_AVX512_VNNI;
+    }
+    if (__builtin_cpu_supports("avxvnni")) {
+        return INT_KERNEL_AVX_VNNI;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return INT_KERNEL_AVX2;
+    }
+#endif
+    return INT_KERNEL_GENERIC;
+}
+
+typedef void (*int_kernel_function)(const void *a_row, const void *bt[INT_COLUMNS], size_t length,
+                                    int32_t acc[INT_COLUMNS]);
+
+static int_kernel_function int_kernel_for(enum storage storage, enum int_kernel kernel)
+{
+    bool int8 = storage == STORAGE_INT8;
+    switch (kernel) {
+#ifdef INT_GEMM_X86
+        case INT_KERNEL_AVX512_VNNI: return int8 ? int8_avx512_vnni : int16_avx512_vnni;
+        case INT_KERNEL_AVX_VNNI: return int8 ? int8_avx_vnni : int16_avx_vnni;
+        case INT_KERNEL_AVX2: return int8 ? int8_avx2 : int16_avx2;
+#endif
+        default: return int8 ? int8_generic : int16_generic;
+    }
+}
+
+// the int8 vnni kernels multiply unsigned A bytes
+static bool int_offset_a(enum storage storage, enum int_kernel kernel)
+{
+    return storage == STORAGE_INT8 && (kernel == INT_KERNEL_AVX512_VNNI || kernel == INT_KERNEL_AVX_VNNI);
+}
+
+void release_int_storage()
+{
+    free(int_operands.a);
+    free(int_operands.bt);
+    free(int_operands.a_scales);
+    free(int_operands.b_scales);
+    free(int_operands.b_sums);
+    int_operands.a = int_operands.bt = NULL;
+    int_operands.a_scales = int_operands.b_scales = NULL;
+    int_operands.b_sums = NULL;
+}
+
+/**
+ * Quantize A by rows and B by columns for the integer products that follow
+ */
+void prepare_int_storage(enum storage storage, double matrix1[][N], double matrix2[][N])
+{
+    release_int_storage();
+    size_t element_bytes = int_element_bytes(storage);
+    size_t row_elements = INT_ROW_ALIGN / element_bytes;
+    int_operands.storage = storage;
+    int_operands.kernel = detect_int_kernel();
+    int_operands.length = (N + row_elements - 1) / row_elements * row_elements;
+    int_operands.qmax = int_quantized_max(storage);
+    int_operands.a = malloc(N * int_operands.length * element_bytes);
+    int_operands.bt = malloc(N * int_operands.length * element_bytes);
+    int_operands.a_scales = malloc(N * sizeof(double));
+    int_operands.b_scales = malloc(N * sizeof(double));
+    int_operands.b_sums = malloc(N * sizeof(int32_t));
+    if (int_operands.a == NULL || int_operands.bt == NULL || int_operands.a_scales == NULL
+        || int_operands.b_scales == NULL || int_operands.b_sums == NULL) {
+        ERROR("Could not allocate the %s copies of the matrices", storage_name(storage));
+        exit(1);
+    }
+    quantize_vectors(storage, int_operands.qmax, &matrix1[0][0], N, N, N, 1,
+                     int_operands.a, int_operands.length, int_operands.a_scales);
+    quantize_vectors(storage, int_operands.qmax, &matrix2[0][0], N, N, 1, N,
+                     int_operands.bt, int_operands.length, int_operands.b_scales);
+
+    if (int_offset_a(storage, int_operands.kernel)) {
+        // uint8 = int8 + 128 is a flip of the sign bit; the padding becomes 128 but multiplies B's zero padding
+        uint8_t *a = int_operands.a;
+        for (size_t e = 0; e < N * int_operands.length; e++) {
+            a[e] ^= 0x80;
+        }
+        for (size_t j = 0; j < N; j++) {
+            const int8_t *b = (const int8_t *)int_operands.bt + j * int_operands.length;
+            int32_t sum = 0;
+            for (size_t k = 0; k < N; k++) {
+                sum += b[k];
+            }
+            int_operands.b_sums[j] = sum;
+        }
+    }
+    INFO("Quantized A by rows and B by columns to %s (|q| <= %d): %zu MiB each instead of %zu MiB, %s kernel",
+         storage_name(storage), int_operands.qmax, N * int_operands.length * element_bytes >> 20,
+         (size_t)N * N * sizeof(double) >> 20, int_kernel_name(int_operands.kernel));
+}
+
+/**
+ * Multiply the quantized copies of A and B made by prepare_int_storage and dequantize into result
+ *
+ * The result does not need to be zeroed: it is overwritten.
+ *
+ * @param result preallocated matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_int(double result[][N])
+{
+    if (int_operands.a == NULL || int_operands.bt == NULL) {
+        ERROR("No quantized copies of the matrices: call prepare_int_storage first");
+        return MATRIX_FAILED;
+    }
+    enum storage storage = int_operands.storage;
+    size_t element_bytes = int_element_bytes(storage);
+    size_t length = int_operands.length;
+    const char *a = int_operands.a;
+    const char *bt = int_operands.bt;
+    int_kernel_function kernel = int_kernel_for(storage, int_operands.kernel);
+    bool offset = int_offset_a(storage, int_operands.kernel);
+    INFO("Running %s matrix_mult %d x %d with the %s kernel", storage_name(storage), N, N,
+         int_kernel_name(int_operands.kernel));
+
+    // blocks of rows of A against blocks of columns of B, so the B block stays in L2 across the rows
+#pragma omp parallel for collapse(2) schedule(dynamic)
+    for (size_t ii = 0; ii < N; ii += INT_BLOCK_ROWS) {
+        for (size_t jj = 0; jj < N; jj += INT_BLOCK_COLS) {
+            phase_begin(PHASE_KERNEL);
+            for (size_t i = ii; i < MIN(ii + INT_BLOCK_ROWS, N); i++) {
+                const void *a_row = a + i * length * element_bytes;
+                for (size_t j = jj; j < MIN(jj + INT_BLOCK_COLS, N); j += INT_COLUMNS) {
+                    const void *columns[INT_COLUMNS];
+                    int32_t acc[INT_COLUMNS];
+                    for (int c = 0; c < INT_COLUMNS; c++) {
+                        // past the last column repeat it, the extra results are dropped
+                        columns[c] = bt + MIN(j + c, N - 1) * length * element_bytes;
+                    }
+                    kernel(a_row, columns, length, acc);
+                    for (int c = 0; c < INT_COLUMNS && j + c < N; c++) {
+                        int32_t sum = offset ? acc[c] - 128 * int_operands.b_sums[j + c] : acc[c];
+                        result[i][j + c] = dequantize(sum, int_operands.a_scales[i], int_operands.b_scales[j + c]);
+                    }
+                }
+            }
+            phase_end(PHASE_KERNEL);
+        }
+    }
+    return 1; // forget about flops - we'll add it from known values
+}
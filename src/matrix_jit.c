@@ -0,0 +1,320 @@
+#define _GNU_SOURCE // getpid, mkdir and dlopen even with -std=c99
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_tiles.h"
+
+/*
+ * Kernels generated at run time for the exact shape (--jit), linked into every implementation.
+ *
+ * The fixed kernels know the block size at best: when -b does not divide N, the last row, column and
+ * depth of tiles are partial and run in the generic loops, which is where the odd shapes lose. Here
+ * the C source of a kernel per tile shape is generated with everything a constant: the block size,
+ * the remainders N % b in each dimension and the leading dimension N. The local compiler builds it
+ * once with -O3 -march=native, so it also targets the ISA of the machine, into a shared object that
+ * is loaded with dlopen.
+ *
+ * The shared objects are cached on disk (--jit-cache, default ~/.cache/speedmm) named by a hash of the
+ * generated source, the compiler command and the CPU (model and flags from /proc/cpuinfo), so later runs
+ * on the same shape and machine load them without compiling, and a new CPU or compiler gets its own.
+ * The compiler is $CC, else cc. When it cannot be run the product falls back to tile_gemm.
+ * Without HOME or --jit-cache there is no cache and --jit does the same, and nothing is loaded from a
+ * directory or file that is not owned by the current user or that the group or others can write.
+ *
+ * The tiles of C are spread over the threads as in tile_gemm and A and B are read in place: the
+ * kernels run a register blocked i k j loop on them and accumulate into C.
+ */
+
+#define JIT_DEFAULT_CACHE ".cache/speedmm"
+#define JIT_FLAGS "-O3 -march=native -fPIC -shared"
+
+typedef void (*jit_kernel)(const double *restrict a, const double *restrict b, double *restrict c);
+
+static struct {
+    void *library;
+    size_t bsize;
+    jit_kernel kernels[2][2][2]; // [partial rows][partial cols][partial depth]
+} jit = { NULL, 0, { { { NULL } } } };
+
+static size_t jit_extent(size_t partial)
+{
+    return partial ? N % jit.bsize : jit.bsize;
+}
+
+/**
+ * 64 bit FNV-1a, to name the cached kernels
+ */
+static uint64_t jit_hash(uint64_t hash, const char *text)
+{
+    for (; *text; text++) {
+        hash = (hash ^ (unsigned char)*text) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * The model name and flags of the CPU, so a cached kernel (or a saved plan) is only reused where it was
+ * built for
+ */
+uint64_t jit_hash_cpu(uint64_t hash)
+{
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+    if (cpuinfo == NULL) {
+        return jit_hash(hash, "unknown cpu");
+    }
+    char line[8192];
+    bool model = false, flags = false;
+    while ((!model || !flags) && fgets(line, sizeof(line), cpuinfo) != NULL) {
+        if (!model && strncmp(line, "model name", 10) == 0) {
+            hash = jit_hash(hash, line);
+            model = true;
+        }
+        else if (!flags && strncmp(line, "flags", 5) == 0) {
+            hash = jit_hash(hash, line);
+            flags = true;
+        }
+    }
+    fclose(cpuinfo);
+    return hash;
+}
+
+static void jit_write_kernel(FILE *out, size_t rows, size_t cols, size_t depth, bool partial_rows,
+                             bool partial_cols, bool partial_depth)
+{
+    fprintf(out,
+            "void jit_kernel_%d%d%d(const double *restrict a, const double *restrict b, double *restrict c)\n"
+            "{\n"
+            "    for (int i = 0; i < %zu; i++) {\n"
+            "        double row[%zu];\n"
+            "        for (int j = 0; j < %zu; j++) row[j] = c[i * %d + j];\n"
+            "        for (int k = 0; k < %zu; k++) {\n"
+            "            double a_ik = a[i * %d + k];\n"
+            "            for (int j = 0; j < %zu; j++) row[j] += a_ik * b[k * %d + j];\n"
+            "        }\n"
+            "        for (int j = 0; j < %zu; j++) c[i * %d + j] = row[j];\n"
+            "    }\n"
+            "}\n\n",
+            partial_rows, partial_cols, partial_depth, rows, cols, cols, N, depth, N, cols, N, cols, N);
+}
+
+/**
+ * Write the source of the kernels for every tile shape of an N x N product in blocks of bsize
+ */
+static void jit_write_source(FILE *out)
+{
+    fprintf(out, "// generated by speedmm for N = %d in blocks of %zu\n\n", N, jit.bsize);
+    for (int partial_rows = 0; partial_rows < 2; partial_rows++) {
+        for (int partial_cols = 0; partial_cols < 2; partial_cols++) {
+            for (int partial_depth = 0; partial_depth < 2; partial_depth++) {
+                if ((partial_rows || partial_cols || partial_depth) && N % jit.bsize == 0) {
+                    continue;
+                }
+                jit_write_kernel(out, jit_extent(partial_rows), jit_extent(partial_cols), jit_extent(partial_depth),
+                                 partial_rows, partial_cols, partial_depth);
+            }
+        }
+    }
+}
+
+/**
+ * The cache directory, created private (0700) if missing
+ *
+ * @return NULL when there is neither --jit-cache nor HOME: no shared fallback, since whatever
+ *         is found in the directory gets loaded
+ */
+static char *jit_cache_dir(char *buffer, size_t size)
+{
+    if (config->jit_cache != NULL) {
+        snprintf(buffer, size, "%s", config->jit_cache);
+    }
+    else if (getenv("HOME") != NULL && getenv("HOME")[0] != '\0') {
+        snprintf(buffer, size, "%s/%s", getenv("HOME"), JIT_DEFAULT_CACHE);
+    }
+    else {
+        return NULL;
+    }
+    // mkdir -p
+    for (char *slash = strchr(buffer + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(buffer, 0700);
+        *slash = '/';
+    }
+    mkdir(buffer, 0700);
+    return buffer;
+}
+
+/**
+ * Whether a cache entry can be trusted: owned by the current user and not writable by the
+ * group or others, so nobody else could have planted a library there
+ */
+static bool jit_private(const char *path)
+{
+    struct stat status;
+    if (stat(path, &status) != 0) {
+        ERROR("Cannot stat %s: %s", path, strerror(errno));
+        return false;
+    }
+    if (status.st_uid != geteuid() || (status.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        ERROR("%s is not owned by the current user or is writable by others: falling back to the generic tiles",
+              path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Compile the generated source into the shared object, through a temporary name so that
+ * concurrent runs never load a half written file
+ *
+ * @return false if the compiler failed
+ */
+static bool jit_compile(const char *compiler, const char *source, const char *library)
+{
+    char temporary[4200];
+    char command[9000];
+    snprintf(temporary, sizeof(temporary), "%s.%d.tmp", library, (int)getpid());
+    snprintf(command, sizeof(command), "%s %s -o '%s' '%s'", compiler, JIT_FLAGS, temporary, source);
+    DEBUG("Compiling the kernels: %s", command);
+    if (system(command) != 0) {
+        unlink(temporary);
+        return false;
+    }
+    return rename(temporary, library) == 0;
+}
+
+void release_jit_kernels()
+{
+    if (jit.library != NULL) {
+        dlclose(jit.library);
+    }
+    memset(&jit, 0, sizeof(jit));
+}
+
+/**
+ * Generate, compile or load from the cache the kernels for the N x N product in blocks of -b
+ *
+ * @return false if the kernels are not available (the product then runs tile_gemm)
+ */
+bool prepare_jit_kernels()
+{
+    release_jit_kernels();
+    jit.bsize = MIN(tile_block_size(), (size_t)N);
+    const char *compiler = getenv("CC") != NULL ? getenv("CC") : "cc";
+
+    char *source_text = NULL;
+    size_t source_size = 0;
+    FILE *source_stream = open_memstream(&source_text, &source_size);
+    if (source_stream == NULL) {
+        ERROR("Could not generate the kernel source");
+        return false;
+    }
+    jit_write_source(source_stream);
+    fclose(source_stream);
+
+    uint64_t hash = jit_hash(0xcbf29ce484222325ULL, source_text);
+    hash = jit_hash(jit_hash(hash, compiler), JIT_FLAGS);
+    hash = jit_hash_cpu(hash);
+    char cache[4096];
+    char library[4200];
+    char source[4200];
+    if (jit_cache_dir(cache, sizeof(cache)) == NULL) {
+        ERROR("No directory for the kernels (set HOME or --jit-cache): falling back to the generic tiles");
+        free(source_text);
+        return false;
+    }
+    if (!jit_private(cache)) {
+        free(source_text);
+        return false;
+    }
+    snprintf(library, sizeof(library), "%s/kernel_%016llx.so", cache, (unsigned long long)hash);
+
+    double start = omp_get_wtime();
+    if (access(library, R_OK) == 0) {
+        INFO("Loading the kernels for blocks of %zu from the cache: %s", jit.bsize, library);
+    }
+    else {
+        snprintf(source, sizeof(source), "%s/kernel_%016llx.c", cache, (unsigned long long)hash);
+        FILE *out = fopen(source, "w");
+        if (out == NULL) {
+            ERROR("Cannot write the kernel source to %s: falling back to the generic tiles", source);
+            free(source_text);
+            return false;
+        }
+        fputs(source_text, out);
+        fclose(out);
+        INFO("Compiling the kernels for blocks of %zu with %s: %s", jit.bsize, compiler, library);
+        if (!jit_compile(compiler, source, library)) {
+            ERROR("Could not compile the kernels with %s: falling back to the generic tiles", compiler);
+            free(source_text);
+            return false;
+        }
+    }
+    free(source_text);
+
+    if (!jit_private(library)) {
+        return false;
+    }
+    jit.library = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+    if (jit.library == NULL) {
+        ERROR("Could not load the kernels: %s", dlerror());
+        return false;
+    }
+    for (int partial_rows = 0; partial_rows < 2; partial_rows++) {
+        for (int partial_cols = 0; partial_cols < 2; partial_cols++) {
+            for (int partial_depth = 0; partial_depth < 2; partial_depth++) {
+                char name[32];
+                snprintf(name, sizeof(name), "jit_kernel_%d%d%d", partial_rows, partial_cols, partial_depth);
+                // ISO C has no function pointer from void *, POSIX guarantees this one
+                *(void **)&jit.kernels[partial_rows][partial_cols][partial_depth] = dlsym(jit.library, name);
+            }
+        }
+    }
+    if (jit.kernels[0][0][0] == NULL) {
+        ERROR("The kernel library %s has no kernels", library);
+        release_jit_kernels();
+        return false;
+    }
+    INFO("Kernels ready in %.3f s", omp_get_wtime() - start);
+    return true;
+}
+
+/**
+ * Multiply the matrices with the kernels made by prepare_jit_kernels, or tile_gemm without them
+ *
+ * IMPORTANT: The result matrix must be zeroed for this function to succeed
+ *
+ * @param result preallocated zeroed matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_jit(double matrix1[][N], double matrix2[][N], double result[][N])
+{
+    if (jit.library == NULL) {
+        INFO("Running matrix_mult %d x %d on the generic tiles", N, N);
+        struct tile_matrix a = { &matrix1[0][0], N, 1 }, b = { &matrix2[0][0], N, 1 }, c = { &result[0][0], N, 1 };
+        tile_gemm(N, N, N, 1.0, a, b, c);
+        return 1;
+    }
+    size_t bsize = jit.bsize;
+    size_t tiles = (N + bsize - 1) / bsize;
+    INFO("Running matrix_mult %d x %d with the generated kernels in blocks of %zu", N, N, bsize);
+#pragma omp parallel
+    {
+        phase_begin(PHASE_KERNEL);
+#pragma omp for collapse(2) schedule(dynamic)
+        for (size_t ti = 0; ti < tiles; ti++) {
+            for (size_t tj = 0; tj < tiles; tj++) {
+                size_t ii = ti * bsize, jj = tj * bsize;
+                for (size_t kk = 0; kk < N; kk += bsize) {
+                    jit_kernel kernel = jit.kernels[ii + bsize > N][jj + bsize > N][kk + bsize > N];
+                    kernel(&matrix1[ii][kk], &matrix2[kk][jj], &result[ii][jj]);
+                }
+            }
+        }
+        phase_end(PHASE_KERNEL);
+    }
+    return 1; // forget about flops - we'll add it from known values
+}
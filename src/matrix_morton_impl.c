@@ -0,0 +1,205 @@
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_epilogue.h"
+
+/*
+ * Cache-oblivious divide-and-conquer multiplication on a Morton (Z-order) tile layout.
+ *
+ * A, B and C are converted to square MORTON_TILE x MORTON_TILE tiles stored in Z-order, so every
+ * quadrant at every level of the recursion is one contiguous quarter of its parent. The recursion
+ * then gets good locality at every cache level without a block size tuned for any of them:
+ * some level of the recursion always fits in L1, another in L2, another in L3.
+ *
+ * Each level does C11 += A11.B11, C12 += A11.B12, C21 += A21.B11, C22 += A21.B12 as 4 parallel
+ * tasks on disjoint quadrants of C, then the other 4 halves, so no temporaries are needed.
+ * The conversion from and to row-major happens once at the edges, the copy back to row-major storing
+ * the product through the epilogue.
+ */
+
+// 3 tiles of 32x32 doubles (24 KiB) fit in L1 with room to spare
+#define MORTON_TILE 32
+// stop spawning tasks below this many elements per side, the task overhead outweighs the work
+#define MORTON_TASK_MIN 128
+
+// spread the bits of x apart so they can be interleaved with another index
+static size_t part1by1(size_t x)
+{
+    size_t z = 0;
+    for (size_t bit = 0; bit < sizeof(size_t) * 4; bit++) {
+        z |= ((x >> bit) & 1) << (2 * bit);
+    }
+    return z;
+}
+
+/**
+ * Offset of tile (ti, tj) in the Morton layout: quadrants in the order 11, 12, 21, 22
+ */
+size_t morton_tile_offset(size_t ti, size_t tj)
+{
+    return ((part1by1(ti) << 1) | part1by1(tj)) * MORTON_TILE * MORTON_TILE;
+}
+
+/**
+ * @return number of tiles per side, rounded up to a power of 2 so every level splits in quadrants
+ */
+size_t morton_tiles()
+{
+    size_t tiles = 1;
+    while (tiles * MORTON_TILE < N) {
+        tiles *= 2;
+    }
+    return tiles;
+}
+
+/**
+ * Copy a row-major matrix into Morton tiles (padding with zeros past N), counted as the given pack phase
+ */
+void to_morton(double matrix[][N], double *morton, size_t tiles, enum counter_phase phase)
+{
+#pragma omp parallel
+    {
+        phase_begin(phase);
+#pragma omp for collapse(2) schedule(static)
+        for (size_t ti = 0; ti < tiles; ti++) {
+            for (size_t tj = 0; tj < tiles; tj++) {
+                double *tile = morton + morton_tile_offset(ti, tj);
+                for (size_t i = 0; i < MORTON_TILE; i++) {
+                    for (size_t j = 0; j < MORTON_TILE; j++) {
+                        size_t row = ti * MORTON_TILE + i, col = tj * MORTON_TILE + j;
+                        tile[i * MORTON_TILE + j] = row < N && col < N ? matrix[row][col] : 0;
+                    }
+                }
+            }
+        }
+        phase_end(phase);
+    }
+}
+
+/**
+ * Copy Morton tiles back to a row-major matrix (dropping the padding) through the epilogue
+ */
+void from_morton(double *morton, double matrix[][N], size_t tiles, const struct epilogue *epilogue)
+{
+#pragma omp parallel
+    {
+        phase_begin(PHASE_WRITE_BACK);
+#pragma omp for collapse(2) schedule(static)
+        for (size_t ti = 0; ti < tiles; ti++) {
+            for (size_t tj = 0; tj < tiles; tj++) {
+                double *tile = morton + morton_tile_offset(ti, tj);
+                for (size_t i = 0; i < MORTON_TILE && ti * MORTON_TILE + i < N; i++) {
+                    for (size_t j = 0; j < MORTON_TILE && tj * MORTON_TILE + j < N; j++) {
+                        size_t row = ti * MORTON_TILE + i, col = tj * MORTON_TILE + j;
+                        epilogue_store(epilogue, TILE_FIRST | TILE_LAST, &matrix[row][col], tile[i * MORTON_TILE + j],
+                                       row, col);
+                    }
+                }
+            }
+        }
+        phase_end(PHASE_WRITE_BACK);
+    }
+}
+
+/**
+ * C += A . B on single contiguous tiles, i k j order so the inner loop vectorizes
+ */
+void morton_leaf(const double *restrict a, const double *restrict b, double *restrict c)
+{
+    for (size_t i = 0; i < MORTON_TILE; i++) {
+        for (size_t k = 0; k < MORTON_TILE; k++) {
+            double a_ik = a[i * MORTON_TILE + k];
+            for (size_t j = 0; j < MORTON_TILE; j++) {
+                c[i * MORTON_TILE + j] += a_ik * b[k * MORTON_TILE + j];
+            }
+        }
+    }
+}
+
+/**
+ * C += A . B on Morton matrices of n x n elements, with (ti, tj, tk) the tile coordinates of the
+ * C and A / B quadrants in the whole matrices (for the trace)
+ */
+void morton_recurse(size_t n, const double *a, const double *b, double *c, int ti, int tj, int tk)
+{
+    if (n == MORTON_TILE) {
+        double start = trace_now();
+        phase_begin(PHASE_KERNEL);
+        morton_leaf(a, b, c);
+        phase_end(PHASE_KERNEL);
+        trace_tile(0, start, ti * MORTON_TILE, tj * MORTON_TILE, tk * MORTON_TILE);
+        return;
+    }
+    size_t h = n / 2;
+    size_t quarter = h * h;
+    int half_tiles = (int)(h / MORTON_TILE);
+    const double *a11 = a, *a12 = a + quarter, *a21 = a + 2 * quarter, *a22 = a + 3 * quarter;
+    const double *b11 = b, *b12 = b + quarter, *b21 = b + 2 * quarter, *b22 = b + 3 * quarter;
+    double *c11 = c, *c12 = c + quarter, *c21 = c + 2 * quarter, *c22 = c + 3 * quarter;
+    bool spawn = n >= MORTON_TASK_MIN;
+
+    // first halves of the inner products, each task on its own quadrant of C
+#pragma omp task if(spawn)
+    morton_recurse(h, a11, b11, c11, ti, tj, tk);
+#pragma omp task if(spawn)
+    morton_recurse(h, a11, b12, c12, ti, tj + half_tiles, tk);
+#pragma omp task if(spawn)
+    morton_recurse(h, a21, b11, c21, ti + half_tiles, tj, tk);
+#pragma omp task if(spawn)
+    morton_recurse(h, a21, b12, c22, ti + half_tiles, tj + half_tiles, tk);
+#pragma omp taskwait
+
+    // second halves, accumulating on the same quadrants
+#pragma omp task if(spawn)
+    morton_recurse(h, a12, b21, c11, ti, tj, tk + half_tiles);
+#pragma omp task if(spawn)
+    morton_recurse(h, a12, b22, c12, ti, tj + half_tiles, tk + half_tiles);
+#pragma omp task if(spawn)
+    morton_recurse(h, a22, b21, c21, ti + half_tiles, tj, tk + half_tiles);
+#pragma omp task if(spawn)
+    morton_recurse(h, a22, b22, c22, ti + half_tiles, tj + half_tiles, tk + half_tiles);
+#pragma omp taskwait
+}
+
+/**
+ * Perform a dot-multiplication on two square matrices with the cache-oblivious recursion
+ *
+ * Needs no block size: -b and the loop order are ignored.
+ * The product is combined with the result as gemm_epilogue says (matrix_epilogue.h), while it is copied
+ * back: by default added to it, so it must be zeroed, with beta 0 it overwrites it.
+ *
+ * @param order ignored
+ * @param matrix1 left-side of the dot-multiplication
+ * @param matrix2 right-side of the dot-multiplication
+ * @param result preallocated matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_morton(enum loop_order order, double matrix1[][N], double matrix2[][N], double result[][N])
+{
+    size_t tiles = morton_tiles();
+    size_t n = tiles * MORTON_TILE;
+    INFO("Running cache-oblivious Morton matrix_mult %d x %d (%zu x %zu tiles of %d)",
+         N, N, tiles, tiles, MORTON_TILE);
+    double *a = malloc(n * n * sizeof(double));
+    double *b = malloc(n * n * sizeof(double));
+    double *c = calloc(n * n, sizeof(double));
+    if (a == NULL || b == NULL || c == NULL) {
+        ERROR("Could not allocate the Morton copies of the matrices");
+        free(a); free(b); free(c);
+        return -1;
+    }
+
+    to_morton(matrix1, a, tiles, PHASE_PACK_A);
+    to_morton(matrix2, b, tiles, PHASE_PACK_B);
+
+#pragma omp parallel shared(a, b, c, n)
+    {
+#pragma omp single
+        morton_recurse(n, a, b, c, 0, 0, 0);
+    }
+
+    from_morton(c, result, tiles, &gemm_epilogue);
+    free(a);
+    free(b);
+    free(c);
+    return 1; // forget about flops - we'll add it from known values
+}
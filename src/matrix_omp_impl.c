@@ -3,6 +3,7 @@
 #include "matrix.h"
 //#include "matrix_config.h"
 #include "matrix_types.h"
+#include "block_kernels.h"
 
 /**
  * Perform a dot-multiplication on two square matrices of a given size in i j k (natural) order
@@ -16,7 +17,7 @@
  * @param result preallocated zeroed matrix into which to store the results
  * @return number of floating point operations performed or -1 if there is a problem
  */
-void multiply_block(int ii, int jj, int kk, size_t bsize, double matrix1[][N], double matrix2[][N], double result[][N])
+static void multiply_block(int ii, int jj, int kk, size_t bsize, double matrix1[][N], double matrix2[][N], double result[][N])
 {
     double counter = 1.0f;
     {
@@ -37,25 +38,48 @@ void multiply_block(int ii, int jj, int kk, size_t bsize, double matrix1[][N], d
     }
 }
 
-long dot_multiply_matrices_blocked(size_t bsize, double matrix1[][N], double matrix2[][N], double result[][N])
+static long dot_multiply_matrices_blocked(size_t bsize, double matrix1[][N], double matrix2[][N], double result[][N])
 {
-#pragma omp parallel shared(matrix1, matrix2, result, bsize)
+    fused_block_kernel kernel = select_block_kernel(bsize);
+    const struct epilogue *epilogue = &gemm_epilogue;
+#pragma omp parallel shared(matrix1, matrix2, result, bsize, kernel, epilogue)
     {
 #pragma omp single
         {
             for (size_t ii = 0; ii < N; ii += bsize) {
                 for (size_t jj = 0; jj < N; jj += bsize) {
-                    for (size_t kk = 0; kk < N; kk += bsize) {
+                    size_t first, last;
+                    productive_blocks(ii, jj, bsize, &first, &last);
+                    if (first > last) {
+                        #pragma omp task shared(result, bsize, epilogue) firstprivate(ii, jj) \
+                            depend(inout: result[ii:bsize][jj:bsize])
+                        empty_block_tile(ii, jj, bsize, result, epilogue);
+                        continue;
+                    }
+                    for (size_t kk = first; kk <= last; kk += bsize) {
+                        if (!block_tiles_productive(ii, jj, kk)) {
+                            continue; // no task for an all-zero tile with --sparse blocks
+                        }
                         // Run the block multiplication in parallel OMP tasks
                         // making sure that the right block-sections in the matrix are identified
                         // as  as ingoing to the task or outomcing or both. in separate
                         // This is based on the OpenMP documentation example found in:
                         // https://www.openmp.org/wp-content/uploads/openmp-examples-5.0.0.pdf
-                        #pragma omp task shared(matrix1, matrix2, result, bsize)  \
-                            firstprivate(ii, jj, kk) \
+                        // The tasks of a C tile run in kk order, so the first and last carry the epilogue
+                        double created = trace_now();
+                        unsigned stage = tile_stage(kk, first, last);
+                        #pragma omp task shared(matrix1, matrix2, result, bsize, kernel, epilogue)  \
+                            firstprivate(ii, jj, kk, created, stage) \
                             depend(in: matrix1[ii:bsize][kk:bsize], matrix2[kk:bsize][jj:bsize]) \
                             depend(inout: result[ii:bsize][jj:bsize])
-                        multiply_block(ii, jj, kk, bsize, matrix1, matrix2, result);
+                        {
+                            double start = trace_now();
+                            phase_begin(PHASE_KERNEL);
+                            run_block_kernel(kernel, multiply_block, ii, jj, kk, bsize, matrix1, matrix2, result,
+                                             epilogue, stage);
+                            phase_end(PHASE_KERNEL);
+                            trace_tile(created, start, ii, jj, kk);
+                        }
                     }
                 }
             }
@@ -71,15 +95,16 @@ long dot_multiply_matrices_blocked(size_t bsize, double matrix1[][N], double mat
  * Relies on the global config to get the block_size (so that it can match the signature
  * of the same function in other implementation modules)
  *
- * IMPORTANT: The result matrix must be zeroed for this function to succeed
+ * The result is combined with the product as gemm_epilogue says (matrix_epilogue.h): by default the product
+ * is added to it, so it must be zeroed, with beta 0 it is overwritten without being read.
  *
  * @param order the loop order: one of ijk, kij, or kji
  * @param matrix1 left-side of the dot-multiplication
  * @param matrix2 right-side of the dot-multiplication
- * @param result preallocated zeroed matrix into which to store the results
+ * @param result preallocated matrix into which to store the results
  * @return number of doubleing point operations performed or -1 if there is a problem
  */
-long dot_multiply_matrices(enum loop_order order, double matrix1[][N], double matrix2[][N], double result[][N])
+long dot_multiply_matrices_omp(enum loop_order order, double matrix1[][N], double matrix2[][N], double result[][N])
 {
     int bsize = config->block_size;
     if (bsize < 1) {
@@ -90,7 +115,8 @@ long dot_multiply_matrices(enum loop_order order, double matrix1[][N], double ma
         ERROR("matrix N (%zu) must be a whole multiple of block-size (-b %d) to use the blocking implementation", N, bsize);
         return MATRIX_FAILED;
     }
-    INFO("Running matrix_mult %d x %d in blocks of %d", N, N, bsize);
+    INFO("Running matrix_mult %d x %d in blocks of %d (%s kernel)", N, N, bsize,
+         select_block_kernel(bsize) != NULL ? "specialized" : "generic");
     switch(order) {
         case ijk:
             return dot_multiply_matrices_blocked(bsize, matrix1, matrix2, result);
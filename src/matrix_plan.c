@@ -0,0 +1,472 @@
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_plan.h"
+
+/*
+ * Plans for double GEMMs (--plan), linked into every implementation.
+ *
+ * A plan fixes the kernel, the block size and the schedule of the C tiles over a fixed number of threads
+ * for one shape. PLAN_MEASURE runs every candidate on a sample of the shape (each dimension cut to
+ * PLAN_SAMPLE) and keeps the fastest, PLAN_ESTIMATE takes -b (default 64), the register blocked kernel
+ * and the dynamic schedule. The packed tiles of every thread are allocated with the plan.
+ *
+ * plan_pack_b copies a B that does not change into the panels the kernel reads, depth x cols tiles one
+ * after the other in kk then jj order, so each execution only packs its tiles of A and runs the kernel.
+ * That is the case of many A multiplied by the same B (weights against batches of inputs).
+ *
+ * The saved plan is a text file of "key value" lines: the shape, thread count and CPU it was made for,
+ * then the choices. plan_load refuses a plan made for anything else, so a stale file gets replanned.
+ */
+
+#define PLAN_MAGIC "speedmm-plan"
+#define PLAN_VERSION 1
+#define PLAN_SAMPLE 512 // dimensions of the sample the candidates are timed on
+#define PLAN_TRIALS 2   // runs of each candidate, the first warms the caches
+
+static const size_t plan_blocks[] = { 32, 64, 128, 256 };
+
+char *plan_kernel_name(enum plan_kernel kernel)
+{
+    return kernel == PLAN_KERNEL_ROWS4 ? "rows4" : "ikj";
+}
+
+char *plan_schedule_name(enum plan_schedule schedule)
+{
+    return schedule == PLAN_STATIC ? "static" : "dynamic";
+}
+
+static struct tile_matrix plan_at(struct tile_matrix matrix, size_t i, size_t j)
+{
+    struct tile_matrix tile = { matrix.data + i * matrix.ld + j * matrix.step, matrix.ld, matrix.step };
+    return tile;
+}
+
+/**
+ * C tile += A tile . B tile, one row of C at a time: the inner loop streams a row of B and vectorizes
+ */
+static void plan_kernel_ikj(size_t rows, size_t cols, size_t depth, const double *restrict a,
+                            const double *restrict b, double *restrict c)
+{
+    for (size_t i = 0; i < rows; i++) {
+        for (size_t k = 0; k < depth; k++) {
+            double a_ik = a[i * depth + k];
+#pragma omp simd
+            for (size_t j = 0; j < cols; j++) {
+                c[i * cols + j] += a_ik * b[k * cols + j];
+            }
+        }
+    }
+}
+
+/**
+ * C tile += A tile . B tile, 4 rows of C at a time: each row of B is loaded once for the 4
+ */
+static void plan_kernel_rows4(size_t rows, size_t cols, size_t depth, const double *restrict a,
+                              const double *restrict b, double *restrict c)
+{
+    size_t i = 0;
+    for (; i + 4 <= rows; i += 4) {
+        double *restrict c0 = &c[i * cols], *restrict c1 = c0 + cols, *restrict c2 = c1 + cols,
+               *restrict c3 = c2 + cols;
+        for (size_t k = 0; k < depth; k++) {
+            double a0 = a[i * depth + k], a1 = a[(i + 1) * depth + k];
+            double a2 = a[(i + 2) * depth + k], a3 = a[(i + 3) * depth + k];
+            const double *restrict b_row = &b[k * cols];
+#pragma omp simd
+            for (size_t j = 0; j < cols; j++) {
+                c0[j] += a0 * b_row[j];
+                c1[j] += a1 * b_row[j];
+                c2[j] += a2 * b_row[j];
+                c3[j] += a3 * b_row[j];
+            }
+        }
+    }
+    plan_kernel_ikj(rows - i, cols, depth, &a[i * depth], b, &c[i * cols]);
+}
+
+static void free_tiles(double **tiles, int threads)
+{
+    if (tiles == NULL) {
+        return;
+    }
+    for (int t = 0; t < threads; t++) {
+        free(tiles[t]);
+    }
+    free(tiles);
+}
+
+void plan_destroy(struct gemm_plan *plan)
+{
+    if (plan == NULL) {
+        return;
+    }
+    free(plan->packed_b);
+    free_tiles(plan->a_tiles, plan->threads);
+    free_tiles(plan->b_tiles, plan->threads);
+    free_tiles(plan->c_tiles, plan->threads);
+    free(plan);
+}
+
+static double **alloc_tiles(int threads, size_t bsize)
+{
+    double **tiles = calloc(threads, sizeof(double *));
+    for (int t = 0; tiles != NULL && t < threads; t++) {
+        tiles[t] = malloc(bsize * bsize * sizeof(double));
+        if (tiles[t] == NULL) {
+            free_tiles(tiles, threads);
+            return NULL;
+        }
+    }
+    return tiles;
+}
+
+/**
+ * A plan with its choices made: allocate its per thread tiles
+ */
+static struct gemm_plan *new_plan(size_t m, size_t n, size_t k, int threads, enum plan_kernel kernel,
+                                  size_t bsize, enum plan_schedule schedule)
+{
+    struct gemm_plan *plan = calloc(1, sizeof(struct gemm_plan));
+    if (plan == NULL) {
+        return NULL;
+    }
+    plan->m = m;
+    plan->n = n;
+    plan->k = k;
+    plan->threads = threads;
+    plan->cpu = jit_hash_cpu(0xcbf29ce484222325ULL);
+    plan->kernel = kernel;
+    plan->bsize = bsize;
+    plan->schedule = schedule;
+    plan->a_tiles = alloc_tiles(threads, bsize);
+    plan->b_tiles = alloc_tiles(threads, bsize);
+    plan->c_tiles = alloc_tiles(threads, bsize);
+    if (plan->a_tiles == NULL || plan->b_tiles == NULL || plan->c_tiles == NULL) {
+        ERROR("Could not allocate the packed tiles of the plan");
+        plan_destroy(plan);
+        return NULL;
+    }
+    return plan;
+}
+
+/**
+ * Pack B into the panels of the plan, so the executions read it without packing it
+ *
+ * @return false if the memory could not be allocated
+ */
+bool plan_pack_b(struct gemm_plan *plan, struct tile_matrix b)
+{
+    free(plan->packed_b);
+    plan->packed_b = malloc(plan->k * plan->n * sizeof(double));
+    if (plan->packed_b == NULL) {
+        ERROR("Could not allocate the packed B of the plan");
+        return false;
+    }
+    size_t bsize = plan->bsize;
+#pragma omp parallel for collapse(2) schedule(static) num_threads(plan->threads)
+    for (size_t kk = 0; kk < plan->k; kk += bsize) {
+        for (size_t jj = 0; jj < plan->n; jj += bsize) {
+            size_t depth = MIN(bsize, plan->k - kk), cols = MIN(bsize, plan->n - jj);
+            tile_pack(depth, cols, 1.0, plan_at(b, kk, jj), plan->packed_b + kk * plan->n + jj * depth);
+        }
+    }
+    return true;
+}
+
+static void plan_tile(const struct gemm_plan *plan, size_t ii, size_t jj, struct tile_matrix a,
+                      struct tile_matrix b, struct tile_matrix c, const struct epilogue *epilogue, int thread)
+{
+    size_t bsize = plan->bsize;
+    size_t rows = MIN(bsize, plan->m - ii), cols = MIN(bsize, plan->n - jj);
+    double *a_tile = plan->a_tiles[thread], *c_tile = plan->c_tiles[thread];
+    memset(c_tile, 0, rows * cols * sizeof(double));
+    for (size_t kk = 0; kk < plan->k; kk += bsize) {
+        size_t depth = MIN(bsize, plan->k - kk);
+        phase_begin(PHASE_PACK_A);
+        tile_pack(rows, depth, 1.0, plan_at(a, ii, kk), a_tile);
+        phase_end(PHASE_PACK_A);
+        const double *b_panel = plan->packed_b != NULL ? plan->packed_b + kk * plan->n + jj * depth : NULL;
+        if (b_panel == NULL) {
+            phase_begin(PHASE_PACK_B);
+            tile_pack(depth, cols, 1.0, plan_at(b, kk, jj), plan->b_tiles[thread]);
+            phase_end(PHASE_PACK_B);
+            b_panel = plan->b_tiles[thread];
+        }
+        phase_begin(PHASE_KERNEL);
+        if (plan->kernel == PLAN_KERNEL_ROWS4) {
+            plan_kernel_rows4(rows, cols, depth, a_tile, b_panel, c_tile);
+        }
+        else {
+            plan_kernel_ikj(rows, cols, depth, a_tile, b_panel, c_tile);
+        }
+        phase_end(PHASE_KERNEL);
+    }
+    phase_begin(PHASE_WRITE_BACK);
+    for (size_t i = 0; i < rows; i++) {
+        for (size_t j = 0; j < cols; j++) {
+            double *element = c.data + (ii + i) * c.ld + (jj + j) * c.step;
+            epilogue_store(epilogue, TILE_FIRST | TILE_LAST, element, c_tile[i * cols + j], ii + i, jj + j);
+        }
+    }
+    phase_end(PHASE_WRITE_BACK);
+}
+
+/**
+ * C = A . B through the epilogue for the m x k A, k x n B and m x n C of the plan given as strided views
+ */
+void plan_execute(const struct gemm_plan *plan, struct tile_matrix a, struct tile_matrix b, struct tile_matrix c,
+                  const struct epilogue *epilogue)
+{
+    struct epilogue accumulate = EPILOGUE_ACCUMULATE;
+    if (epilogue == NULL) {
+        epilogue = &accumulate;
+    }
+    size_t row_tiles = (plan->m + plan->bsize - 1) / plan->bsize;
+    size_t col_tiles = (plan->n + plan->bsize - 1) / plan->bsize;
+#pragma omp parallel num_threads(plan->threads)
+    {
+        int thread = omp_get_thread_num();
+        if (plan->schedule == PLAN_STATIC) {
+#pragma omp for collapse(2) schedule(static)
+            for (size_t ti = 0; ti < row_tiles; ti++) {
+                for (size_t tj = 0; tj < col_tiles; tj++) {
+                    plan_tile(plan, ti * plan->bsize, tj * plan->bsize, a, b, c, epilogue, thread);
+                }
+            }
+        }
+        else {
+#pragma omp for collapse(2) schedule(dynamic)
+            for (size_t ti = 0; ti < row_tiles; ti++) {
+                for (size_t tj = 0; tj < col_tiles; tj++) {
+                    plan_tile(plan, ti * plan->bsize, tj * plan->bsize, a, b, c, epilogue, thread);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Best time of the plan on random operands of its shape, B packed
+ */
+static double time_plan(struct gemm_plan *plan)
+{
+    double *a = malloc(plan->m * plan->k * sizeof(double));
+    double *b = malloc(plan->k * plan->n * sizeof(double));
+    double *c = malloc(plan->m * plan->n * sizeof(double));
+    double best = -1;
+    if (a != NULL && b != NULL && c != NULL) {
+        for (size_t e = 0; e < plan->m * plan->k; e++) {
+            a[e] = (double)(e % 7) / 7.0;
+        }
+        for (size_t e = 0; e < plan->k * plan->n; e++) {
+            b[e] = (double)(e % 5) / 5.0;
+        }
+        struct tile_matrix va = { a, plan->k, 1 }, vb = { b, plan->n, 1 }, vc = { c, plan->n, 1 };
+        struct epilogue overwrite = { 1.0, 0.0, 0.0, NULL, NULL, ACTIVATION_NONE };
+        if (plan_pack_b(plan, vb)) {
+            for (int trial = 0; trial < PLAN_TRIALS; trial++) {
+                double start = omp_get_wtime();
+                plan_execute(plan, va, vb, vc, &overwrite);
+                double elapsed = omp_get_wtime() - start;
+                best = best < 0 ? elapsed : MIN(best, elapsed);
+            }
+        }
+    }
+    free(a);
+    free(b);
+    free(c);
+    return best;
+}
+
+/**
+ * Make a plan for C = A . B with an m x k A and a k x n B on the given number of threads
+ *
+ * @param flags PLAN_MEASURE to time the candidates, PLAN_ESTIMATE to take the defaults
+ * @return NULL if the memory could not be allocated
+ */
+struct gemm_plan *plan_gemm(size_t m, size_t n, size_t k, int threads, int flags)
+{
+    enum plan_kernel kernel = PLAN_KERNEL_ROWS4;
+    size_t bsize = tile_block_size();
+    enum plan_schedule schedule = PLAN_DYNAMIC;
+    double gflops = 0;
+    if (flags == PLAN_MEASURE) {
+        size_t sample_m = MIN(m, (size_t)PLAN_SAMPLE), sample_n = MIN(n, (size_t)PLAN_SAMPLE);
+        size_t sample_k = MIN(k, (size_t)PLAN_SAMPLE);
+        size_t largest = MAX(sample_m, MAX(sample_n, sample_k));
+        double sample_flops = 2.0 * sample_m * sample_n * sample_k, best = -1;
+        for (size_t b = 0; b < sizeof(plan_blocks) / sizeof(plan_blocks[0]); b++) {
+            if (b > 0 && plan_blocks[b] > largest) {
+                break; // a single partial tile, like the smaller block
+            }
+            for (enum plan_kernel candidate = PLAN_KERNEL_IKJ; candidate <= PLAN_KERNEL_ROWS4; candidate++) {
+                for (enum plan_schedule order = PLAN_STATIC; order <= PLAN_DYNAMIC; order++) {
+                    struct gemm_plan *sample = new_plan(sample_m, sample_n, sample_k, threads, candidate,
+                                                        plan_blocks[b], order);
+                    double seconds = sample != NULL ? time_plan(sample) : -1;
+                    plan_destroy(sample);
+                    if (seconds <= 0) {
+                        continue;
+                    }
+                    VERBOSE("Plan candidate %s kernel, blocks of %zu, %s schedule: %.3f GFLOP/s",
+                            plan_kernel_name(candidate), plan_blocks[b], plan_schedule_name(order),
+                            sample_flops / seconds / 1e9);
+                    if (best < 0 || seconds < best) {
+                        best = seconds;
+                        kernel = candidate;
+                        bsize = plan_blocks[b];
+                        schedule = order;
+                    }
+                }
+            }
+        }
+        gflops = best > 0 ? sample_flops / best / 1e9 : 0;
+    }
+    struct gemm_plan *plan = new_plan(m, n, k, threads, kernel, bsize, schedule);
+    if (plan != NULL) {
+        plan->gflops = gflops;
+    }
+    return plan;
+}
+
+bool plan_save(const struct gemm_plan *plan, const char *path)
+{
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        ERROR("Cannot write the plan to %s", path);
+        return false;
+    }
+    fprintf(out, "%s %d\n", PLAN_MAGIC, PLAN_VERSION);
+    fprintf(out, "m %zu\nn %zu\nk %zu\ndtype double\nthreads %d\ncpu %016llx\n", plan->m, plan->n, plan->k,
+            plan->threads, (unsigned long long)plan->cpu);
+    fprintf(out, "kernel %s\nblock %zu\nschedule %s\ngflops %.3f\n", plan_kernel_name(plan->kernel), plan->bsize,
+            plan_schedule_name(plan->schedule), plan->gflops);
+    fclose(out);
+    return true;
+}
+
+struct gemm_plan *plan_load(const char *path, size_t m, size_t n, size_t k, int threads)
+{
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        return NULL;
+    }
+    char key[64], value[64];
+    int version = 0;
+    size_t saved_m = 0, saved_n = 0, saved_k = 0, bsize = 0;
+    int saved_threads = 0;
+    unsigned long long cpu = 0;
+    bool is_double = false;
+    enum plan_kernel kernel = PLAN_KERNEL_ROWS4;
+    enum plan_schedule schedule = PLAN_DYNAMIC;
+    double gflops = 0;
+    if (fscanf(in, "%63s %d", key, &version) != 2 || strcmp(key, PLAN_MAGIC) != 0 || version != PLAN_VERSION) {
+        ERROR("%s is not a plan", path);
+        fclose(in);
+        return NULL;
+    }
+    while (fscanf(in, "%63s %63s", key, value) == 2) {
+        if (strcmp(key, "m") == 0) saved_m = strtoull(value, NULL, 10);
+        else if (strcmp(key, "n") == 0) saved_n = strtoull(value, NULL, 10);
+        else if (strcmp(key, "k") == 0) saved_k = strtoull(value, NULL, 10);
+        else if (strcmp(key, "dtype") == 0) is_double = strcmp(value, "double") == 0;
+        else if (strcmp(key, "threads") == 0) saved_threads = atoi(value);
+        else if (strcmp(key, "cpu") == 0) cpu = strtoull(value, NULL, 16);
+        else if (strcmp(key, "kernel") == 0) kernel = strcmp(value, "ikj") == 0 ? PLAN_KERNEL_IKJ : PLAN_KERNEL_ROWS4;
+        else if (strcmp(key, "block") == 0) bsize = strtoull(value, NULL, 10);
+        else if (strcmp(key, "schedule") == 0) schedule = strcmp(value, "static") == 0 ? PLAN_STATIC : PLAN_DYNAMIC;
+        else if (strcmp(key, "gflops") == 0) gflops = atof(value);
+    }
+    fclose(in);
+    if (saved_m != m || saved_n != n || saved_k != k || !is_double || saved_threads != threads || bsize == 0) {
+        INFO("The plan in %s is for %zu x %zu x %zu on %d threads, not %zu x %zu x %zu on %d", path, saved_m, saved_n,
+             saved_k, saved_threads, m, n, k, threads);
+        return NULL;
+    }
+    if (cpu != jit_hash_cpu(0xcbf29ce484222325ULL)) {
+        INFO("The plan in %s was made on another CPU", path);
+        return NULL;
+    }
+    struct gemm_plan *plan = new_plan(m, n, k, threads, kernel, bsize, schedule);
+    if (plan != NULL) {
+        plan->gflops = gflops;
+    }
+    return plan;
+}
+
+// the plan of the driver's --plan product
+static struct gemm_plan *driver_plan = NULL;
+static bool driver_plan_loaded = false;
+static double driver_plan_seconds = 0;
+static double driver_pack_seconds = 0;
+
+/**
+ * Load the plan for the N x N product from the file, or make it and save it there, then pack B
+ *
+ * @return false if the plan could not be made
+ */
+bool prepare_gemm_plan(const char *path, bool estimate, double matrix2[][N])
+{
+    release_gemm_plan();
+    int threads = omp_get_max_threads();
+    double start = omp_get_wtime();
+    driver_plan = plan_load(path, N, N, N, threads);
+    driver_plan_loaded = driver_plan != NULL;
+    if (driver_plan == NULL) {
+        INFO("Planning the %d x %d product on %d threads (%s)", N, N, threads, estimate ? "estimate" : "measure");
+        driver_plan = plan_gemm(N, N, N, threads, estimate ? PLAN_ESTIMATE : PLAN_MEASURE);
+        if (driver_plan == NULL) {
+            return false;
+        }
+        plan_save(driver_plan, path);
+    }
+    driver_plan_seconds = omp_get_wtime() - start;
+    start = omp_get_wtime();
+    struct tile_matrix b = { &matrix2[0][0], N, 1 };
+    if (!plan_pack_b(driver_plan, b)) {
+        return false;
+    }
+    driver_pack_seconds = omp_get_wtime() - start;
+    INFO("Plan %s %s in %.3f s: %s kernel, blocks of %zu, %s schedule; B packed in %.3f s", path,
+         driver_plan_loaded ? "loaded" : "made", driver_plan_seconds, plan_kernel_name(driver_plan->kernel),
+         driver_plan->bsize, plan_schedule_name(driver_plan->schedule), driver_pack_seconds);
+    return true;
+}
+
+/**
+ * Report the plan in the metrics
+ */
+void gemm_plan_metrics(struct metrics *metrics)
+{
+    metrics->plan_kernel = driver_plan->kernel;
+    metrics->plan_block = (int)driver_plan->bsize;
+    metrics->plan_schedule = driver_plan->schedule;
+    metrics->plan_loaded = driver_plan_loaded;
+    metrics->plan_seconds = driver_plan_seconds;
+    metrics->pack_seconds = driver_pack_seconds;
+}
+
+void release_gemm_plan()
+{
+    plan_destroy(driver_plan);
+    driver_plan = NULL;
+}
+
+/**
+ * Multiply A by the B packed by prepare_gemm_plan into result through gemm_epilogue
+ *
+ * @param result preallocated matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_plan(double matrix1[][N], double result[][N])
+{
+    if (driver_plan == NULL) {
+        ERROR("The plan was not prepared");
+        return MATRIX_FAILED;
+    }
+    INFO("Running matrix_mult %d x %d on the plan: %s kernel, blocks of %zu, %s schedule, B packed", N, N,
+         plan_kernel_name(driver_plan->kernel), driver_plan->bsize, plan_schedule_name(driver_plan->schedule));
+    struct tile_matrix a = { &matrix1[0][0], N, 1 }, b = { NULL, N, 1 }, c = { &result[0][0], N, 1 };
+    plan_execute(driver_plan, a, b, c, &gemm_epilogue);
+    return 1; // forget about flops - we'll add it from known values
+}
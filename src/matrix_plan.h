@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "matrix_types.h"
+#include "matrix_tiles.h"
+#include "matrix_epilogue.h"
+
+/*
+ * Plans for double GEMMs, FFTW style: all the choices for a shape and thread count (kernel, block size,
+ * schedule) are made once by plan_gemm, optionally timing the candidates, and a constant B can be packed
+ * into the panels the kernel reads. plan_execute then only runs the tiles, with no tuning, allocation or
+ * packing of B, however many times it is called. Plans are saved to and loaded from small text files so
+ * the tuning is done once per shape and machine. See matrix_plan.c.
+ */
+
+// plan_gemm: time the candidates on a sample of the shape, or pick the defaults without running anything
+#define PLAN_MEASURE 0
+#define PLAN_ESTIMATE 1
+
+struct gemm_plan {
+    // what the plan is for, all saved
+    size_t m;
+    size_t n;
+    size_t k;
+    int threads;
+    uint64_t cpu; // jit_hash_cpu of the machine it was tuned on
+    // what it chose, all saved
+    enum plan_kernel kernel;
+    size_t bsize;
+    enum plan_schedule schedule;
+    double gflops; // of the choice on the sample, 0 when estimated
+    // execution state, not saved
+    double *packed_b;  // B in kernel panels, NULL to pack B at each execution
+    double **a_tiles;  // per thread packed tiles
+    double **b_tiles;
+    double **c_tiles;
+};
+
+extern struct gemm_plan *plan_gemm(size_t m, size_t n, size_t k, int threads, int flags);
+extern bool plan_pack_b(struct gemm_plan *plan, struct tile_matrix b);
+// C = A . B through the epilogue (NULL to add to C), B is ignored when it was packed
+extern void plan_execute(const struct gemm_plan *plan, struct tile_matrix a, struct tile_matrix b,
+                         struct tile_matrix c, const struct epilogue *epilogue);
+extern bool plan_save(const struct gemm_plan *plan, const char *path);
+// NULL when the file is missing or unreadable, or the plan is for another shape, thread count or machine
+extern struct gemm_plan *plan_load(const char *path, size_t m, size_t n, size_t k, int threads);
+extern void plan_destroy(struct gemm_plan *plan);
+
+extern char *plan_kernel_name(enum plan_kernel kernel);
+extern char *plan_schedule_name(enum plan_schedule schedule);
@@ -0,0 +1,166 @@
+#include "matrix.h"
+#include "matrix_types.h"
+
+/*
+ * Reduced and mixed precision products for --precision, linked into every implementation.
+ *
+ * The double matrices are converted to float copies first (counted as the pack phases), so the
+ * kernels stream half the bytes and fit twice the elements in each vector register:
+ *  - single: float inputs, float accumulation, float result converted back to double
+ *  - mixed:  float inputs, double accumulation (the products of two floats are exact in double)
+ *  - refine: mixed, then a correction pass with the rounding residuals A - fl(A) and B - fl(B)
+ *            held as floats, which recovers close to double accuracy at about 3x the mixed cost
+ */
+
+#define PRECISION_DEFAULT_BLOCK 64
+
+/**
+ * Round a double matrix to float, keeping the rounding residual when residual is not NULL,
+ * counted as the given pack phase
+ */
+void round_to_float(double matrix[][N], float *rounded, float *residual, enum counter_phase phase)
+{
+#pragma omp parallel
+    {
+        phase_begin(phase);
+#pragma omp for schedule(static)
+        for (size_t i = 0; i < N; i++) {
+            for (size_t j = 0; j < N; j++) {
+                float value = (float)matrix[i][j];
+                rounded[i * N + j] = value;
+                if (residual != NULL) {
+                    residual[i * N + j] = (float)(matrix[i][j] - (double)value);
+                }
+            }
+        }
+        phase_end(phase);
+    }
+}
+
+/**
+ * C = A . B all in float, blocked with i k j order inside the blocks
+ */
+void sgemm_blocked(size_t bsize, const float *restrict a, const float *restrict b, float *restrict c)
+{
+#pragma omp parallel for schedule(static)
+    for (size_t ii = 0; ii < N; ii += bsize) {
+        phase_begin(PHASE_KERNEL);
+        size_t i_end = MIN(ii + bsize, N);
+        for (size_t i = ii; i < i_end; i++) {
+            for (size_t j = 0; j < N; j++) {
+                c[i * N + j] = 0;
+            }
+        }
+        for (size_t kk = 0; kk < N; kk += bsize) {
+            for (size_t jj = 0; jj < N; jj += bsize) {
+                size_t k_end = MIN(kk + bsize, N), j_end = MIN(jj + bsize, N);
+                for (size_t i = ii; i < i_end; i++) {
+                    for (size_t k = kk; k < k_end; k++) {
+                        float a_ik = a[i * N + k];
+                        for (size_t j = jj; j < j_end; j++) {
+                            c[i * N + j] += a_ik * b[k * N + j];
+                        }
+                    }
+                }
+            }
+        }
+        phase_end(PHASE_KERNEL);
+    }
+}
+
+/**
+ * C += A . B with float inputs and double accumulation, blocked with i k j order inside the blocks
+ */
+void mixed_gemm_blocked(size_t bsize, const float *restrict a, const float *restrict b, double result[][N])
+{
+#pragma omp parallel for schedule(static)
+    for (size_t ii = 0; ii < N; ii += bsize) {
+        phase_begin(PHASE_KERNEL);
+        size_t i_end = MIN(ii + bsize, N);
+        for (size_t kk = 0; kk < N; kk += bsize) {
+            for (size_t jj = 0; jj < N; jj += bsize) {
+                size_t k_end = MIN(kk + bsize, N), j_end = MIN(jj + bsize, N);
+                for (size_t i = ii; i < i_end; i++) {
+                    double *restrict c = result[i];
+                    for (size_t k = kk; k < k_end; k++) {
+                        double a_ik = a[i * N + k];
+                        for (size_t j = jj; j < j_end; j++) {
+                            c[j] += a_ik * (double)b[k * N + j];
+                        }
+                    }
+                }
+            }
+        }
+        phase_end(PHASE_KERNEL);
+    }
+}
+
+/**
+ * Perform a dot-multiplication on two square matrices in reduced or mixed precision
+ *
+ * Uses the block size from the global config (-b, default 64); the loop order is ignored.
+ *
+ * IMPORTANT: The result matrix must be zeroed for the mixed and refine precisions
+ *
+ * @param precision one of PRECISION_SINGLE, PRECISION_MIXED or PRECISION_REFINE
+ * @param matrix1 left-side of the dot-multiplication
+ * @param matrix2 right-side of the dot-multiplication
+ * @param result preallocated zeroed matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_precision(enum precision precision, double matrix1[][N], double matrix2[][N],
+                                     double result[][N])
+{
+    size_t bsize = config->block_size > 0 ? (size_t)config->block_size : PRECISION_DEFAULT_BLOCK;
+    bool refine = precision == PRECISION_REFINE;
+    INFO("Running %s precision matrix_mult %d x %d with blocks of %zu", precision_name(precision), N, N, bsize);
+
+    size_t bytes = (size_t)N * N * sizeof(float);
+    float *a = malloc(bytes), *b = malloc(bytes);
+    float *a_residual = refine ? malloc(bytes) : NULL;
+    float *b_residual = refine ? malloc(bytes) : NULL;
+    if (a == NULL || b == NULL || (refine && (a_residual == NULL || b_residual == NULL))) {
+        ERROR("Could not allocate the float copies of the matrices");
+        free(a); free(b); free(a_residual); free(b_residual);
+        return MATRIX_FAILED;
+    }
+
+    round_to_float(matrix1, a, a_residual, PHASE_PACK_A);
+    round_to_float(matrix2, b, b_residual, PHASE_PACK_B);
+
+    if (precision == PRECISION_SINGLE) {
+        float *c = malloc(bytes);
+        if (c == NULL) {
+            ERROR("Could not allocate the float result");
+            free(a); free(b);
+            return MATRIX_FAILED;
+        }
+        sgemm_blocked(bsize, a, b, c);
+#pragma omp parallel
+        {
+            phase_begin(PHASE_WRITE_BACK);
+#pragma omp for schedule(static)
+            for (size_t i = 0; i < N; i++) {
+                for (size_t j = 0; j < N; j++) {
+                    result[i][j] = c[i * N + j];
+                }
+            }
+            phase_end(PHASE_WRITE_BACK);
+        }
+        free(c);
+    }
+    else {
+        mixed_gemm_blocked(bsize, a, b, result);
+        if (refine) {
+            // A.B = fl(A).fl(B) + fl(A).dB + dA.fl(B) + dA.dB: the last term is below double rounding
+            mixed_gemm_blocked(bsize, a, b_residual, result);
+            mixed_gemm_blocked(bsize, a_residual, b, result);
+        }
+    }
+
+    free(a);
+    free(b);
+    free(a_residual);
+    free(b_residual);
+    return 1; // forget about flops - we'll add it from known values
+}
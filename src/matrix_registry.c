@@ -0,0 +1,97 @@
+#include "matrix.h"
+#include "matrix_types.h"
+
+/*
+ * The implementations of the double A . B, all linked side by side into libspeedmm, each under its own
+ * name. The matrix_N executables select theirs by name at startup (MATRIX_IMPLEMENTATION), the matrix
+ * executable the one of --impl (or each of --compare in turn), and a libspeedmm context the one it is
+ * created with; dot_multiply_matrices then runs the selected one, so the engines that fall back to the
+ * implementation (the accuracy references, the epilogue passes) keep working whichever it is.
+ *
+ * The blocked kernels read B by rows along k (matrix2[j][k]), so they multiply by B^T: the driver's B
+ * (ones or the identity) is symmetric, libspeedmm hands them B transposed.
+ */
+
+extern long dot_multiply_matrices_simple(enum loop_order order, double matrix1[][N], double matrix2[][N],
+                                         double result[][N]);
+extern long dot_multiply_matrices_omp(enum loop_order order, double matrix1[][N], double matrix2[][N],
+                                      double result[][N]);
+extern long dot_multiply_matrices_block(enum loop_order order, double matrix1[][N], double matrix2[][N],
+                                        double result[][N]);
+extern long dot_multiply_matrices_vector(enum loop_order order, double matrix1[][N], double matrix2[][N],
+                                         double result[][N]);
+extern long dot_multiply_matrices_strassen(enum loop_order order, double matrix1[][N], double matrix2[][N],
+                                           double result[][N]);
+extern void prepare_strassen();
+extern long dot_multiply_matrices_morton(enum loop_order order, double matrix1[][N], double matrix2[][N],
+                                         double result[][N]);
+
+// in the order of the matrix_N executables
+static const struct implementation registry[] = {
+    { "simple", "sequential, with loop interchange", dot_multiply_matrices_simple, false, false, false, NULL },
+    { "omp", "blocked, omp tasks", dot_multiply_matrices_omp, true, true, true, NULL },
+    { "block", "blocked", dot_multiply_matrices_block, true, true, true, NULL },
+    { "vector", "blocked, AVX", dot_multiply_matrices_vector, true, true, false, NULL },
+    { "strassen", "Strassen-Winograd over the blocked kernel, omp tasks", dot_multiply_matrices_strassen, false, false,
+      false, prepare_strassen },
+    { "morton", "cache-oblivious recursion on a Morton layout, omp tasks", dot_multiply_matrices_morton, false, false, false,
+      NULL },
+};
+
+static const struct implementation *selected = &registry[0];
+
+/**
+ * @param count set to the number of implementations
+ * @return all the implementations
+ */
+const struct implementation *implementations(int *count)
+{
+    *count = sizeof(registry) / sizeof(registry[0]);
+    return registry;
+}
+
+/**
+ * @return the implementation of that name or NULL
+ */
+const struct implementation *find_implementation(const char *name)
+{
+    for (size_t i = 0; i < sizeof(registry) / sizeof(registry[0]); i++) {
+        if (strcmp(registry[i].name, name) == 0) {
+            return &registry[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Make the named implementation the one dot_multiply_matrices runs
+ *
+ * @return false if there is no implementation of that name
+ */
+bool select_implementation(const char *name)
+{
+    const struct implementation *implementation = find_implementation(name);
+    if (implementation == NULL) {
+        return false;
+    }
+    selected = implementation;
+    return true;
+}
+
+const struct implementation *selected_implementation()
+{
+    return selected;
+}
+
+/**
+ * Perform a dot-multiplication on two square matrices with the selected implementation
+ *
+ * The result is combined with the product as gemm_epilogue says (matrix_epilogue.h): by default the product
+ * is added to it, so it must be zeroed, with beta 0 it is overwritten without being read.
+ *
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices(enum loop_order order, double matrix1[][N], double matrix2[][N], double result[][N])
+{
+    return selected->multiply(order, matrix1, matrix2, result);
+}
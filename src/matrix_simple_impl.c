@@ -1,6 +1,7 @@
 #include <float.h>
 #include <math.h>
 #include "matrix.h"
+#include "matrix_epilogue.h"
 
 /**
  * Perform a dot-multiplication on two square matrices of a given size in i j k (natural) order
@@ -90,22 +91,33 @@ long dot_multiply_matrices_jki(double matrix1[][N], double matrix2[][N], double
 /**
  * Perform a dot-multiplication on two square matrices of a given size in the speciied order
  *
- * IMPORTANT: The result matrix must be zeroed for this function to succeed
+ * The result is combined with the product as gemm_epilogue says (matrix_epilogue.h): by default the product
+ * is added to it, so it must be zeroed, with beta 0 it is overwritten without being read.
  *
  * @param order the loop order: one of ijk, kij, or kji
  * @param size number of rows (and columns) in the square matrix
  * @param matrix1 left-side of the dot-multiplication
  * @param matrix2 right-side of the dot-multiplication
- * @param result preallocated zeroed matrix into which to store the results
+ * @param result preallocated matrix into which to store the results
  */
-long dot_multiply_matrices(enum loop_order order, double matrix1[][N], double matrix2[][N], double result[][N])
+long dot_multiply_matrices_simple(enum loop_order order, double matrix1[][N], double matrix2[][N], double result[][N])
 {
+    long flops;
+    // no tiles to fuse the epilogue into: its stages are passes over the result
+    epilogue_begin(&gemm_epilogue, result);
+    // no tiles here: the whole sequential multiplication is one kernel phase
+    phase_begin(PHASE_KERNEL);
     switch(order) {
         case ikj:
-            return dot_multiply_matrices_ikj(matrix1, matrix2, result);
+            flops = dot_multiply_matrices_ikj(matrix1, matrix2, result);
+            break;
         case jki:
-            return dot_multiply_matrices_jki(matrix1, matrix2, result);
+            flops = dot_multiply_matrices_jki(matrix1, matrix2, result);
+            break;
         default:
-            return dot_multiply_matrices_ijk(matrix1, matrix2, result);
+            flops = dot_multiply_matrices_ijk(matrix1, matrix2, result);
     }
+    phase_end(PHASE_KERNEL);
+    epilogue_end(&gemm_epilogue, result);
+    return flops;
 }
@@ -0,0 +1,356 @@
+#include <stdint.h>
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_tiles.h"
+
+/*
+ * Sparse A times dense B for --sparse, linked into every implementation.
+ *
+ * A is converted to CSR (the non-zeros row by row, with their columns) or CSC (column by column, with
+ * their rows) outside the timed product, and each non-zero a_ik adds a_ik B[k] to the row i of the
+ * result: 2 nnz N flops instead of 2 N^3. The rows of the result are split into one contiguous range
+ * per thread holding the same number of non-zeros, rather than the same number of rows, so a few dense
+ * rows do not leave one thread with most of the work. With CSC each thread walks every column but only
+ * the part of it in its own rows (found by binary search, the rows of a column are sorted), so the
+ * threads never write the same row either.
+ *
+ * With --sparse blocks A stays dense and a bitmap of the -b tiles of A and B holding a non-zero is made
+ * instead. The blocked implementations (block and omp) then run their kernels only on the productive
+ * tile pairs, so block sparse matrices, whole tiles of zeros, cost in proportion to their non-zero tiles.
+ * The other implementations ignore the bitmap and run dense.
+ *
+ * --sparse band stores the diagonals of A instead (matrix_band.c).
+ *
+ * --sparse auto (the default) picks the cheapest estimate. The axpy of a sparse row of B runs at about
+ * SPARSE_RELATIVE_RATE of the speed of the blocked dense kernels (it streams B from the caches where
+ * they reuse it from registers), so that is the density below which CSR wins; the tiles run the dense
+ * kernels, so they cost the fraction of the tile products that are productive, and the band its in-band
+ * flops at the rate of the band kernels.
+ */
+
+#define SPARSE_RELATIVE_RATE 0.25
+
+static struct {
+    enum sparse_format format;
+    size_t nnz;
+    size_t *pointers; // N + 1 starts of the rows (CSR) or columns (CSC) in indices and values
+    int *indices;     // column (CSR) or row (CSC) of each non-zero
+    double *values;
+    int threads;
+    size_t *partition; // threads + 1 starts of the row ranges of the threads
+} sparse = { SPARSE_DENSE, 0, NULL, NULL, NULL, 0, NULL };
+
+// tiles holding a non-zero for --sparse blocks, one bit per tile row by row
+static struct {
+    size_t bsize;
+    size_t tiles; // per side
+    uint64_t *a;
+    uint64_t *b;
+} occupancy = { 0, 0, NULL, NULL };
+
+static bool tile_bit(const uint64_t *bits, size_t ti, size_t tj)
+{
+    size_t bit = ti * occupancy.tiles + tj;
+    return (bits[bit / 64] >> (bit % 64)) & 1;
+}
+
+static uint64_t *tile_bitmap(double matrix[][N])
+{
+    size_t tiles = occupancy.tiles, bsize = occupancy.bsize;
+    uint64_t *bits = calloc((tiles * tiles + 63) / 64, sizeof(uint64_t));
+    for (size_t i = 0; i < N; i++) {
+        for (size_t tj = 0; tj < tiles; tj++) {
+            size_t bit = i / bsize * tiles + tj;
+            if ((bits[bit / 64] >> (bit % 64)) & 1) {
+                continue;
+            }
+            for (size_t j = tj * bsize; j < MIN((tj + 1) * bsize, (size_t)N); j++) {
+                if (matrix[i][j] != 0) {
+                    bits[bit / 64] |= (uint64_t)1 << (bit % 64);
+                    break;
+                }
+            }
+        }
+    }
+    return bits;
+}
+
+static void release_tile_occupancy()
+{
+    free(occupancy.a);
+    free(occupancy.b);
+    memset(&occupancy, 0, sizeof(occupancy));
+}
+
+/**
+ * Map the tiles of A and B holding a non-zero, in blocks of bsize
+ *
+ * @return the fraction of the tile products of A . B that are productive
+ */
+static double prepare_tile_occupancy(size_t bsize, double matrix1[][N], double matrix2[][N])
+{
+    release_tile_occupancy();
+    occupancy.bsize = bsize;
+    occupancy.tiles = (N + bsize - 1) / bsize;
+    occupancy.a = tile_bitmap(matrix1);
+    occupancy.b = tile_bitmap(matrix2);
+    size_t tiles = occupancy.tiles, productive = 0;
+    for (size_t ti = 0; ti < tiles; ti++) {
+        for (size_t tj = 0; tj < tiles; tj++) {
+            for (size_t tk = 0; tk < tiles; tk++) {
+                productive += tile_bit(occupancy.a, ti, tk) && tile_bit(occupancy.b, tj, tk);
+            }
+        }
+    }
+    return (double)productive / ((double)tiles * tiles * tiles);
+}
+
+/**
+ * @return false when --sparse blocks found the A tile at (ii, kk) or the B tile the blocked kernels read
+ * for (kk, jj) all zero, so the tile product adds nothing. The kernels read B transposed, as B[j][k],
+ * so that B tile is the one at rows jj and columns kk.
+ */
+bool block_tiles_productive(size_t ii, size_t jj, size_t kk)
+{
+    if (occupancy.a == NULL) {
+        return true;
+    }
+    size_t bsize = occupancy.bsize;
+    return tile_bit(occupancy.a, ii / bsize, kk / bsize) && tile_bit(occupancy.b, jj / bsize, kk / bsize);
+}
+
+/**
+ * @return the fraction of the elements of the matrix that are not zero
+ */
+double matrix_density(double matrix[][N])
+{
+    size_t nnz = 0;
+#pragma omp parallel for reduction(+:nnz)
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            nnz += matrix[i][j] != 0;
+        }
+    }
+    return (double)nnz / ((double)N * N);
+}
+
+/**
+ * Choose between the dense product, the non-zero tiles, the band and CSR for a plain double product of A
+ * with this density (the non-zero tiles only for the implementations that skip the others)
+ */
+enum sparse_format select_sparse_format(double density, double matrix1[][N], double matrix2[][N])
+{
+    // relative costs: 2 N^3 at the dense rate against 2 nnz N at the sparse one, and the productive tiles
+    double dense_cost = 1.0, sparse_cost = density / SPARSE_RELATIVE_RATE, tiles_cost = dense_cost;
+    if (selected_implementation()->sparse_tiles) {
+        tiles_cost = prepare_tile_occupancy(tile_block_size(), matrix1, matrix2);
+        release_tile_occupancy();
+    }
+    double band_cost = band_relative_cost(matrix1, matrix2);
+    enum sparse_format format = SPARSE_DENSE;
+    double cost = dense_cost;
+    if (tiles_cost < cost) {
+        format = SPARSE_BLOCKS;
+        cost = tiles_cost;
+    }
+    if (sparse_cost < cost) {
+        format = SPARSE_CSR;
+        cost = sparse_cost;
+    }
+    if (band_cost < cost) {
+        format = SPARSE_BAND;
+        cost = band_cost;
+    }
+    INFO("A has %.2f%% non-zeros: estimated cost of the sparse product %.3f, of the non-zero tiles %.3f, "
+         "of the band %.3f of the dense one, using %s", density * 100, sparse_cost, tiles_cost, band_cost,
+         sparse_format_name(format));
+    return format;
+}
+
+void release_sparse_storage()
+{
+    free(sparse.pointers);
+    free(sparse.indices);
+    free(sparse.values);
+    free(sparse.partition);
+    memset(&sparse, 0, sizeof(sparse));
+    sparse.format = SPARSE_DENSE;
+    release_tile_occupancy();
+    release_band_storage();
+}
+
+/**
+ * Split the rows into one range per thread with about the same number of non-zeros in each
+ * (plus one per row for the row itself, so empty rows are not free)
+ */
+static void partition_rows(const size_t *row_counts)
+{
+    sparse.threads = omp_get_max_threads();
+    sparse.partition = malloc((sparse.threads + 1) * sizeof(size_t));
+    double total = (double)sparse.nnz + N, work = 0;
+    size_t row = 0;
+    for (int thread = 0; thread < sparse.threads; thread++) {
+        sparse.partition[thread] = row;
+        double target = total * (thread + 1) / sparse.threads;
+        while (row < N && work + (double)(row_counts[row] + 1) / 2 < target) {
+            work += (double)(row_counts[row] + 1);
+            row++;
+        }
+    }
+    sparse.partition[sparse.threads] = N;
+}
+
+/**
+ * Convert A to CSR or CSC for dot_multiply_matrices_sparse, map the non-zero tiles of A and B for the
+ * blocked implementations, or store the bands for dot_multiply_matrices_band
+ */
+void prepare_sparse_storage(enum sparse_format format, double matrix[][N], double matrix2[][N])
+{
+    release_sparse_storage();
+    if (format == SPARSE_BAND) {
+        prepare_band_storage(matrix, matrix2);
+        return;
+    }
+    if (format == SPARSE_BLOCKS) {
+        double productive = prepare_tile_occupancy(tile_block_size(), matrix, matrix2);
+        INFO("Mapped the non-zero tiles of %zu: %.2f%% of the tile products are productive", occupancy.bsize,
+             productive * 100);
+        return;
+    }
+    if (format != SPARSE_CSR && format != SPARSE_CSC) {
+        return;
+    }
+    sparse.format = format;
+    size_t *row_counts = calloc(N, sizeof(size_t));
+    sparse.pointers = calloc(N + 1, sizeof(size_t));
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            if (matrix[i][j] != 0) {
+                row_counts[i]++;
+                sparse.pointers[(format == SPARSE_CSR ? i : j) + 1]++;
+            }
+        }
+    }
+    for (size_t line = 0; line < N; line++) {
+        sparse.pointers[line + 1] += sparse.pointers[line];
+    }
+    sparse.nnz = sparse.pointers[N];
+    sparse.indices = malloc(MAX(sparse.nnz, 1) * sizeof(int));
+    sparse.values = malloc(MAX(sparse.nnz, 1) * sizeof(double));
+    // fill in row order, so the rows of each CSC column come out sorted
+    size_t *next = malloc(N * sizeof(size_t));
+    memcpy(next, sparse.pointers, N * sizeof(size_t));
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            if (matrix[i][j] != 0) {
+                size_t at = next[format == SPARSE_CSR ? i : j]++;
+                sparse.indices[at] = (int)(format == SPARSE_CSR ? j : i);
+                sparse.values[at] = matrix[i][j];
+            }
+        }
+    }
+    free(next);
+    partition_rows(row_counts);
+    free(row_counts);
+    INFO("Stored A as %s: %zu non-zeros (%.2f%%) over %d threads", sparse_format_name(format), sparse.nnz,
+         100.0 * (double)sparse.nnz / ((double)N * N), sparse.threads);
+}
+
+/**
+ * c += a0 b0 + a1 b1 + a2 b2 + a3 b3 over a row, four non-zeros per pass over c
+ */
+static inline void axpy_4(double *restrict c, double a0, const double *restrict b0, double a1,
+                          const double *restrict b1, double a2, const double *restrict b2, double a3,
+                          const double *restrict b3)
+{
+#pragma omp simd
+    for (size_t j = 0; j < N; j++) {
+        c[j] += a0 * b0[j] + a1 * b1[j] + a2 * b2[j] + a3 * b3[j];
+    }
+}
+
+static inline void axpy_1(double *restrict c, double a, const double *restrict b)
+{
+#pragma omp simd
+    for (size_t j = 0; j < N; j++) {
+        c[j] += a * b[j];
+    }
+}
+
+static void multiply_csr(size_t first, size_t last, double matrix2[][N], double result[][N])
+{
+    const int *indices = sparse.indices;
+    const double *values = sparse.values;
+    for (size_t i = first; i < last; i++) {
+        size_t p = sparse.pointers[i], end = sparse.pointers[i + 1];
+        for (; p + 4 <= end; p += 4) {
+            axpy_4(result[i], values[p], matrix2[indices[p]], values[p + 1], matrix2[indices[p + 1]],
+                   values[p + 2], matrix2[indices[p + 2]], values[p + 3], matrix2[indices[p + 3]]);
+        }
+        for (; p < end; p++) {
+            axpy_1(result[i], values[p], matrix2[indices[p]]);
+        }
+    }
+}
+
+/**
+ * @return the first position in [from, to) of the sorted indices with a row >= row
+ */
+static size_t lower_bound(size_t from, size_t to, size_t row)
+{
+    while (from < to) {
+        size_t middle = from + (to - from) / 2;
+        if ((size_t)sparse.indices[middle] < row) {
+            from = middle + 1;
+        }
+        else {
+            to = middle;
+        }
+    }
+    return from;
+}
+
+static void multiply_csc(size_t first, size_t last, double matrix2[][N], double result[][N])
+{
+    for (size_t k = 0; k < N; k++) {
+        size_t end = sparse.pointers[k + 1];
+        for (size_t p = lower_bound(sparse.pointers[k], end, first); p < end && (size_t)sparse.indices[p] < last; p++) {
+            axpy_1(result[sparse.indices[p]], sparse.values[p], matrix2[k]);
+        }
+    }
+}
+
+/**
+ * Multiply the CSR or CSC copy of A made by prepare_sparse_storage by B
+ *
+ * IMPORTANT: The result matrix must be zeroed for this function to succeed
+ *
+ * @param result preallocated zeroed matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_sparse(double matrix2[][N], double result[][N])
+{
+    if (sparse.pointers == NULL) {
+        ERROR("The sparse copy of A was not prepared");
+        return MATRIX_FAILED;
+    }
+    INFO("Running matrix_mult %d x %d with A in %s, %zu non-zeros", N, N, sparse_format_name(sparse.format),
+         sparse.nnz);
+#pragma omp parallel num_threads(sparse.threads)
+    {
+        // the row ranges were balanced for omp_get_max_threads, fewer threads take several ranges
+        phase_begin(PHASE_KERNEL);
+#pragma omp for schedule(static, 1)
+        for (int range = 0; range < sparse.threads; range++) {
+            size_t first = sparse.partition[range], last = sparse.partition[range + 1];
+            if (sparse.format == SPARSE_CSR) {
+                multiply_csr(first, last, matrix2, result);
+            }
+            else {
+                multiply_csc(first, last, matrix2, result);
+            }
+        }
+        phase_end(PHASE_KERNEL);
+    }
+    return 1; // forget about flops - we'll add it from known values
+}
@@ -0,0 +1,422 @@
+#include <float.h>
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_epilogue.h"
+#include "block_kernels.h"
+
+/*
+ * Strassen-Winograd multiplication: 7 half-size products and 15 additions per level instead of 8 products,
+ * recursing down to a crossover size where the classical blocked kernel of block_kernels.h takes over.
+ *
+ * The 7 products of the top levels run as parallel OpenMP tasks; below that each task recurses
+ * sequentially. All the temporaries come from one workspace arena allocated up front and split
+ * deterministically between the tasks, so there are no mallocs during the recursion.
+ *
+ * The sequential levels follow the schedule of Boyer, Dumas, Pernet and Zhou (2009) with two h x h
+ * temporaries: one S and one T operand at a time, with the products written to the C quadrants and
+ * accumulated there. The task levels need all 8 operands at once, and the products P2 to P5 go
+ * straight to the C quadrants, so only P1, P6 and P7 need their own buffers. With two task levels
+ * that comes to (11/4 + 77/16 + 49 x 2/3 / 16) N^2 ~ 9.6 N^2 doubles: 1.2 GiB at N = 4096 and
+ * 4.8 GiB at N = 8192, against 3 N^2 for A, B and C.
+ */
+
+// levels of the recursion that spawn tasks: 7^2 = 49 tasks is enough to keep 32 threads busy
+#define STRASSEN_TASK_LEVELS 2
+#define STRASSEN_DEFAULT_LEAF_BLOCK 64
+// the temporaries of a task level: S1-S4, T1-T4 operands and the P1, P6 and P7 products
+#define STRASSEN_TASK_TEMPORARIES 11
+// the temporaries of a sequential level: the current S and T, S4 then P1 in the first
+#define STRASSEN_TEMPORARIES 2
+#define STRASSEN_TUNING_TRIALS 3
+
+struct arena {
+    double *base;
+    size_t size; // in doubles
+    size_t used;
+};
+
+static double *arena_take(struct arena *arena, size_t doubles)
+{
+    if (arena->used + doubles > arena->size) {
+        ERROR("Strassen workspace arena exhausted (%zu + %zu > %zu doubles)", arena->used, doubles, arena->size);
+        exit(1);
+    }
+    double *block = arena->base + arena->used;
+    arena->used += doubles;
+    return block;
+}
+
+/**
+ * Doubles of workspace needed to multiply n x n matrices, mirroring the way strassen_recurse splits the arena
+ */
+static size_t strassen_workspace(size_t n, size_t cutoff, int level)
+{
+    if (n <= cutoff || n % 2 != 0) {
+        return n * n; // B transposed for the leaf kernel
+    }
+    size_t h = n / 2;
+    size_t child = strassen_workspace(h, cutoff, level + 1);
+    // parallel levels give each of the 7 products its own slice, sequential levels reuse one
+    if (level < STRASSEN_TASK_LEVELS) {
+        return STRASSEN_TASK_TEMPORARIES * h * h + 7 * child;
+    }
+    return STRASSEN_TEMPORARIES * h * h + child;
+}
+
+/**
+ * @return the block size for the kernel of a leaf of size n: -b (default 64) when it has a kernel and
+ * divides n, else the largest kernel that does, 0 if none does
+ */
+static size_t strassen_leaf_block(size_t n)
+{
+    size_t bsize = config->block_size > 0 ? (size_t)config->block_size : STRASSEN_DEFAULT_LEAF_BLOCK;
+    if (bsize <= n && n % bsize == 0 && select_strided_block_kernel(bsize) != NULL) {
+        return bsize;
+    }
+    for (bsize = 256; bsize >= 16; bsize /= 2) {
+        if (bsize <= n && n % bsize == 0) {
+            return bsize;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Classical blocked kernel for the leaves: C = A . B (C is overwritten)
+ *
+ * B is transposed into bt (n x n) so the block kernels can dot rows of A with rows of B^T, as they do in
+ * the block and omp implementations. Leaves no kernel divides (odd sizes) run i k j loops instead.
+ */
+static void strassen_leaf(size_t n, const double *restrict a, size_t lda, const double *restrict b, size_t ldb,
+                          double *restrict c, size_t ldc, double *restrict bt)
+{
+    size_t bsize = strassen_leaf_block(n);
+    if (bsize == 0) {
+        phase_begin(PHASE_KERNEL);
+        for (size_t i = 0; i < n; i++) {
+            for (size_t j = 0; j < n; j++) {
+                c[i * ldc + j] = 0;
+            }
+            for (size_t k = 0; k < n; k++) {
+                double a_ik = a[i * lda + k];
+                for (size_t j = 0; j < n; j++) {
+                    c[i * ldc + j] += a_ik * b[k * ldb + j];
+                }
+            }
+        }
+        phase_end(PHASE_KERNEL);
+        return;
+    }
+    phase_begin(PHASE_PACK_B);
+    for (size_t k = 0; k < n; k++) {
+        for (size_t j = 0; j < n; j++) {
+            bt[j * n + k] = b[k * ldb + j];
+        }
+    }
+    phase_end(PHASE_PACK_B);
+    strided_block_kernel kernel = select_strided_block_kernel(bsize);
+    phase_begin(PHASE_KERNEL);
+    for (size_t ii = 0; ii < n; ii += bsize) {
+        for (size_t jj = 0; jj < n; jj += bsize) {
+            for (size_t kk = 0; kk < n; kk += bsize) {
+                kernel(&a[ii * lda + kk], lda, &bt[jj * n + kk], n, &c[ii * ldc + jj], ldc, kk == 0);
+            }
+        }
+    }
+    phase_end(PHASE_KERNEL);
+}
+
+// dst = x + y (sign = 1) or x - y (sign = -1) on h x h strided matrices
+static void strassen_add(size_t h, double *dst, size_t ldd, const double *x, size_t ldx,
+                         const double *y, size_t ldy, double sign)
+{
+    for (size_t i = 0; i < h; i++) {
+        for (size_t j = 0; j < h; j++) {
+            dst[i * ldd + j] = x[i * ldx + j] + sign * y[i * ldy + j];
+        }
+    }
+}
+
+static void strassen_recurse(size_t n, const double *a, size_t lda, const double *b, size_t ldb,
+                             double *c, size_t ldc, size_t cutoff, int level, struct arena arena);
+
+/**
+ * The 7 products as parallel tasks, each with its own slice of the arena
+ *
+ * P2 to P5 are written to the C quadrants, P1, P6 and P7 to temporaries, then combined into C
+ */
+static void strassen_tasks(size_t h, const double *a, size_t lda, const double *b, size_t ldb,
+                           double *c, size_t ldc, size_t cutoff, int level, struct arena arena)
+{
+    size_t hh = h * h;
+    const double *a11 = a, *a12 = a + h, *a21 = a + h * lda, *a22 = a + h * lda + h;
+    const double *b11 = b, *b12 = b + h, *b21 = b + h * ldb, *b22 = b + h * ldb + h;
+    double *c11 = c, *c12 = c + h, *c21 = c + h * ldc, *c22 = c + h * ldc + h;
+
+    double *s1 = arena_take(&arena, hh), *s2 = arena_take(&arena, hh);
+    double *s3 = arena_take(&arena, hh), *s4 = arena_take(&arena, hh);
+    double *t1 = arena_take(&arena, hh), *t2 = arena_take(&arena, hh);
+    double *t3 = arena_take(&arena, hh), *t4 = arena_take(&arena, hh);
+    double *p1 = arena_take(&arena, hh), *p6 = arena_take(&arena, hh), *p7 = arena_take(&arena, hh);
+
+    // the operand sums play the part of packing A and B
+    phase_begin(PHASE_PACK_A);
+    strassen_add(h, s1, h, a21, lda, a22, lda, 1);  // S1 = A21 + A22
+    strassen_add(h, s2, h, s1, h, a11, lda, -1);    // S2 = S1 - A11
+    strassen_add(h, s3, h, a11, lda, a21, lda, -1); // S3 = A11 - A21
+    strassen_add(h, s4, h, a12, lda, s2, h, -1);    // S4 = A12 - S2
+    phase_end(PHASE_PACK_A);
+    phase_begin(PHASE_PACK_B);
+    strassen_add(h, t1, h, b12, ldb, b11, ldb, -1); // T1 = B12 - B11
+    strassen_add(h, t2, h, b22, ldb, t1, h, -1);    // T2 = B22 - T1
+    strassen_add(h, t3, h, b22, ldb, b12, ldb, -1); // T3 = B22 - B12
+    strassen_add(h, t4, h, t2, h, b21, ldb, -1);    // T4 = T2 - B21
+    phase_end(PHASE_PACK_B);
+
+    const double *left[7] = { a11, a12, s4, a22, s1, s2, s3 };
+    size_t left_ld[7] = { lda, lda, h, lda, h, h, h };
+    const double *right[7] = { b11, b21, b22, t4, t1, t2, t3 };
+    size_t right_ld[7] = { ldb, ldb, ldb, h, h, h, h };
+    double *product[7] = { p1, c11, c12, c21, c22, p6, p7 };
+    size_t product_ld[7] = { h, ldc, ldc, ldc, ldc, h, h };
+
+    size_t child = strassen_workspace(h, cutoff, level + 1);
+    for (int m = 0; m < 7; m++) {
+        struct arena child_arena = { arena.base + arena.used + m * child, child, 0 };
+#pragma omp task firstprivate(m, child_arena) shared(left, left_ld, right, right_ld, product, product_ld)
+        strassen_recurse(h, left[m], left_ld[m], right[m], right_ld[m], product[m], product_ld[m], cutoff,
+                         level + 1, child_arena);
+    }
+#pragma omp taskwait
+
+    // U2 = P1 + P6, U3 = U2 + P7, U4 = U2 + P5 (in the P6 and P7 buffers)
+    phase_begin(PHASE_REDUCE);
+    strassen_add(h, p6, h, p1, h, p6, h, 1);
+    strassen_add(h, p7, h, p6, h, p7, h, 1);
+    strassen_add(h, p6, h, p6, h, c22, ldc, 1);
+    phase_end(PHASE_REDUCE);
+    phase_begin(PHASE_WRITE_BACK);
+    strassen_add(h, c11, ldc, c11, ldc, p1, h, 1);  // C11 = U1 = P2 + P1
+    strassen_add(h, c12, ldc, p6, h, c12, ldc, 1);  // C12 = U5 = U4 + P3
+    strassen_add(h, c21, ldc, p7, h, c21, ldc, -1); // C21 = U6 = U3 - P4
+    strassen_add(h, c22, ldc, p7, h, c22, ldc, 1);  // C22 = U7 = U3 + P5
+    phase_end(PHASE_WRITE_BACK);
+}
+
+/**
+ * The 7 products one after the other, using the C quadrants for the products and the partial sums
+ * and two temporaries X and Y for the operands
+ */
+static void strassen_sequential(size_t h, const double *a, size_t lda, const double *b, size_t ldb,
+                                double *c, size_t ldc, size_t cutoff, int level, struct arena arena)
+{
+    size_t hh = h * h;
+    const double *a11 = a, *a12 = a + h, *a21 = a + h * lda, *a22 = a + h * lda + h;
+    const double *b11 = b, *b12 = b + h, *b21 = b + h * ldb, *b22 = b + h * ldb + h;
+    double *c11 = c, *c12 = c + h, *c21 = c + h * ldc, *c22 = c + h * ldc + h;
+    double *x = arena_take(&arena, hh), *y = arena_take(&arena, hh);
+    struct arena child = { arena.base + arena.used, arena.size - arena.used, 0 };
+
+    phase_begin(PHASE_PACK_A);
+    strassen_add(h, x, h, a11, lda, a21, lda, -1);   // X = S3 = A11 - A21
+    phase_end(PHASE_PACK_A);
+    phase_begin(PHASE_PACK_B);
+    strassen_add(h, y, h, b22, ldb, b12, ldb, -1);   // Y = T3 = B22 - B12
+    phase_end(PHASE_PACK_B);
+    strassen_recurse(h, x, h, y, h, c21, ldc, cutoff, level + 1, child); // C21 = P7 = S3 . T3
+
+    phase_begin(PHASE_PACK_A);
+    strassen_add(h, x, h, a21, lda, a22, lda, 1);    // X = S1 = A21 + A22
+    phase_end(PHASE_PACK_A);
+    phase_begin(PHASE_PACK_B);
+    strassen_add(h, y, h, b12, ldb, b11, ldb, -1);   // Y = T1 = B12 - B11
+    phase_end(PHASE_PACK_B);
+    strassen_recurse(h, x, h, y, h, c22, ldc, cutoff, level + 1, child); // C22 = P5 = S1 . T1
+
+    phase_begin(PHASE_PACK_A);
+    strassen_add(h, x, h, x, h, a11, lda, -1);       // X = S2 = S1 - A11
+    phase_end(PHASE_PACK_A);
+    phase_begin(PHASE_PACK_B);
+    strassen_add(h, y, h, b22, ldb, y, h, -1);       // Y = T2 = B22 - T1
+    phase_end(PHASE_PACK_B);
+    strassen_recurse(h, x, h, y, h, c12, ldc, cutoff, level + 1, child); // C12 = P6 = S2 . T2
+
+    phase_begin(PHASE_PACK_A);
+    strassen_add(h, x, h, a12, lda, x, h, -1);       // X = S4 = A12 - S2
+    phase_end(PHASE_PACK_A);
+    strassen_recurse(h, x, h, b22, ldb, c11, ldc, cutoff, level + 1, child); // C11 = P3 = S4 . B22
+    strassen_recurse(h, a11, lda, b11, ldb, x, h, cutoff, level + 1, child); // X = P1 = A11 . B11
+
+    phase_begin(PHASE_REDUCE);
+    strassen_add(h, c12, ldc, x, h, c12, ldc, 1);     // C12 = U2 = P1 + P6
+    strassen_add(h, c21, ldc, c12, ldc, c21, ldc, 1); // C21 = U3 = U2 + P7
+    strassen_add(h, c12, ldc, c12, ldc, c22, ldc, 1); // C12 = U4 = U2 + P5
+    strassen_add(h, c22, ldc, c21, ldc, c22, ldc, 1); // C22 = U7 = U3 + P5
+    strassen_add(h, c12, ldc, c12, ldc, c11, ldc, 1); // C12 = U5 = U4 + P3
+    phase_end(PHASE_REDUCE);
+
+    phase_begin(PHASE_PACK_B);
+    strassen_add(h, y, h, y, h, b21, ldb, -1);        // Y = T4 = T2 - B21
+    phase_end(PHASE_PACK_B);
+    strassen_recurse(h, a22, lda, y, h, c11, ldc, cutoff, level + 1, child); // C11 = P4 = A22 . T4
+    phase_begin(PHASE_WRITE_BACK);
+    strassen_add(h, c21, ldc, c21, ldc, c11, ldc, -1); // C21 = U6 = U3 - P4
+    phase_end(PHASE_WRITE_BACK);
+    strassen_recurse(h, a12, lda, b21, ldb, c11, ldc, cutoff, level + 1, child); // C11 = P2 = A12 . B21
+    phase_begin(PHASE_WRITE_BACK);
+    strassen_add(h, c11, ldc, x, h, c11, ldc, 1);      // C11 = U1 = P1 + P2
+    phase_end(PHASE_WRITE_BACK);
+}
+
+/**
+ * C = A . B for n x n strided matrices using the Winograd form of Strassen's algorithm
+ *
+ * C is overwritten, and must not overlap A or B
+ */
+static void strassen_recurse(size_t n, const double *a, size_t lda, const double *b, size_t ldb,
+                             double *c, size_t ldc, size_t cutoff, int level, struct arena arena)
+{
+    if (n <= cutoff || n % 2 != 0) {
+        strassen_leaf(n, a, lda, b, ldb, c, ldc, arena_take(&arena, n * n));
+        return;
+    }
+    if (level < STRASSEN_TASK_LEVELS) {
+        strassen_tasks(n / 2, a, lda, b, ldb, c, ldc, cutoff, level, arena);
+    }
+    else {
+        strassen_sequential(n / 2, a, lda, b, ldb, c, ldc, cutoff, level, arena);
+    }
+}
+
+/**
+ * Multiply n x n matrices with Strassen-Winograd down to the cutoff, allocating the workspace arena
+ */
+static void strassen_multiply(size_t n, const double *a, size_t lda, const double *b, size_t ldb,
+                              double *c, size_t ldc, size_t cutoff)
+{
+    size_t workspace = strassen_workspace(n, cutoff, 0);
+    struct arena arena = { NULL, workspace, 0 };
+    if (workspace > 0) {
+        arena.base = malloc(workspace * sizeof(double));
+        if (arena.base == NULL) {
+            ERROR("Could not allocate %zu MiB of Strassen workspace", workspace * sizeof(double) >> 20);
+            exit(1);
+        }
+    }
+    VERBOSE("Strassen workspace arena: %zu MiB", workspace * sizeof(double) >> 20);
+#pragma omp parallel shared(a, b, c, arena)
+    {
+#pragma omp single
+        strassen_recurse(n, a, lda, b, ldb, c, ldc, cutoff, 0, arena);
+    }
+    free(arena.base);
+}
+
+/**
+ * Pick the crossover: the smallest leaf size at which one level of Strassen beats the classical
+ * kernel on a product of twice that size (best of a few trials on one thread, so it is quick)
+ */
+static size_t tune_strassen_cutoff()
+{
+    size_t candidates[] = { 32, 64, 128, 256 };
+    size_t max_n = 2 * candidates[sizeof(candidates) / sizeof(candidates[0]) - 1];
+    double *a = malloc(max_n * max_n * sizeof(double));
+    double *b = malloc(max_n * max_n * sizeof(double));
+    double *c = malloc(max_n * max_n * sizeof(double));
+    double *bt = malloc(max_n * max_n * sizeof(double));
+    for (size_t i = 0; i < max_n * max_n; i++) {
+        a[i] = (double)(i % 7) / 7.0;
+        b[i] = (double)(i % 5) / 5.0;
+    }
+    size_t cutoff = N; // classical all the way unless Strassen wins somewhere
+    for (size_t c_index = 0; c_index < sizeof(candidates) / sizeof(candidates[0]); c_index++) {
+        size_t leaf = candidates[c_index];
+        size_t n = 2 * leaf;
+        if (n > N) break;
+        size_t workspace = strassen_workspace(n, leaf, STRASSEN_TASK_LEVELS); // sequential level
+        struct arena arena = { malloc(workspace * sizeof(double)), workspace, 0 };
+        double classical = DBL_MAX, strassen = DBL_MAX;
+        for (int trial = 0; trial < STRASSEN_TUNING_TRIALS; trial++) {
+            double start = omp_get_wtime();
+            strassen_leaf(n, a, n, b, n, c, n, bt);
+            classical = MIN(classical, omp_get_wtime() - start);
+            start = omp_get_wtime();
+            strassen_recurse(n, a, n, b, n, c, n, leaf, STRASSEN_TASK_LEVELS, arena);
+            strassen = MIN(strassen, omp_get_wtime() - start);
+        }
+        free(arena.base);
+
+        VERBOSE("Strassen tuning: %zu x %zu classical %.6fs, one level over %zu leaves %.6fs",
+                n, n, classical, leaf, strassen);
+        if (strassen < classical) {
+            cutoff = leaf;
+            break;
+        }
+    }
+    free(a);
+    free(b);
+    free(c);
+    free(bt);
+    return cutoff;
+}
+
+/**
+ * @return the crossover of the products: --cutoff, or tuned on this machine the first time it is needed
+ */
+static size_t strassen_cutoff()
+{
+    static size_t tuned_cutoff = 0;
+    if (config->cutoff > 0) {
+        return (size_t)config->cutoff;
+    }
+    if (tuned_cutoff == 0) {
+        tuned_cutoff = tune_strassen_cutoff();
+        INFO("Tuned Strassen crossover: recursing down to %zu x %zu", tuned_cutoff, tuned_cutoff);
+    }
+    return tuned_cutoff;
+}
+
+/**
+ * Tune the crossover before the products are timed (registered as the prepare step of the implementation)
+ */
+void prepare_strassen()
+{
+    strassen_cutoff();
+}
+
+/**
+ * Perform a dot-multiplication on two square matrices with the Strassen-Winograd algorithm
+ *
+ * Uses the global config for the crossover (--cutoff, tuned once on this machine when not given)
+ * and for the block size of the classical kernel at the leaves (-b, default 64, when block_kernels.h has it).
+ * The product is combined with the result as gemm_epilogue says (matrix_epilogue.h): the recursion overwrites
+ * its C, so with beta 0 the result needs no zeroing and the rest of the epilogue is a pass over it, else
+ * the product goes to a temporary that is merged into the result.
+ *
+ * @param order ignored: the leaves run the block kernels
+ * @param matrix1 left-side of the dot-multiplication
+ * @param matrix2 right-side of the dot-multiplication
+ * @param result preallocated matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_strassen(enum loop_order order, double matrix1[][N], double matrix2[][N], double result[][N])
+{
+    (void)order;
+    size_t cutoff = strassen_cutoff();
+    INFO("Running Strassen-Winograd matrix_mult %d x %d down to %zu x %zu", N, N, cutoff, cutoff);
+    const struct epilogue *epilogue = &gemm_epilogue;
+    if (epilogue->c_scale == 0) {
+        strassen_multiply(N, &matrix1[0][0], N, &matrix2[0][0], N, &result[0][0], N, cutoff);
+        epilogue_end(epilogue, result);
+        return 1;
+    }
+    double (*product)[N] = malloc(N * N * sizeof(double));
+    if (product == NULL) {
+        ERROR("Could not allocate the Strassen product for the epilogue");
+        return MATRIX_FAILED;
+    }
+    strassen_multiply(N, &matrix1[0][0], N, &matrix2[0][0], N, &product[0][0], N, cutoff);
+    epilogue_merge(epilogue, product, result);
+    free(product);
+    return 1; // forget about flops - we'll add it from known values
+}
@@ -1,12 +1,20 @@
+#define _GNU_SOURCE // syscall() for perf_event_open even with -std=c99
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <math.h>
 #include "csvhelper.h"
+#include "matrix.h"
+#include "matrix_plan.h"
 //#include "matrix_config.h"
 #include "matrix_support.h"
 #include "papi_support.h"
+#include "perf_support.h"
+#include "trace_support.h"
+#include "roofline_support.h"
+#include "binary_support.h"
 #include <omp.h>
 
 #define OPT_SILENT 299
@@ -18,6 +26,9 @@
 #define L3_CACHE_MIB 30
 // flag set by --quiet or -q
 
+// the configuration of the run, shared among modules: set by the driver or a libspeedmm context
+struct config *config;
+
 /**
  * Convert the omp schedule kind to an int for easy graphing and
  * handle the OMP 4.5 introduction of monotonic for static by returning zero.
@@ -66,6 +77,118 @@ void omp_debug(char *msg) {
            msg, kind, chunks, omp_get_thread_num(), omp_get_num_threads());
 }
 #endif
+
+/*
+ * Hardware counter calls that go to either PAPI or the perf_event_open backend (--perf)
+ */
+void init_counters()
+{
+    if (config->perf) {
+        init_perf();
+    }
+    else {
+        init_papi();
+    }
+}
+
+int counter_code(char *event_name)
+{
+    return config->perf ? perf_code(event_name) : papi_code(event_name);
+}
+
+char *counter_name(int event_code)
+{
+    return config->perf ? perf_name(event_code) : papi_name(event_code);
+}
+
+int init_counter_events(unsigned offset, unsigned num_events, int *event_codes, int *failed_codes)
+{
+    if (config->perf) {
+        return init_perf_events(offset, num_events, event_codes, failed_codes);
+    }
+    return init_papi_events(offset, num_events, event_codes, failed_codes);
+}
+
+long long start_counters(int event_set)
+{
+    return config->perf ? start_perf(event_set) : start_papi(event_set);
+}
+
+long long stop_counters(int event_set, unsigned offset, long long *all_event_results)
+{
+    if (config->perf) {
+        return stop_perf(event_set, offset, all_event_results);
+    }
+    return stop_papi(event_set, offset, all_event_results);
+}
+
+/**
+ * Prepare every event (from all the ! separated subsets) to be counted together in one run
+ *
+ * @return handle for start_counters_multiplexed / stop_counters_multiplexed
+ */
+int init_counter_events_multiplexed(unsigned num_subsets, unsigned subset_starts[num_subsets],
+                                    unsigned subset_sizes[num_subsets], unsigned num_events,
+                                    int *event_codes, int *failed_codes)
+{
+    if (config->perf) {
+        // one perf group per subset: the kernel rotates the groups over the counters
+        for (unsigned s = 0; s < num_subsets; s++) {
+            init_perf_events(subset_starts[s], subset_sizes[s], event_codes, failed_codes);
+        }
+        return 0;
+    }
+    return init_papi_multiplex_events(num_events, event_codes, failed_codes);
+}
+
+long long start_counters_multiplexed(int event_set)
+{
+    return config->perf ? start_perf_multiplexed() : start_papi(event_set);
+}
+
+long long stop_counters_multiplexed(int event_set, long long *all_event_results)
+{
+    return config->perf ? stop_perf_multiplexed(all_event_results) : stop_papi(event_set, 0, all_event_results);
+}
+
+/**
+ * Close the event sets of the run, whichever backend opened them
+ */
+void release_counters()
+{
+    if (config->perf) {
+        release_perf_events();
+    }
+    else {
+        release_papi_events();
+    }
+}
+
+/**
+ * @return the value of the named event if it was counted successfully, otherwise -1
+ */
+long long counted_event(char *event_name, size_t num_events, int event_codes[num_events],
+                        long long event_values[num_events], int failed_codes[num_events])
+{
+    for (size_t i = 0; i < num_events; i++) {
+        if (failed_codes[i] == 0 && strcmp(counter_name(event_codes[i]), event_name) == 0) {
+            return event_values[i];
+        }
+    }
+    return -1;
+}
+
+void describe_counter_events(size_t num_events, int event_codes[num_events],
+                             long long event_values[num_events], int failed_codes[num_events])
+{
+    if (config->perf) {
+        describe_perf_events(num_events, event_codes, event_values, failed_codes);
+    }
+    else {
+        describe_papi_events(num_events, event_codes, event_values, failed_codes);
+    }
+}
+
 // simple doubleing point matrices
 int matrix_size(int n) {
     return n * n * sizeof(float);
@@ -88,6 +211,62 @@ void print_headers(FILE *out, char **headers, int dimensions) {
     fprintf(out, ",Cluster\n");
 }
 
+/**
+ * @return true when the run has an epilogue other than overwriting C with A . B (--alpha, --beta, --bias,
+ * --activation)
+ */
+bool epilogue_configured()
+{
+    return config->alpha != 1 || config->beta != 0 || config->bias != BIAS_NONE || config->activation != ACTIVATION_NONE;
+}
+
+/**
+ * @return true when the run used reduced precision or storage, so it is compared against the double path,
+ * or the 3m complex product, compared against 4m, or a triangular solve, whose residual is measured,
+ * or a chain, compared against the left to right order, or an epilogue, compared against separate passes,
+ * or a plan, compared against the implementation
+ */
+bool accuracy_compared()
+{
+    return config->precision != PRECISION_DOUBLE || config->storage != STORAGE_DOUBLE
+           || config->complex == COMPLEX_3M || config->trsm != TRIANGLE_NONE || config->chain_matrices > 0
+           || epilogue_configured() || config->plan_file != NULL;
+}
+
+/**
+ * @return true when the run multiplies only part of A or B (--a-rows, --b-cols)
+ */
+bool general_shape()
+{
+    return config->a_rows > 0 || config->b_cols > 0;
+}
+
+/**
+ * @return true when the run is the double A . B of the implementation, which applies the epilogue
+ * (once --sparse is resolved)
+ */
+bool dense_product()
+{
+    return config->chain_matrices == 0 && config->syrk == TRIANGLE_NONE && config->trmm == TRIANGLE_NONE
+           && config->trsm == TRIANGLE_NONE && (config->sparse == SPARSE_DENSE || config->sparse == SPARSE_BLOCKS)
+           && !general_shape() && !config->jit && config->batch == 0 && config->complex == COMPLEX_NONE
+           && config->storage == STORAGE_DOUBLE && config->precision == PRECISION_DOUBLE;
+}
+
+/**
+ * Get the result ready for the next product: zeroed for the engines that add to it, the initial C of
+ * --beta, and left as it is when the epilogue overwrites it (beta 0), which saves a pass over it
+ */
+void prepare_result(double result[][N])
+{
+    if (!dense_product()) {
+        fill_matrix_constant(result, 0.0f);
+    }
+    else if (config->beta != 0) {
+        fill_matrix_constant(result, EPILOGUE_INITIAL_C);
+    }
+}
+
 /**
  * Print the headers for the metrics table to a file pointer.
  * Used for the first run to use a metrics file to produce the header row
@@ -97,13 +276,78 @@ void print_headers(FILE *out, char **headers, int dimensions) {
 void print_metrics_headers(FILE *out, size_t num_events, int event_codes[num_events])
 {
     char flops_prefix= config->giga ? 'G' : '_';
+    // the columns of the original table first, then all the others whatever the options (empty when they
+    // do not apply), so the rows of differently configured runs line up in one file
     fprintf(out, "label,size,total_micro_seconds,FLOPs,%cFLOPs_per_second,order_name,block_size,"
                  "max_threads,omp_schedule,omp_chunk_size,"
                  "test_results,", flops_prefix);
-    print_papi_headers(out, num_events, event_codes);
+    fprintf(out, "effective_GFLOPs,implementation,precision,storage,complex,complex_layout,batch,syrk,trmm,trsm,"
+                 "sparse,a_density,"
+                 "max_rel_error,norm_rel_error,"
+                 "a_rows,b_cols,GB_per_second,"
+                 "chain_order,planned_GFLOPs,naive_GFLOPs,arena_MB,naive_MB,"
+                 "alpha,beta,bias,activation,"
+                 "plan_kernel,plan_block,plan_schedule,plan_loaded,plan_seconds,pack_seconds,"
+                 "peak_GFLOPs,peak_GBps,arith_intensity,achieved_GFLOPs,peak_fraction,roof_fraction,bound,");
+    if (config->perf) {
+        print_perf_headers(out, num_events, event_codes);
+    }
+    else {
+        print_papi_headers(out, num_events, event_codes);
+    }
+    if (config->multiplex) {
+        // fraction of the run each event was counted for
+        for (size_t i = 0; i < num_events; i++) {
+            fprintf(out, ",%s_counted", counter_name(event_codes[i]));
+        }
+    }
+    if (config->thread_counters) {
+        // max / mean over the threads
+        for (size_t i = 0; i < num_events; i++) {
+            fprintf(out, ",%s_imbalance", counter_name(event_codes[i]));
+        }
+    }
     fprintf(out, "\n");
 }
 
+/**
+ * FLOPs of the classical algorithm for the run: 2 N^3
+ * (8 N^3 for a complex product, as 4 real products: 3m gets credit for the one it saves,
+ * 2 N^2 batch for the (N / batch)^2 products of a batch, 2 rows cols N for --a-rows and --b-cols
+ * N^3 for the triangle of --trmm and --trsm, N^2 (N + 1) for the triangle of --syrk
+ * and the left to right order of a --chain)
+ */
+double classical_flops(struct metrics *metrics)
+{
+    if (metrics->chain_matrices > 0) {
+        return metrics->chain_naive_flops;
+    }
+    if (metrics->batch > 0) {
+        return 2.0 * N * N * metrics->batch;
+    }
+    if (metrics->a_rows > 0 || metrics->b_cols > 0) {
+        return 2.0 * N * (metrics->a_rows > 0 ? metrics->a_rows : N) * (metrics->b_cols > 0 ? metrics->b_cols : N);
+    }
+    if (metrics->trmm != TRIANGLE_NONE || metrics->trsm != TRIANGLE_NONE) {
+        return CLASSICAL_FLOPS / 2;
+    }
+    if (metrics->syrk != TRIANGLE_NONE) {
+        return (double)N * N * (N + 1); // N (N + 1) / 2 dot products of 2N
+    }
+    return metrics->complex == COMPLEX_NONE ? CLASSICAL_FLOPS : 4 * CLASSICAL_FLOPS;
+}
+
+/**
+ * Classical FLOPs over the run time, so engines doing fewer operations (Strassen) compare on the same scale
+ */
+double effective_gflops(struct metrics *metrics)
+{
+    if (metrics->total_micro_seconds <= 0) {
+        return 0;
+    }
+    return classical_flops(metrics) / ((double)metrics->total_micro_seconds * 1000.0);
+}
+
 /**
  * Print the results of the run with timing numbers in a single row to go in a csv file
  * @param out output file pointer
@@ -124,8 +368,7 @@ void print_metrics(FILE *out, struct metrics *metrics,
 
     char *order_name = loop_order_name(metrics->loop_order);
 
-    fprintf(out,
-            "%s,%d,%lld,%ld,%f,%s,%d,%d,%d,%d,%s," ,
+    fprintf(out, "%s,%d,%lld,%ld,%f,%s,%d,%d,%d,%d,%s,",
             metrics->label,
             metrics->size,
             metrics->total_micro_seconds,
@@ -135,7 +378,75 @@ void print_metrics(FILE *out, struct metrics *metrics,
             metrics->block_size,
             metrics->omp_max_threads, metrics->omp_schedule_kind, metrics->omp_chunk_size,
             test_results);
+    fprintf(out, "%.3f,%s,%s,%s,%s,%s,%d,%s,%s,%s,%s,%.4f,",
+            effective_gflops(metrics),
+            metrics->implementation,
+            precision_name(metrics->precision),
+            storage_name(metrics->storage),
+            complex_name(metrics->complex),
+            complex_layout_name(metrics->complex_layout),
+            metrics->batch,
+            triangle_name(metrics->syrk),
+            triangle_name(metrics->trmm),
+            triangle_name(metrics->trsm),
+            sparse_format_name(metrics->sparse),
+            metrics->a_density);
+    if (accuracy_compared()) {
+        fprintf(out, "%.3e,%.3e,", metrics->max_rel_error, metrics->norm_rel_error);
+    }
+    else {
+        fprintf(out, ",,");
+    }
+    if (general_shape()) {
+        fprintf(out, "%d,%d,%.3f,", metrics->a_rows > 0 ? metrics->a_rows : N, metrics->b_cols > 0 ? metrics->b_cols : N,
+                metrics->bytes_per_second / 1e9);
+    }
+    else {
+        fprintf(out, ",,,");
+    }
+    if (config->chain_matrices > 0) {
+        fprintf(out, "%s,%.3f,%.3f,%.3f,%.3f,", metrics->chain_order, metrics->chain_flops / 1e9,
+                metrics->chain_naive_flops / 1e9, metrics->chain_arena_bytes / 1e6, metrics->chain_naive_bytes / 1e6);
+    }
+    else {
+        fprintf(out, ",,,,,");
+    }
+    if (epilogue_configured()) {
+        fprintf(out, "%g,%g,%s,%s,", metrics->alpha, metrics->beta, bias_name(metrics->bias),
+                activation_name(metrics->activation));
+    }
+    else {
+        fprintf(out, ",,,,");
+    }
+    if (config->plan_file != NULL) {
+        fprintf(out, "%s,%d,%s,%d,%.6f,%.6f,", plan_kernel_name(metrics->plan_kernel), metrics->plan_block,
+                plan_schedule_name(metrics->plan_schedule), metrics->plan_loaded, metrics->plan_seconds,
+                metrics->pack_seconds);
+    }
+    else {
+        fprintf(out, ",,,,,,");
+    }
+    if (config->roofline) {
+        struct roofline *roofline = &metrics->roofline;
+        fprintf(out, "%.3f,%.3f,%.3f,%.3f,%.4f,%.4f,%s,",
+                roofline->peak_flops / 1e9, roofline->peak_bytes / 1e9, roofline->arithmetic_intensity,
+                roofline->achieved_flops / 1e9, roofline->peak_fraction, roofline->roof_fraction,
+                roofline->memory_bound ? "memory" : "compute");
+    }
+    else {
+        fprintf(out, ",,,,,,,");
+    }
     print_papi_events(out, num_events, event_values);
+    if (config->multiplex) {
+        for (size_t i = 0; i < num_events; i++) {
+            fprintf(out, ",%.3f", counter_confidence[i]);
+        }
+    }
+    if (config->thread_counters) {
+        for (size_t i = 0; i < num_events; i++) {
+            fprintf(out, ",%.3f", thread_imbalance(i, perf_num_threads()));
+        }
+    }
     fprintf(out, "\n");
 }
 
@@ -180,6 +491,57 @@ int read_csv(FILE* csv_file, double matrix[][N])
     return i;
 }
 
+/**
+ * Parse a complex CSV cell written as re+imi or re-imi (a plain real value has a zero imaginary part)
+ *
+ * @return false if the cell is not a number
+ */
+bool parse_complex_cell(char *cell, double *real, double *imag)
+{
+    char *end;
+    *real = strtod(cell, &end);
+    *imag = 0;
+    if (end == cell) {
+        return false;
+    }
+    if (*end == '+' || *end == '-') {
+        char *imag_start = end;
+        *imag = strtod(imag_start, &end);
+        return end != imag_start && *end == 'i';
+    }
+    return true;
+}
+
+/**
+ * Read a complex matrix from the CSV file, cells as written by write_complex_matrix
+ *
+ * @return number of actual rows read from the file
+ */
+int read_complex_csv(FILE* csv_file, double real[][N], double imag[][N])
+{
+    char *line;
+    int i = 0;
+    while (i < (int)N && (line = csvgetline(csv_file)) != NULL) {
+        int num_fields = csvnfield();
+        if (num_fields < 2) {
+            printf("Warning: found non-empty trailing line. Will stop reading rows now: %s", line);
+            break;
+        }
+        if (num_fields != N) {
+            ERROR("%d values found on line. The file must contain square matrix of size %d: %s", num_fields, N, line);
+            break;
+        }
+        for (size_t j = 0; j < N; ++j) {
+            if (!parse_complex_cell(csvfield(j), &real[i][j], &imag[i][j])) {
+                ERROR("Not a complex value at row %d column %zu: %s", i, j, csvfield(j));
+            }
+        }
+        i++;
+    }
+    fclose(csv_file);
+    return i;
+}
+
 /**
  * Fill the given square matrix with a random value
  *
@@ -194,6 +556,59 @@ void fill_matrix_random(double matrix[][N])
     }
 }
 
+/**
+ * Fill the given square matrix with random values in about a fraction density of its elements, zero elsewhere
+ *
+ * @param matrix pre-allocated two dimensional array of doubles for the matrix
+ * @param density fraction of the elements that get a value
+ */
+void fill_matrix_random_sparse(double matrix[][N], double density)
+{
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            bool kept = ((double) rand()) / ((double) RAND_MAX) < density;
+            matrix[i][j] = kept ? ((double) rand()) / ((float) RAND_MAX) : 0;
+        }
+    }
+}
+
+/**
+ * Fill the given square matrix with random values in about a fraction density of its tiles, zero elsewhere
+ *
+ * @param matrix pre-allocated two dimensional array of doubles for the matrix
+ * @param bsize size of the tiles
+ * @param density fraction of the tiles that get values
+ */
+void fill_matrix_random_tiles(double matrix[][N], size_t bsize, double density)
+{
+    for (size_t ii = 0; ii < N; ii += bsize) {
+        for (size_t jj = 0; jj < N; jj += bsize) {
+            bool kept = ((double) rand()) / ((double) RAND_MAX) < density;
+            for (size_t i = ii; i < MIN(ii + bsize, (size_t)N); ++i) {
+                for (size_t j = jj; j < MIN(jj + bsize, (size_t)N); ++j) {
+                    matrix[i][j] = kept ? ((double) rand()) / ((float) RAND_MAX) : 0;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Fill the given square matrix with random values within bandwidth diagonals of the main one, zero elsewhere
+ *
+ * @param matrix pre-allocated two dimensional array of doubles for the matrix
+ * @param bandwidth diagonals below and above the main one that get values
+ */
+void fill_matrix_random_band(double matrix[][N], size_t bandwidth)
+{
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            bool in_band = (i > j ? i - j : j - i) <= bandwidth;
+            matrix[i][j] = in_band ? ((double) rand()) / ((float) RAND_MAX) : 0;
+        }
+    }
+}
+
 /**
  * Fill the given square matrix with the provided double value
  *
@@ -260,6 +675,19 @@ void write_matrix(FILE *out, char *label, char sep, double matrix[][N])
     fprintf(out, "\n");
 }
 
+/**
+ * Write a complex matrix as CSV to a file pointer, each cell as re+imi
+ */
+void write_complex_matrix(FILE *out, double real[][N], double imag[][N])
+{
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            fprintf(out, j > 0 ? ",%.3f%+.3fi" : "%.3f%+.3fi", real[i][j], imag[i][j]);
+        }
+        fprintf(out, "\n");
+    }
+}
+
 /**
  * Print the matrix of to stdout
  *
@@ -310,6 +738,69 @@ int read_csv_file(char *csv_file_name, double matrix[][N])
     return read_csv(csv_file, matrix);
 }
 
+/**
+ * Read a matrix from a binary file (recognized by its magic) or a CSV file
+ *
+ * @return number of rows read
+ */
+int read_matrix_file(char *file_name, double matrix[][N])
+{
+    if (is_binary_file(file_name)) {
+        return read_binary_file(file_name, matrix);
+    }
+    return read_csv_file(file_name, matrix);
+}
+
+/**
+ * Read a complex matrix from a binary file (c128, or a real type with zero imaginary parts)
+ * or a CSV file of re+imi cells
+ *
+ * @return number of rows read
+ */
+int read_complex_matrix_file(char *file_name, double real[][N], double imag[][N])
+{
+    if (is_binary_file(file_name)) {
+        return read_binary_complex_file(file_name, real, imag);
+    }
+    FILE *csv_file = fopen(file_name, "r");
+    if (!csv_file) {
+        fprintf(stderr, "Error: cannot read the input file at %s\n", file_name);
+        exit(1);
+    }
+    return read_complex_csv(csv_file, real, imag);
+}
+
+/**
+ * Write a complex matrix to a c128 binary file if the name ends with .mtx, else to a CSV file
+ */
+void write_complex_matrix_file(char *file_name, double real[][N], double imag[][N])
+{
+    if (has_binary_suffix(file_name)) {
+        write_binary_complex_file(file_name, real, imag);
+        return;
+    }
+    FILE *csv_file = fopen(file_name, "w");
+    if (!csv_file) {
+        fprintf(stderr, "Error: cannot write to the output file at %s\n", file_name);
+        exit(1);
+    }
+    write_complex_matrix(csv_file, real, imag);
+    fclose(csv_file);
+}
+
+/**
+ * Write a matrix to a binary file in the --storage type if the name ends with .mtx, else to a CSV file
+ */
+void write_matrix_file(char *file_name, double matrix[][N])
+{
+    if (has_binary_suffix(file_name)) {
+        write_binary_file(file_name, matrix, storage_dtype(config->storage));
+    }
+    else {
+        write_csv_file(file_name, matrix);
+    }
+}
+
 /**
  * Create a big enough array to clear all the way to the L3 cache
  */
@@ -322,10 +813,63 @@ void clear_caches()
         c = 0;
 }
 
+/**
+ * @return true if the first line of the existing metrics file is the header this run would write
+ */
+static bool same_metrics_headers(char *metrics_file_name, size_t num_events, int event_codes[num_events])
+{
+    char *headers = NULL;
+    size_t headers_size = 0;
+    FILE *expected = open_memstream(&headers, &headers_size);
+    if (expected == NULL) {
+        return true; // cannot check
+    }
+    print_metrics_headers(expected, num_events, event_codes);
+    fclose(expected);
+
+    char *line = NULL;
+    size_t line_size = 0;
+    FILE *existing = fopen(metrics_file_name, "r");
+    bool same = existing != NULL && getline(&line, &line_size, existing) >= 0 && strcmp(line, headers) == 0;
+    if (existing != NULL) {
+        fclose(existing);
+    }
+    free(line);
+    free(headers);
+    return same;
+}
+
+/**
+ * @return the metrics file the rows go to: metrics_file_name, or when it has other columns (another version or
+ * other --papi events) the first of NAME.1.csv, NAME.2.csv... that is new or has the same ones, so the
+ * measurement is kept without misaligning the rows of the existing file
+ */
+static char *metrics_file_with_headers(char *metrics_file_name, size_t num_events, int event_codes[num_events])
+{
+    static char other_name[PATH_MAX];
+    if (access(metrics_file_name, F_OK) == -1 || same_metrics_headers(metrics_file_name, num_events, event_codes)) {
+        return metrics_file_name;
+    }
+    char *extension = strrchr(metrics_file_name, '.');
+    int stem = extension != NULL && strchr(extension, '/') == NULL ?
+               (int)(extension - metrics_file_name) : (int)strlen(metrics_file_name);
+    for (int other = 1; ; other++) {
+        snprintf(other_name, sizeof(other_name), "%.*s.%d%s", stem, metrics_file_name, other,
+                 metrics_file_name + stem);
+        if (access(other_name, F_OK) == -1 || same_metrics_headers(other_name, num_events, event_codes)) {
+            break;
+        }
+    }
+    fprintf(stderr, "WARNING: The metrics file %s has other columns (another version or other --papi events): "
+                    "writing the metrics to %s instead\n", metrics_file_name, other_name);
+    return other_name;
+}
+
 void write_metrics_file(char *metrics_file_name, struct metrics *metrics,
                         size_t num_events, int event_codes[num_events],
                         long long event_values[num_events], int failed_codes[num_events])
 {
+    metrics_file_name = metrics_file_with_headers(metrics_file_name, num_events, event_codes);
     char *mode = "a"; // default to append to the metrics file
     bool first_time = false;
     if (access(metrics_file_name, F_OK ) == -1 ) {
@@ -339,11 +883,11 @@ void write_metrics_file(char *metrics_file_name, struct metrics *metrics,
         ERROR("Could not create or find a file to store metrics at %s. Does the dir exist?", metrics_file_name);
         exit(1);
     }
-
     if (first_time) {
         print_metrics_headers(metrics_file, num_events, event_codes);
     }
     print_metrics(metrics_file, metrics, num_events, event_values);
+    fclose(metrics_file); // --compare appends a row per implementation
 }
 
 /**
@@ -442,7 +986,7 @@ int test_results(struct config *config, char *test_file_name, double matrix[][N]
 {
     int result = 1;
     double (*test_matrix)[N] = malloc(N * N * sizeof(double));
-    int test_matrix_size = read_csv_file(test_file_name, test_matrix);
+    int test_matrix_size = read_matrix_file(test_file_name, test_matrix);
     if (test_matrix_size < (int)N) {
         if (!config->silent) {
             fprintf(stderr, "Test failed. The test matrix has %d rows whereas the produced matrix has %zu",
@@ -480,3 +1024,67 @@ int test_results(struct config *config, char *test_file_name, double matrix[][N]
     return result;
 }
 
+/**
+ * Compares a complex result against a complex test file, as test_results does for real ones
+ *
+ * An element fails when the modulus of its difference with the expected value exceeds the threshold.
+ *
+ * @return 1 or -1 if the files match
+ */
+int test_complex_results(struct config *config, char *test_file_name, double real[][N], double imag[][N])
+{
+    double (*test_real)[N] = malloc(N * N * sizeof(double));
+    double (*test_imag)[N] = malloc(N * N * sizeof(double));
+    int result = 1;
+    int test_matrix_size = read_complex_matrix_file(test_file_name, test_real, test_imag);
+    if (test_matrix_size < (int)N) {
+        if (!config->silent) {
+            fprintf(stderr, "Test failed. The test matrix has %d rows whereas the produced matrix has %d\n",
+                    test_matrix_size, N);
+        }
+        result = -1;
+    }
+    int failures_reported = 0;
+    for (size_t i = 0; i < (size_t)test_matrix_size && i < N; ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            double diff = hypot(test_real[i][j] - real[i][j], test_imag[i][j] - imag[i][j]);
+            if (diff > FAILURE_THRESHOLD) {
+                if (!config->silent && failures_reported++ < 10) {
+                    fprintf(stderr, "Test failure: result[%zu][%zu] %f%+fi does not match expected: %f%+fi (diff: %f)\n",
+                            i, j, real[i][j], imag[i][j], test_real[i][j], test_imag[i][j], diff);
+                }
+                result = -1;
+                break; // give up comparing at first failure in this row - but do the other rows
+            }
+        }
+    }
+    free(test_real);
+    free(test_imag);
+    return result;
+}
+
+/**
+ * Measure the accuracy lost by a reduced precision or storage result against the double path result
+ *
+ * Sets max_rel_error (elementwise, over the non-zero reference elements) and
+ * norm_rel_error (Frobenius norm of the difference over the norm of the reference) in the metrics.
+ */
+void compare_with_double_path(struct metrics *metrics, double matrix[][N], double reference[][N])
+{
+    double max_rel_error = 0, max_abs_error = 0, diff_norm = 0, reference_norm = 0;
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            double diff = fabs(matrix[i][j] - reference[i][j]);
+            max_abs_error = MAX(max_abs_error, diff);
+            if (reference[i][j] != 0) {
+                max_rel_error = MAX(max_rel_error, diff / fabs(reference[i][j]));
+            }
+            diff_norm += diff * diff;
+            reference_norm += reference[i][j] * reference[i][j];
+        }
+    }
+    metrics->max_rel_error = max_rel_error;
+    metrics->norm_rel_error = reference_norm > 0 ? sqrt(diff_norm / reference_norm) : sqrt(diff_norm);
+    INFO("Accuracy loss against the double path: max abs error %.3e, max relative error %.3e, "
+         "normwise relative error %.3e", max_abs_error, metrics->max_rel_error, metrics->norm_rel_error);
+}
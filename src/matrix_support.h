@@ -8,21 +8,71 @@
 #include <string.h>
 #include "matrix_types.h"
 
+// most counters of a run, over all its ! separated --papi subsets
+#define MAX_PAPI_CODES 100
+
+// what the run is, from the global config
+extern bool epilogue_configured();
+extern bool accuracy_compared();
+extern bool general_shape();
+extern bool dense_product();
+extern void prepare_result(double result[][N]);
+extern void update_metrics(struct metrics *metrics);
+extern double effective_gflops(struct metrics *metrics);
+extern void compare_with_double_path(struct metrics *metrics, double matrix[][N], double reference[][N]);
+
+// hardware counters of the run, from PAPI or perf_event_open as --perf says
+extern unsigned split_string(char *string, char *delim, char *words[MAX_PAPI_CODES]);
+extern void init_counters();
+extern int counter_code(char *event_name);
+extern char *counter_name(int event_code);
+extern int init_counter_events(unsigned offset, unsigned num_events, int *event_codes, int *failed_codes);
+extern long long start_counters(int event_set);
+extern long long stop_counters(int event_set, unsigned offset, long long *all_event_results);
+extern int init_counter_events_multiplexed(unsigned num_subsets, unsigned subset_starts[num_subsets],
+                                           unsigned subset_sizes[num_subsets], unsigned num_events,
+                                           int *event_codes, int *failed_codes);
+extern long long start_counters_multiplexed(int event_set);
+extern long long stop_counters_multiplexed(int event_set, long long *all_event_results);
+extern void release_counters();
+extern long long counted_event(char *event_name, size_t num_events, int event_codes[num_events],
+                               long long event_values[num_events], int failed_codes[num_events]);
+extern void describe_counter_events(size_t num_events, int event_codes[num_events],
+                                    long long event_values[num_events], int failed_codes[num_events]);
+extern void describe_thread_counters(size_t num_events, int event_codes[num_events]);
+extern void clear_caches();
+
+// --roofline and --trace
+extern struct roofline measure_roofline_peaks();
+extern void place_roofline(struct metrics *metrics, struct roofline *peaks, long long l3_misses);
+extern void describe_roofline(struct roofline *roofline);
+extern void trace_start();
+extern void write_trace_file(char *trace_file_name, const char *suffix);
+
 extern void fill_matrix_constant(double matrix[][N], double value);
 extern void fill_matrix_identity(double matrix[][N]);
 extern void fill_matrix_random(double matrix[][N]);
+extern void fill_matrix_random_sparse(double matrix[][N], double density);
+extern void fill_matrix_random_tiles(double matrix[][N], size_t bsize, double density);
+extern void fill_matrix_random_band(double matrix[][N], size_t bandwidth);
 
 extern void print_matrix(char *label, double matrix[][N]);
 extern void print_metrics_headers(FILE *out, size_t num_events, int event_codes[num_events]);
+extern double classical_flops(struct metrics *metrics);
 extern void print_metrics(FILE *out, struct metrics *metrics,
                           size_t num_events, long long event_results[num_events]);
 
+extern int read_matrix_file(char *file_name, double matrix[][N]);
 extern int read_csv_file(char *csv_file_name, double matrix[][N]);
 extern int read_csv(FILE *csv_file, double matrix[][N]);
 extern int test_results(struct config *config, char *test_file_name, double matrix[][N]);
+extern int read_complex_matrix_file(char *file_name, double real[][N], double imag[][N]);
+extern int test_complex_results(struct config *config, char *test_file_name, double real[][N], double imag[][N]);
 
+extern void write_matrix_file(char *file_name, double matrix[][N]);
 extern void write_csv_file(char *csv_file_name, double matrix[][N]);
 extern void write_matrix(FILE *out, char *label, char sep, double matrix[][N]);
+extern void write_complex_matrix_file(char *file_name, double real[][N], double imag[][N]);
 extern void write_metrics_file(char *metrics_file_name, struct metrics *metrics,
                                size_t num_events, int event_codes[num_events],
                                long long event_values[num_events], int failed_codes[num_events]);
@@ -0,0 +1,103 @@
+#include <math.h>
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_tiles.h"
+
+/*
+ * Symmetric rank-k update for --syrk upper|lower, linked into every implementation: C = A.A^T.
+ *
+ * C is symmetric, so only the tiles of one triangle are computed (half the flops of the full product)
+ * and, unless --syrk-no-mirror, copied to the other half afterwards.
+ *
+ * The triangle has a different number of tiles on each row of tiles, so a loop over the rows would
+ * give the threads unequal work. Instead the t (t + 1) / 2 tiles of the triangle are numbered in a
+ * single index space and dealt out dynamically: every tile costs the same (a full depth product), so
+ * the threads stay balanced whatever the shape. Each tile is a tile_gemm of a block of rows of A with
+ * a block of rows of A read as A^T (a strided view: the packing does the transposition).
+ */
+
+/**
+ * The (row, column) of tile number index of the lower triangle, numbered row by row
+ */
+static void lower_tile(size_t index, size_t *ti, size_t *tj)
+{
+    size_t row = (size_t)((sqrt(8.0 * (double)index + 1.0) - 1.0) / 2.0);
+    // fix the rounding of the square root for large indices
+    while (row * (row + 1) / 2 > index) {
+        row--;
+    }
+    while ((row + 1) * (row + 2) / 2 <= index) {
+        row++;
+    }
+    *ti = row;
+    *tj = index - row * (row + 1) / 2;
+}
+
+/**
+ * Copy the computed triangle to the other one, or clear the other triangle of the diagonal tiles
+ * (computed in full) so that only the requested triangle is set
+ */
+static void finish_triangle(enum triangle triangle, bool mirror, size_t bsize, double result[][N])
+{
+#pragma omp parallel
+    {
+        phase_begin(PHASE_WRITE_BACK);
+#pragma omp for schedule(dynamic, 16)
+        for (size_t i = 0; i < N; i++) {
+            // the other triangle of row i: j > i for lower, j < i for upper
+            size_t first = triangle == TRIANGLE_LOWER ? i + 1 : 0;
+            size_t last = triangle == TRIANGLE_LOWER ? N : i;
+            if (!mirror) {
+                // only the diagonal tile of the row was written outside the triangle
+                size_t tile_start = i / bsize * bsize;
+                first = MAX(first, tile_start);
+                last = MIN(last, tile_start + bsize);
+            }
+            for (size_t j = first; j < last; j++) {
+                result[i][j] = mirror ? result[j][i] : 0;
+            }
+        }
+        phase_end(PHASE_WRITE_BACK);
+    }
+}
+
+/**
+ * Compute the upper or lower triangle of A.A^T into result, mirrored to the other half unless
+ * --syrk-no-mirror. Uses the block size from the global config (-b, default 64).
+ *
+ * IMPORTANT: The result matrix must be zeroed for this function to succeed
+ *
+ * @param result preallocated zeroed matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_syrk(enum triangle triangle, bool mirror, double matrix[][N], double result[][N])
+{
+    size_t bsize = MIN(tile_block_size(), (size_t)N);
+    size_t tiles = (N + bsize - 1) / bsize;
+    size_t triangle_tiles = tiles * (tiles + 1) / 2;
+    INFO("Running SYRK %d x %d: %s triangle in %zu tiles of %zu%s", N, N, triangle_name(triangle), triangle_tiles,
+         bsize, mirror ? ", mirrored" : "");
+#pragma omp parallel
+    {
+#pragma omp for schedule(dynamic)
+        for (size_t index = 0; index < triangle_tiles; index++) {
+            size_t ti, tj;
+            lower_tile(index, &ti, &tj);
+            if (triangle == TRIANGLE_UPPER) {
+                size_t swap = ti;
+                ti = tj;
+                tj = swap;
+            }
+            size_t ii = ti * bsize, jj = tj * bsize;
+            struct tile_matrix a = { &matrix[ii][0], N, 1 };
+            struct tile_matrix a_transposed = { &matrix[jj][0], 1, N }; // (k, j) is A[jj + j][k]
+            struct tile_matrix c = { &result[ii][jj], N, 1 };
+            double start = trace_now();
+            // on this thread only: tile_gemm does not open a parallel region inside one
+            tile_gemm(MIN(bsize, N - ii), MIN(bsize, N - jj), N, 1.0, a, a_transposed, c);
+            trace_tile(0, start, ii, jj, 0);
+        }
+    }
+    finish_triangle(triangle, mirror, bsize, result);
+    return 1; // forget about flops - we'll add it from known values
+}
@@ -0,0 +1,107 @@
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_tiles.h"
+
+/*
+ * Tile scheduling and packing shared by the engines built on general strided GEMMs.
+ *
+ * The C tiles are distributed over the OpenMP threads (dynamic schedule), each tile owned by a
+ * single thread so no synchronization is needed on C. For each step along k the thread packs the
+ * A and B tiles into contiguous buffers of its own, so the micro-kernel streams unit-stride data
+ * whatever the strides of the operands, and runs an i k j kernel on them that vectorizes.
+ * When called from inside a parallel region (a task, or a batch loop) the tiles run on the
+ * calling thread only.
+ *
+ * The operands are strided views, so packing also gathers one part of interleaved complex values
+ * and the kernels only ever see contiguous real tiles. C is accumulated in a contiguous tile too
+ * and added to the view once per tile.
+ */
+
+size_t tile_block_size()
+{
+    return config->block_size > 0 ? (size_t)config->block_size : TILE_DEFAULT_BLOCK;
+}
+
+void tile_pack(size_t rows, size_t cols, double alpha, struct tile_matrix src, double *dst)
+{
+    for (size_t i = 0; i < rows; i++) {
+        const double *row = src.data + i * src.ld;
+        for (size_t j = 0; j < cols; j++) {
+            dst[i * cols + j] = alpha * row[j * src.step];
+        }
+    }
+}
+
+static struct tile_matrix tile_at(struct tile_matrix matrix, size_t i, size_t j)
+{
+    struct tile_matrix tile = { matrix.data + i * matrix.ld + j * matrix.step, matrix.ld, matrix.step };
+    return tile;
+}
+
+/**
+ * C tile += packed A tile . packed B tile
+ */
+static void tile_kernel(size_t rows, size_t cols, size_t depth, const double *restrict a,
+                        const double *restrict b, double *restrict c)
+{
+    for (size_t i = 0; i < rows; i++) {
+        for (size_t k = 0; k < depth; k++) {
+            double a_ik = a[i * depth + k];
+            for (size_t j = 0; j < cols; j++) {
+                c[i * cols + j] += a_ik * b[k * cols + j];
+            }
+        }
+    }
+}
+
+/**
+ * C += alpha A . B for an m x k A, k x n B and m x n C given as strided views
+ */
+void tile_gemm(size_t m, size_t n, size_t k, double alpha,
+               struct tile_matrix a, struct tile_matrix b, struct tile_matrix c)
+{
+    size_t bsize = tile_block_size();
+    size_t row_tiles = (m + bsize - 1) / bsize;
+    size_t col_tiles = (n + bsize - 1) / bsize;
+#pragma omp parallel if(!omp_in_parallel())
+    {
+        double *a_tile = malloc(bsize * bsize * sizeof(double));
+        double *b_tile = malloc(bsize * bsize * sizeof(double));
+        double *c_tile = malloc(bsize * bsize * sizeof(double));
+        if (a_tile == NULL || b_tile == NULL || c_tile == NULL) {
+            ERROR("Could not allocate the packed tiles");
+            exit(1);
+        }
+#pragma omp for collapse(2) schedule(dynamic)
+        for (size_t ti = 0; ti < row_tiles; ti++) {
+            for (size_t tj = 0; tj < col_tiles; tj++) {
+                size_t ii = ti * bsize, jj = tj * bsize;
+                size_t rows = MIN(bsize, m - ii), cols = MIN(bsize, n - jj);
+                memset(c_tile, 0, rows * cols * sizeof(double));
+                for (size_t kk = 0; kk < k; kk += bsize) {
+                    size_t depth = MIN(bsize, k - kk);
+                    phase_begin(PHASE_PACK_A);
+                    tile_pack(rows, depth, alpha, tile_at(a, ii, kk), a_tile);
+                    phase_end(PHASE_PACK_A);
+                    phase_begin(PHASE_PACK_B);
+                    tile_pack(depth, cols, 1.0, tile_at(b, kk, jj), b_tile);
+                    phase_end(PHASE_PACK_B);
+                    phase_begin(PHASE_KERNEL);
+                    tile_kernel(rows, cols, depth, a_tile, b_tile, c_tile);
+                    phase_end(PHASE_KERNEL);
+                }
+                phase_begin(PHASE_WRITE_BACK);
+                for (size_t i = 0; i < rows; i++) {
+                    double *row = c.data + (ii + i) * c.ld + jj * c.step;
+                    for (size_t j = 0; j < cols; j++) {
+                        row[j * c.step] += c_tile[i * cols + j];
+                    }
+                }
+                phase_end(PHASE_WRITE_BACK);
+            }
+        }
+        free(a_tile);
+        free(b_tile);
+        free(c_tile);
+    }
+}
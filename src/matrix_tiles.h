@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Shared tile scheduling and packing for the engines that are not tied to one implementation module
+ * (complex products and the general shapes). See matrix_tiles.c.
+ */
+
+#define TILE_DEFAULT_BLOCK 64
+
+// a strided view of a matrix: element (i, j) is at data[i * ld + j * step]
+struct tile_matrix {
+    double *data;
+    size_t ld;
+    size_t step; // 1 for plain row-major, 2 for one part of interleaved complex values
+};
+
+// block size for the tiles: -b from the config, else TILE_DEFAULT_BLOCK
+extern size_t tile_block_size();
+
+// copy a rows x cols block of a view to a contiguous buffer, scaled by alpha
+extern void tile_pack(size_t rows, size_t cols, double alpha, struct tile_matrix src, double *dst);
+
+// C += alpha A . B for an m x k A, k x n B and m x n C
+extern void tile_gemm(size_t m, size_t n, size_t k, double alpha,
+                      struct tile_matrix a, struct tile_matrix b, struct tile_matrix c);
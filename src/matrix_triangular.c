@@ -0,0 +1,166 @@
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_tiles.h"
+
+/*
+ * Products and solves with a triangular A for --trmm and --trsm, linked into every implementation:
+ * C = tri(A).B and tri(A).X = B, where tri(A) is the upper or lower triangle of A, diagonal included.
+ * The other triangle of A is never read.
+ *
+ * The dense product would spend half its work on the zeros of the triangle. Both operations recurse on
+ * halves of the triangle instead. For lower, with A = [A11 0; A21 A22]:
+ *   TRMM: C1 = A11.B1 (recursion), C2 = A22.B2 (recursion) + A21.B1 (tile_gemm)
+ *   TRSM: X1 = A11 \ B1 (recursion), B2 -= A21.X1 (tile_gemm), X2 = A22 \ B2 (recursion)
+ * and the mirror image for upper. Only the diagonal blocks of -b (default 64) are left to the small
+ * triangular kernels, a fraction b / N of the flops: the rest runs in the packed tile GEMM, whose tiles
+ * the threads share dynamically. The columns of B are independent, so the diagonal blocks split them
+ * into chunks across the threads.
+ */
+
+#define TRIANGULAR_COLUMNS 128 // columns of B per chunk at the diagonal blocks
+
+/**
+ * Split n (> bsize) into two parts, the first a whole number of blocks, so the leaves stay aligned
+ */
+static size_t split(size_t n, size_t bsize)
+{
+    return (n / bsize + 1) / 2 * bsize;
+}
+
+static struct tile_matrix view(double matrix[][N], size_t i, size_t j)
+{
+    struct tile_matrix tile = { &matrix[i][j], N, 1 };
+    return tile;
+}
+
+/**
+ * C[i] += tri(A)[i] . B for the rows i of the diagonal block at first, size n
+ */
+static void trmm_diagonal(enum triangle triangle, size_t first, size_t n, double matrix1[][N], double matrix2[][N],
+                          double result[][N])
+{
+#pragma omp parallel for schedule(static) if(!omp_in_parallel())
+    for (size_t jj = 0; jj < N; jj += TRIANGULAR_COLUMNS) {
+        size_t width = MIN((size_t)TRIANGULAR_COLUMNS, N - jj);
+        phase_begin(PHASE_KERNEL);
+        for (size_t i = first; i < first + n; i++) {
+            size_t k_first = triangle == TRIANGLE_LOWER ? first : i;
+            size_t k_last = triangle == TRIANGLE_LOWER ? i + 1 : first + n;
+            double *restrict c = &result[i][jj];
+            for (size_t k = k_first; k < k_last; k++) {
+                double a_ik = matrix1[i][k];
+                const double *restrict b = &matrix2[k][jj];
+#pragma omp simd
+                for (size_t j = 0; j < width; j++) {
+                    c[j] += a_ik * b[j];
+                }
+            }
+        }
+        phase_end(PHASE_KERNEL);
+    }
+}
+
+/**
+ * Solve the diagonal block at first, size n, in place: forward substitution for lower, backward for upper
+ */
+static void trsm_diagonal(enum triangle triangle, size_t first, size_t n, double matrix[][N], double x[][N])
+{
+#pragma omp parallel for schedule(static) if(!omp_in_parallel())
+    for (size_t jj = 0; jj < N; jj += TRIANGULAR_COLUMNS) {
+        size_t width = MIN((size_t)TRIANGULAR_COLUMNS, N - jj);
+        phase_begin(PHASE_KERNEL);
+        for (size_t step = 0; step < n; step++) {
+            size_t i = triangle == TRIANGLE_LOWER ? first + step : first + n - 1 - step;
+            size_t k_first = triangle == TRIANGLE_LOWER ? first : i + 1;
+            size_t k_last = triangle == TRIANGLE_LOWER ? i : first + n;
+            double *restrict row = &x[i][jj];
+            for (size_t k = k_first; k < k_last; k++) {
+                double a_ik = matrix[i][k];
+                const double *restrict solved = &x[k][jj];
+#pragma omp simd
+                for (size_t j = 0; j < width; j++) {
+                    row[j] -= a_ik * solved[j];
+                }
+            }
+            double inverse = 1.0 / matrix[i][i];
+#pragma omp simd
+            for (size_t j = 0; j < width; j++) {
+                row[j] *= inverse;
+            }
+        }
+        phase_end(PHASE_KERNEL);
+    }
+}
+
+static void trmm(enum triangle triangle, size_t first, size_t n, size_t bsize, double matrix1[][N],
+                 double matrix2[][N], double result[][N])
+{
+    if (n <= bsize) {
+        trmm_diagonal(triangle, first, n, matrix1, matrix2, result);
+        return;
+    }
+    size_t n1 = split(n, bsize), n2 = n - n1, second = first + n1;
+    trmm(triangle, first, n1, bsize, matrix1, matrix2, result);
+    trmm(triangle, second, n2, bsize, matrix1, matrix2, result);
+    if (triangle == TRIANGLE_LOWER) {
+        // C2 += A21 . B1
+        tile_gemm(n2, N, n1, 1.0, view(matrix1, second, first), view(matrix2, first, 0), view(result, second, 0));
+    }
+    else {
+        // C1 += A12 . B2
+        tile_gemm(n1, N, n2, 1.0, view(matrix1, first, second), view(matrix2, second, 0), view(result, first, 0));
+    }
+}
+
+static void trsm(enum triangle triangle, size_t first, size_t n, size_t bsize, double matrix[][N], double x[][N])
+{
+    if (n <= bsize) {
+        trsm_diagonal(triangle, first, n, matrix, x);
+        return;
+    }
+    size_t n1 = split(n, bsize), n2 = n - n1, second = first + n1;
+    if (triangle == TRIANGLE_LOWER) {
+        // X1 = A11 \ B1, B2 -= A21 . X1, X2 = A22 \ B2
+        trsm(triangle, first, n1, bsize, matrix, x);
+        tile_gemm(n2, N, n1, -1.0, view(matrix, second, first), view(x, first, 0), view(x, second, 0));
+        trsm(triangle, second, n2, bsize, matrix, x);
+    }
+    else {
+        // X2 = A22 \ B2, B1 -= A12 . X2, X1 = A11 \ B1
+        trsm(triangle, second, n2, bsize, matrix, x);
+        tile_gemm(n1, N, n2, -1.0, view(matrix, first, second), view(x, second, 0), view(x, first, 0));
+        trsm(triangle, first, n1, bsize, matrix, x);
+    }
+}
+
+/**
+ * Multiply B by the upper or lower triangle of A. Uses the block size from the global config (-b, default 64).
+ *
+ * IMPORTANT: The result matrix must be zeroed for this function to succeed
+ *
+ * @param result preallocated zeroed matrix into which to store the results
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_trmm(enum triangle triangle, double matrix1[][N], double matrix2[][N], double result[][N])
+{
+    size_t bsize = MIN(tile_block_size(), (size_t)N);
+    INFO("Running TRMM %d x %d: %s triangle of A . B, diagonal blocks of %zu", N, N, triangle_name(triangle), bsize);
+    trmm(triangle, 0, N, bsize, matrix1, matrix2, result);
+    return 1; // forget about flops - we'll add it from known values
+}
+
+/**
+ * Solve tri(A) . X = B for X into result, tri(A) the upper or lower triangle of A, which must have no
+ * zero on its diagonal. Uses the block size from the global config (-b, default 64).
+ *
+ * @param result preallocated matrix into which to store the solution
+ * @return number of doubleing point operations performed or -1 if there is a problem
+ */
+long dot_multiply_matrices_trsm(enum triangle triangle, double matrix1[][N], double matrix2[][N], double result[][N])
+{
+    size_t bsize = MIN(tile_block_size(), (size_t)N);
+    INFO("Running TRSM %d x %d: %s triangle of A \\ B, diagonal blocks of %zu", N, N, triangle_name(triangle), bsize);
+    memcpy(result, matrix2, sizeof(double) * N * N); // solved in place
+    trsm(triangle, 0, N, bsize, matrix1, result);
+    return 1; // forget about flops - we'll add it from known values
+}
@@ -8,12 +8,19 @@
 #define N 4096
 // Calculate OPS second
 #define KNOWN_DPOPS 3400000000
+// multiply-adds of the classical N^3 algorithm, for rates that are comparable with hardware peaks
+#define CLASSICAL_FLOPS (2.0 * N * N * N)
 // How many rows to report progress on in verbose mode
 #define PROGRESS_GRANULARITY 100
 
 #define MAX_SIZE 15
 #define DEFAULT_BLOCK_SIZE 0
 #define FAILURE_THRESHOLD 0.001
+// longest --chain of matrices
+#define CHAIN_MAX_MATRICES 16
+#define CHAIN_ORDER_LENGTH (8 * CHAIN_MAX_MATRICES) // its parenthesization, A1 to A16
+// most implementations --compare runs, repeats included
+#define COMPARE_MAX_IMPLEMENTATIONS 16
 
 // Error codes to use instead of flops count
 #define MATRIX_FAILED -1
@@ -27,16 +34,94 @@
 // order of loops in multiplication
 enum loop_order { ijk, ikj, jki };
 
+// arithmetic of the multiplication: --precision
+//  single = float storage and accumulation, mixed = float storage with double accumulation,
+//  refine = mixed products plus a correction pass from the float rounding residuals
+enum precision { PRECISION_DOUBLE, PRECISION_SINGLE, PRECISION_MIXED, PRECISION_REFINE };
+
+// element type A and B are stored in for the product: --storage (16 bit floats are widened to float to
+// multiply, integers are quantized with per-row scales and accumulated in int32)
+enum storage { STORAGE_DOUBLE, STORAGE_FP16, STORAGE_BF16, STORAGE_INT8, STORAGE_INT16 };
+
+// complex double product: --complex (4m = 4 real products, 3m = 3 real products and extra additions)
+enum complex_algorithm { COMPLEX_NONE, COMPLEX_4M, COMPLEX_3M };
+
+// how the real and imaginary parts of complex matrices are stored: --complex-layout
+enum complex_layout { LAYOUT_INTERLEAVED, LAYOUT_SPLIT };
+
+// triangle of a matrix: the one of C = A.A^T computed by --syrk, the triangle of A used by --trmm and --trsm
+enum triangle { TRIANGLE_NONE, TRIANGLE_UPPER, TRIANGLE_LOWER };
+
+// storage of A for the product: --sparse (auto picks from the density, tiles and band of A),
+// blocks keeps A dense and skips the all-zero tiles in the blocked implementations
+enum sparse_format { SPARSE_AUTO, SPARSE_DENSE, SPARSE_CSR, SPARSE_CSC, SPARSE_BLOCKS, SPARSE_BAND };
+
+// vector added to the result by the epilogue of the double A . B: --bias (one value per row or per column)
+enum bias_vector { BIAS_NONE, BIAS_ROW, BIAS_COL };
+
+// an implementation of the double A . B, registered by name in matrix_registry.c
+struct implementation {
+    char *name;
+    char *description;
+    long (*multiply)(enum loop_order order, double matrix1[][N], double matrix2[][N], double result[][N]);
+    bool transposed_b; // dots the rows of A with the rows of B, so it multiplies by B^T
+    bool blocked; // needs a -b dividing N
+    bool sparse_tiles; // skips the all-zero tiles of --sparse blocks (block_tiles_productive)
+    void (*prepare)(); // one-off setup kept out of the timed products (tuning), or NULL
+};
+
+// kernel and order of the C tiles chosen by a --plan (matrix_plan.c)
+enum plan_kernel { PLAN_KERNEL_IKJ, PLAN_KERNEL_ROWS4 };
+enum plan_schedule { PLAN_STATIC, PLAN_DYNAMIC };
+
+// elementwise function applied last by the epilogue: --activation
+enum activation { ACTIVATION_NONE, ACTIVATION_RELU, ACTIVATION_SIGMOID, ACTIVATION_TANH, ACTIVATION_GELU };
+
+// phases of the multiplication kernels that --thread-counters reports separately
+enum counter_phase { PHASE_PACK_A, PHASE_PACK_B, PHASE_KERNEL, PHASE_REDUCE, PHASE_WRITE_BACK, NUM_PHASES };
+
 struct config {
     char *in_file;
     char *out_file;
     char *test_file;
     char *papi_arg; /// comma separated papi event names
     char *metrics_file;
+    char *trace_file; // Chrome trace JSON of the tile timeline
     char *label;
     enum loop_order loop_order;
     int size;
     int block_size;
+    int cutoff; // Strassen crossover size, 0 to tune it
+    enum precision precision;
+    enum storage storage;
+    enum complex_algorithm complex;
+    enum complex_layout complex_layout;
+    int batch; // size of the small matrices of a batched product, 0 for one N x N product
+    bool batch_pointers; // batch through the array of pointers API rather than the strided one
+    bool jit; // kernels generated and compiled at run time for the shape
+    char *jit_cache; // directory of the compiled kernels
+    int a_rows; // rows of A in the product, 0 for N
+    int b_cols; // columns of B in the product, 0 for N
+    enum triangle syrk;
+    bool syrk_mirror; // copy the computed triangle to the other half
+    enum triangle trmm; // B := tri(A) . B
+    enum triangle trsm; // solve tri(A) . X = B
+    enum sparse_format sparse; // resolved from auto once A is loaded
+    double a_density; // fraction of non-zeros of a random A, 0 for all
+    double a_tile_density; // fraction of the -b tiles of a random A that are not all zero, 0 for all
+    int a_bandwidth; // diagonals below and above the main one of a random banded A, -1 for all
+    int chain[CHAIN_MAX_MATRICES + 1]; // dimensions of the --chain of random matrices, matrix i is chain[i] x chain[i+1]
+    int chain_matrices; // 0 for the A . B product
+    // epilogue of the double A . B: C = activation(alpha A . B + beta C + bias)
+    double alpha;
+    double beta; // 0 overwrites C, which then needs no zeroing
+    enum bias_vector bias;
+    enum activation activation;
+    char *plan_file; // plan of the double A . B to load, or to make and save, NULL to run the implementation
+    bool plan_estimate; // make the plan from the defaults instead of timing the candidates
+    char *implementations[COMPARE_MAX_IMPLEMENTATIONS]; // --impl or --compare, run in turn on the same A and B
+    int implementation_count; // 0 for the one of the executable
+    bool compare; // one metrics row per implementation
     bool identity;
     bool silent;
     bool verbose;
@@ -44,12 +129,31 @@ struct config {
     bool quiet;
     bool giga; // giga flops/second instead of flops/second
     bool papi_ignore;
+    bool perf; // count the --papi events with perf_event_open instead of PAPI
+    bool multiplex; // collect all the ! separated --papi subsets in a single multiplexed run
+    bool thread_counters; // per-thread and per-phase counters (perf backend only)
+    bool roofline; // measure the machine peaks and report the run against them
     bool test_equal_cols;
     bool test_reverse_rows;
 };
 
+// where a run sits on the roofline of the machine (--roofline)
+struct roofline {
+    double peak_flops;           // FLOP/s of the FMA benchmark on all threads
+    double peak_bytes;           // bytes/s of the STREAM triad on all threads
+    double ridge;                // FLOPs/byte where the roofs meet
+    double traffic_bytes;        // DRAM traffic of the run
+    bool traffic_measured;       // from the L3 miss counter rather than the model
+    double arithmetic_intensity; // FLOPs/byte of the run
+    double achieved_flops;       // 2 N^3 / time
+    double peak_fraction;        // achieved / peak FLOP/s
+    double roof_fraction;        // achieved / attainable at this intensity
+    bool memory_bound;
+};
+
 struct metrics {
     char *label; // label for metrics row from -l command line arg
+    char *implementation; // name of the one dot_multiply_matrices ran
     long flops; // doubleing point operations
     double total_seconds;         // total time in seconds for the run
     long long total_micro_seconds; // total time in seconds for the run
@@ -63,6 +167,40 @@ struct metrics {
     int omp_chunk_size;
     enum loop_order loop_order;
     int block_size;
+    enum precision precision;
+    enum storage storage;
+    enum complex_algorithm complex;
+    enum complex_layout complex_layout;
+    int batch;
+    int a_rows; // 0 for N
+    int b_cols; // 0 for N
+    double bytes_per_second; // compulsory traffic over the run time, only for --a-rows or --b-cols
+    enum triangle syrk;
+    enum triangle trmm;
+    enum triangle trsm;
+    enum sparse_format sparse; // dense, csr, csc, blocks or band: the engine the run used
+    double a_density; // fraction of non-zeros in A
+    int chain_matrices; // 0 unless --chain
+    char chain_order[CHAIN_ORDER_LENGTH]; // parenthesization of the --chain plan
+    double chain_flops; // of the planned order
+    double chain_naive_flops; // of the left to right order
+    double chain_arena_bytes; // workspace of the planned intermediates
+    double chain_naive_bytes; // intermediates of the left to right order
+    double alpha; // the epilogue of the double A . B
+    double beta;
+    enum bias_vector bias;
+    enum activation activation;
+    enum plan_kernel plan_kernel; // the --plan the product ran on
+    int plan_block;
+    enum plan_schedule plan_schedule;
+    bool plan_loaded; // from the file rather than made
+    double plan_seconds; // to load or make the plan
+    double pack_seconds; // to pack B into its panels
+    // accuracy loss against the double path, only measured for reduced precision or storage (else -1),
+    // or of the 3m complex product against the 4m one, or the residual tri(A) . X - B of --trsm
+    double max_rel_error;  // max over the elements of |C - C_double| / |C_double|
+    double norm_rel_error; // ||C - C_double|| / ||C_double|| (Frobenius)
+    struct roofline roofline; // only measured with --roofline
 };
 
 #define DEBUG__INT(fmt, ...) if (config->debug) printf("DEBUG " fmt "%s", __VA_ARGS__);
@@ -3,6 +3,7 @@
 #include "matrix.h"
 //#include "matrix_config.h"
 #include "matrix_types.h"
+#include "matrix_epilogue.h"
 #include <x86intrin.h>
 
 #include <immintrin.h>
@@ -13,7 +14,7 @@
  * @param v vector of doubles
  * @return a scalar double being the sum of the vector elements
  */
-double reduce_double_avx(__m256d v) {
+static double reduce_double_avx(__m256d v) {
     __m128d vlow  = _mm256_castpd256_pd128(v);
     __m128d vhigh = _mm256_extractf128_pd(v, 1); // high 128
             vlow  = _mm_add_pd(vlow, vhigh);     // reduce down to 128
@@ -35,7 +36,7 @@ double reduce_double_avx(__m256d v) {
  * @param result preallocated zeroed matrix into which to store the results
  * @return number of floating point operations performed or -1 if there is a problem
  */
-void multiply_block(int ii, int jj, int kk, size_t bsize, double matrix1[][N], double matrix2[][N], double result[][N])
+static void multiply_block(int ii, int jj, int kk, size_t bsize, double matrix1[][N], double matrix2[][N], double result[][N])
 {
     {
         __m256d sum;
@@ -49,8 +50,8 @@ void multiply_block(int ii, int jj, int kk, size_t bsize, double matrix1[][N], d
                 // AVX supports four 64-bit double-precision floating point numbers.
                 for (size_t k = kk; k < kk + bsize; k += 4) {
                     // this ALMOST works but give results that do not correspond to expected
-                    vector1 = _mm256_load_pd(&matrix1[i][k]); // matrix1[i][k]
-                    vector2 = _mm256_load_pd(&matrix2[j][k]); // matrix2[j][k]
+                    vector1 = _mm256_loadu_pd(&matrix1[i][k]); // matrix1[i][k]
+                    vector2 = _mm256_loadu_pd(&matrix2[j][k]); // matrix2[j][k]
                     vmult = _mm256_mul_pd(vector1, vector2);
                     // reduce the result to a scalar
                     result[i][j] += reduce_double_avx(vmult);
@@ -60,9 +61,10 @@ void multiply_block(int ii, int jj, int kk, size_t bsize, double matrix1[][N], d
     }
 }
 
-long dot_multiply_matrices_blocked(size_t bsize, double matrix1[][N], double matrix2[][N], double result[][N])
+static long dot_multiply_matrices_blocked(size_t bsize, double matrix1[][N], double matrix2[][N], double result[][N])
 {
-#pragma omp parallel shared(matrix1, matrix2, result, bsize)
+    const struct epilogue *epilogue = &gemm_epilogue;
+#pragma omp parallel shared(matrix1, matrix2, result, bsize, epilogue)
     {
 #pragma omp single
         {
@@ -74,11 +76,25 @@ long dot_multiply_matrices_blocked(size_t bsize, double matrix1[][N], double mat
                         // as  as ingoing to the task or outomcing or both. in separate
                         // This is based on the OpenMP documentation example found in:
                         // https://www.openmp.org/wp-content/uploads/openmp-examples-5.0.0.pdf
-                        #pragma omp task shared(matrix1, matrix2, result, bsize)  \
-                            firstprivate(ii, jj, kk) \
+                        double created = trace_now();
+                        // the tasks of a C tile run in kk order: the first and last run the epilogue on it
+                        #pragma omp task shared(matrix1, matrix2, result, bsize, epilogue)  \
+                            firstprivate(ii, jj, kk, created) \
                             depend(in: matrix1[ii:bsize][kk:bsize], matrix2[kk:bsize][jj:bsize]) \
                             depend(inout: result[ii:bsize][jj:bsize])
-                        multiply_block(ii, jj, kk, bsize, matrix1, matrix2, result);
+                        {
+                            double start = trace_now();
+                            phase_begin(PHASE_KERNEL);
+                            if (kk == 0) {
+                                epilogue_begin_tile(epilogue, result, ii, jj, bsize, bsize);
+                            }
+                            multiply_block(ii, jj, kk, bsize, matrix1, matrix2, result);
+                            if (kk + bsize == N) {
+                                epilogue_end_tile(epilogue, result, ii, jj, bsize, bsize);
+                            }
+                            phase_end(PHASE_KERNEL);
+                            trace_tile(created, start, ii, jj, kk);
+                        }
                     }
                 }
             }
@@ -94,15 +110,16 @@ long dot_multiply_matrices_blocked(size_t bsize, double matrix1[][N], double mat
  * Relies on the global config to get the block_size (so that it can match the signature
  * of the same function in other implementation modules)
  *
- * IMPORTANT: The result matrix must be zeroed for this function to succeed
+ * The result is combined with the product as gemm_epilogue says (matrix_epilogue.h): by default the product
+ * is added to it, so it must be zeroed, with beta 0 it is overwritten without being read.
  *
  * @param order the loop order: one of ijk, kij, or kji
  * @param matrix1 left-side of the dot-multiplication
  * @param matrix2 right-side of the dot-multiplication
- * @param result preallocated zeroed matrix into which to store the results
+ * @param result preallocated matrix into which to store the results
  * @return number of doubleing point operations performed or -1 if there is a problem
  */
-long dot_multiply_matrices(enum loop_order order, double matrix1[][N], double matrix2[][N], double result[][N])
+long dot_multiply_matrices_vector(enum loop_order order, double matrix1[][N], double matrix2[][N], double result[][N])
 {
     int bsize = config->block_size;
     if (bsize < 1) {
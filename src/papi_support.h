@@ -11,8 +11,16 @@
 
 #define MAX_PAPI_CODES 100
 
+// fraction of the run that each event was actually counted when multiplexing (--multiplex)
+// 1.0 = counted all the time, lower values were scaled up; -1 = unknown (PAPI does not tell us)
+double counter_confidence[MAX_PAPI_CODES];
+
 extern struct config *config;
 
+// the event sets created for the run, destroyed by release_papi_events
+static int papi_event_sets[MAX_PAPI_CODES];
+static int papi_num_event_sets = 0;
+
 unsigned split_string(char *string, char *delim, char *words[MAX_PAPI_CODES]) {
     if (string == NULL || strlen(string) == 0) return 0;
     char *buffer, *aPtr;
@@ -59,6 +67,9 @@ int init_papi_events(unsigned offset, unsigned num_events, int *event_codes, int
     int event_set = PAPI_NULL; // init a handle for the event set reference
     int retval = PAPI_create_eventset(&event_set);
     handle_papi(retval, "event set creation failed", "PAPI event set creation succeeded");
+    if (retval == PAPI_OK && papi_num_event_sets < MAX_PAPI_CODES) {
+        papi_event_sets[papi_num_event_sets++] = event_set;
+    }
 
     // debug papi
 //    PAPI_option_t options;
@@ -100,6 +111,49 @@ int init_papi_events(unsigned offset, unsigned num_events, int *event_codes, int
     return event_set;
 }
 
+/**
+ * Builds a single multiplexed EventSet holding all the events so they are collected in one run.
+ *
+ * PAPI time-slices the events over the available counters and scales the values itself,
+ * but does not report how long each event was really counted, so the confidence is unknown.
+ *
+ * @param num_events number of event codes in event_codes
+ * @param event_codes array of PAPI event codes from every subset
+ * @param failed_codes array to which we add return values of any papi failures per event
+ * @return EventSet handle to the multiplexed event set
+ */
+int init_papi_multiplex_events(unsigned num_events, int *event_codes, int *failed_codes) {
+    int retval = PAPI_multiplex_init();
+    handle_papi(retval, "multiplex initialization failed", "PAPI multiplex initialization succeeded");
+
+    int event_set = PAPI_NULL;
+    retval = PAPI_create_eventset(&event_set);
+    handle_papi_errors(retval, "event set creation failed");
+    if (retval == PAPI_OK && papi_num_event_sets < MAX_PAPI_CODES) {
+        papi_event_sets[papi_num_event_sets++] = event_set;
+    }
+    // the event set must be bound to the cpu component before it can be multiplexed
+    retval = PAPI_assign_eventset_component(event_set, 0);
+    handle_papi_errors(retval, "failed to assign the event set to the cpu component");
+    retval = PAPI_set_multiplex(event_set);
+    handle_papi_errors(retval, "failed to make the event set multiplexed");
+
+    int add_failures = 0;
+    for (unsigned i = 0; i < num_events; i++) {
+        retval = PAPI_add_event(event_set, event_codes[i]);
+        failed_codes[i] = retval;
+        counter_confidence[i] = -1;
+        if (retval != PAPI_OK) {
+            add_failures++;
+            char *code_name = papi_name(event_codes[i]);
+            INFO("WARNING: Skipping PAPI code %s! Failed to add it to the multiplexed EventSet. Error code: %d (%s)",
+                 code_name, retval, PAPI_strerror(retval));
+        }
+    }
+    INFO("PAPI multiplexing %u events (%d could not be added)", num_events, add_failures);
+    return event_set;
+}
+
 long long start_papi(int event_set) {
     long long start_marker = get_papi_time();
     int retval = PAPI_start(event_set);
@@ -117,6 +171,18 @@ long long stop_papi(int event_set, unsigned offset, long long *all_event_results
     return stop_marker;
 }
 
+/**
+ * Empty and destroy the (stopped) event sets of the run, so another run can create its own
+ */
+void release_papi_events()
+{
+    for (int s = 0; s < papi_num_event_sets; s++) {
+        handle_papi_errors(PAPI_cleanup_eventset(papi_event_sets[s]), "failed to empty an event set");
+        handle_papi_errors(PAPI_destroy_eventset(&papi_event_sets[s]), "failed to destroy an event set");
+    }
+    papi_num_event_sets = 0;
+}
+
 void describe_papi_event(int event_code, long long event_value, int error) {
     PAPI_event_info_t info;
     PAPI_get_event_info(event_code, &info);
@@ -138,6 +204,9 @@ void describe_papi_events(size_t num_events, int event_codes[num_events],
     for (int i = 0; i < num_events; i++) {
         describe_papi_event(event_codes[i], event_values[i], failed_codes[i]);
     }
+    if (config->multiplex && num_events > 0) {
+        printf("(multiplexed: PAPI scaled the values but does not report how long each event was counted)\n");
+    }
 }
 
 // print the event names in a csv line
@@ -7,8 +7,8 @@
 #include <stdbool.h>
 #include <string.h>
 
-#ifdef __APPLE__
-// macos does not have PAPI, so compile with headers and stubs
+#if defined(__APPLE__) || defined(NO_PAPI)
+// macos does not have PAPI (nor do some linux hosts: make PAPI=no), so compile with headers and stubs
 #include "local_papi.h"
 #include "local_papi_stubs.h"
 #else
@@ -0,0 +1,808 @@
+#ifndef PERF_SUPPORT_LOCAL
+#define PERF_SUPPORT_LOCAL
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <omp.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "matrix_config.h"
+#include "papi_support.h"
+
+/**
+ * Native Linux perf_event_open backend for the hardware counters.
+ *
+ * Used instead of PAPI with --perf (and by default in builds made without PAPI).
+ * It accepts the same PAPI preset names as --papi (PAPI_L1_DCM:PAPI_L2_DCM:PAPI_L3_TCM...)
+ * plus raw codes in the perf tool syntax (e.g. r3f24) and the SW_* software events.
+ *
+ * Each : separated subset becomes one perf group (scheduled onto the PMU together) and is
+ * opened once per OpenMP thread, so the work done by the worker threads is counted too.
+ * Values are scaled by time_enabled / time_running in case the kernel had to multiplex them.
+ * With --multiplex all the groups are enabled together in a single run and the kernel
+ * rotates them over the counters; time_running / time_enabled is kept as the confidence.
+ *
+ * --thread-counters keeps the per-thread values for a breakdown table and imbalance metrics,
+ * and the kernels mark their phases (phase_begin / phase_end) so the first event set is also
+ * read around each phase on each thread.
+ *
+ * In containers and VMs without a PMU the hardware events fall back to the closest
+ * software event where there is one (cycles -> cpu-clock etc.), reported under the name of
+ * the software event since they count nanoseconds, and are otherwise reported as failed
+ * rather than stopping the run.
+ */
+
+#define MAX_PERF_THREADS 128
+#define MAX_PERF_FDS 32        // per thread per event set - derived events use one fd per term
+#define MAX_PERF_EVENT_SETS 16 // one per ! separated subset
+#define MAX_PERF_TERMS 4
+
+// failed_codes value for an event counted with its software fallback rather than the PMU
+#define PERF_FALLBACK 1
+
+#ifndef __linux__
+// keep the tables compiling on mac os, where every event will simply fail to open
+#define PERF_TYPE_HARDWARE 0
+#define PERF_TYPE_SOFTWARE 1
+#define PERF_TYPE_HW_CACHE 3
+#define PERF_TYPE_RAW 4
+enum { PERF_COUNT_HW_CPU_CYCLES = 0, PERF_COUNT_HW_INSTRUCTIONS = 1, PERF_COUNT_HW_CACHE_REFERENCES = 2,
+       PERF_COUNT_HW_CACHE_MISSES = 3, PERF_COUNT_HW_BRANCH_INSTRUCTIONS = 4, PERF_COUNT_HW_BRANCH_MISSES = 5,
+       PERF_COUNT_HW_STALLED_CYCLES_FRONTEND = 7, PERF_COUNT_HW_REF_CPU_CYCLES = 9 };
+enum { PERF_COUNT_SW_CPU_CLOCK = 0, PERF_COUNT_SW_TASK_CLOCK = 1, PERF_COUNT_SW_PAGE_FAULTS = 2,
+       PERF_COUNT_SW_CONTEXT_SWITCHES = 3, PERF_COUNT_SW_CPU_MIGRATIONS = 4 };
+#endif
+
+#define PERF_NO_TYPE 0xffffffff
+
+// PERF_TYPE_HW_CACHE config is cache id | operation << 8 | result << 16
+#define PERF_CACHE(cache, op, result) ((cache) | ((op) << 8) | ((result) << 16))
+#define PERF_CACHE_READ_MISS(cache) PERF_CACHE(cache, 0, 1) // op read = 0, result miss = 1
+
+// cache ids from linux/perf_event.h
+#define PERF_L1D 0
+#define PERF_L1I 1
+#define PERF_LL 2
+#define PERF_DTLB 3
+#define PERF_ITLB 4
+
+struct perf_term {
+    unsigned type;
+    unsigned long long config;
+    long long weight; // e.g. 4 for each 256 bit packed double instruction in PAPI_DP_OPS
+};
+
+struct perf_event_def {
+    char *name;
+    char *description;
+    unsigned num_terms;
+    struct perf_term terms[MAX_PERF_TERMS];
+    unsigned fallback_type; // software event to use when the PMU refuses the hardware event
+    unsigned long long fallback_config;
+    bool intel_only; // raw encodings for Intel cores (Haswell onwards)
+};
+
+#define PERF_EVENT(name, descr, type, config, fb_type, fb_config) \
+    { name, descr, 1, {{type, config, 1}}, fb_type, fb_config, false }
+#define PERF_INTEL_EVENT(name, descr, config) \
+    { name, descr, 1, {{PERF_TYPE_RAW, config, 1}}, PERF_NO_TYPE, 0, true }
+
+// Intel FP_ARITH_INST_RETIRED (event 0xc7) umasks
+#define INTEL_FP_SCALAR_DOUBLE 0x01c7
+#define INTEL_FP_SCALAR_SINGLE 0x02c7
+#define INTEL_FP_128_DOUBLE 0x04c7
+#define INTEL_FP_256_DOUBLE 0x10c7
+
+// Map of the PAPI preset names we use onto generic perf events (see papi_avail.txt for the PAPI side)
+static struct perf_event_def PERF_EVENT_DEFS[] = {
+        PERF_EVENT("PAPI_L1_DCM", "Level 1 data cache misses",
+                   PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_L1D), PERF_NO_TYPE, 0),
+        PERF_EVENT("PAPI_L1_LDM", "Level 1 load misses",
+                   PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_L1D), PERF_NO_TYPE, 0),
+        PERF_EVENT("PAPI_L1_ICM", "Level 1 instruction cache misses",
+                   PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_L1I), PERF_NO_TYPE, 0),
+        // perf has no generic L2 event, so use L2_RQSTS.MISS
+        PERF_INTEL_EVENT("PAPI_L2_DCM", "Level 2 data cache misses", 0x3f24),
+        PERF_INTEL_EVENT("PAPI_L2_TCM", "Level 2 cache misses", 0x3f24),
+        PERF_INTEL_EVENT("PAPI_L2_TCA", "Level 2 total cache accesses", 0xff24),
+        PERF_EVENT("PAPI_L3_TCM", "Level 3 cache misses",
+                   PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, PERF_NO_TYPE, 0),
+        PERF_EVENT("PAPI_L3_TCA", "Level 3 total cache accesses",
+                   PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, PERF_NO_TYPE, 0),
+        PERF_EVENT("PAPI_L3_DCA", "Level 3 data cache accesses",
+                   PERF_TYPE_HW_CACHE, PERF_CACHE(PERF_LL, 0, 0), PERF_NO_TYPE, 0),
+        PERF_EVENT("PAPI_TLB_DM", "Data translation lookaside buffer misses",
+                   PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_DTLB), PERF_NO_TYPE, 0),
+        PERF_EVENT("PAPI_TLB_IM", "Instruction translation lookaside buffer misses",
+                   PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_ITLB), PERF_NO_TYPE, 0),
+        PERF_EVENT("PAPI_TOT_CYC", "Total cycles",
+                   PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK),
+        PERF_EVENT("PAPI_REF_CYC", "Reference clock cycles",
+                   PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK),
+        PERF_EVENT("PAPI_TOT_INS", "Instructions completed",
+                   PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, PERF_NO_TYPE, 0),
+        PERF_EVENT("PAPI_STL_ICY", "Cycles with no instruction issue",
+                   PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND, PERF_NO_TYPE, 0),
+        PERF_EVENT("PAPI_BR_INS", "Branch instructions",
+                   PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_NO_TYPE, 0),
+        PERF_EVENT("PAPI_BR_MSP", "Conditional branch instructions mispredicted",
+                   PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, PERF_NO_TYPE, 0),
+        // floating point: FP_ARITH_INST_RETIRED, scaled by vector width like PAPI does for DP_OPS
+        { "PAPI_FP_OPS", "Floating point operations", 1,
+          {{PERF_TYPE_RAW, INTEL_FP_SCALAR_DOUBLE | INTEL_FP_SCALAR_SINGLE, 1}}, PERF_NO_TYPE, 0, true },
+        { "PAPI_FP_INS", "Floating point instructions", 1,
+          {{PERF_TYPE_RAW, 0x3fc7, 1}}, PERF_NO_TYPE, 0, true },
+        { "PAPI_DP_OPS", "Floating point operations; scaled double precision vector operations", 3,
+          {{PERF_TYPE_RAW, INTEL_FP_SCALAR_DOUBLE, 1},
+           {PERF_TYPE_RAW, INTEL_FP_128_DOUBLE, 2},
+           {PERF_TYPE_RAW, INTEL_FP_256_DOUBLE, 4}}, PERF_NO_TYPE, 0, true },
+        { "PAPI_VEC_DP", "Double precision vector/SIMD instructions", 2,
+          {{PERF_TYPE_RAW, INTEL_FP_128_DOUBLE, 1},
+           {PERF_TYPE_RAW, INTEL_FP_256_DOUBLE, 1}}, PERF_NO_TYPE, 0, true },
+        // software events are available even without a PMU
+        PERF_EVENT("SW_TASK_CLOCK", "Task clock (ns on cpu)",
+                   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, PERF_NO_TYPE, 0),
+        PERF_EVENT("SW_CPU_CLOCK", "CPU clock (ns)",
+                   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK, PERF_NO_TYPE, 0),
+        PERF_EVENT("SW_PAGE_FAULTS", "Page faults",
+                   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, PERF_NO_TYPE, 0),
+        PERF_EVENT("SW_CONTEXT_SWITCHES", "Context switches",
+                   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_NO_TYPE, 0),
+        PERF_EVENT("SW_CPU_MIGRATIONS", "CPU migrations",
+                   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, PERF_NO_TYPE, 0),
+};
+static unsigned PERF_NUM_EVENT_DEFS = sizeof(PERF_EVENT_DEFS) / sizeof(PERF_EVENT_DEFS[0]);
+
+// raw rNNNN codes from the command line are added after the fixed definitions
+#define MAX_PERF_RAW_EVENTS 32
+static struct perf_event_def perf_raw_defs[MAX_PERF_RAW_EVENTS];
+static unsigned perf_num_raw_defs = 0;
+
+/**
+ * The counters opened for one subset of events, one fd per term per thread.
+ * The first fd of each thread is the group leader.
+ */
+struct perf_event_set {
+    unsigned offset;     // position of the first event of this set in the overall event_codes array
+    unsigned num_events;
+    unsigned num_fds;
+    int num_threads;
+    int event_of_fd[MAX_PERF_FDS];
+    long long weight_of_fd[MAX_PERF_FDS];
+    unsigned type_of_fd[MAX_PERF_FDS];
+    unsigned long long config_of_fd[MAX_PERF_FDS];
+    int fds[MAX_PERF_THREADS][MAX_PERF_FDS];
+};
+
+static struct perf_event_set perf_event_sets[MAX_PERF_EVENT_SETS];
+static int perf_num_event_sets = 0;
+static bool perf_no_pmu = false;
+
+// per-thread values of every event from the last read, for --thread-counters
+static long long perf_thread_results[MAX_PERF_THREADS][MAX_PAPI_CODES];
+
+// the phases are counted with the first event set opened for the run, and only while it is counting
+static int perf_phase_set = -1;
+static bool perf_phases_active = false;
+
+static char *PHASE_NAMES[NUM_PHASES] = { "pack A", "pack B", "micro-kernel", "reduction", "write-back" };
+
+/**
+ * Phase totals for one thread, padded so that neighbouring threads do not share cache lines
+ */
+struct perf_thread_phases {
+    long long start[NUM_PHASES][MAX_PERF_FDS]; // per phase, so a phase can run inside another
+    double start_time[NUM_PHASES];
+    long long values[NUM_PHASES][MAX_PERF_FDS];
+    double seconds[NUM_PHASES];
+    long calls[NUM_PHASES];
+    char padding[64];
+};
+static struct perf_thread_phases perf_phases[MAX_PERF_THREADS];
+
+struct perf_event_def *perf_def(int event_code)
+{
+    if (event_code >= 0 && event_code < (int)PERF_NUM_EVENT_DEFS) {
+        return &PERF_EVENT_DEFS[event_code];
+    }
+    int raw_index = event_code - (int)PERF_NUM_EVENT_DEFS;
+    if (raw_index >= 0 && raw_index < (int)perf_num_raw_defs) {
+        return &perf_raw_defs[raw_index];
+    }
+    return NULL;
+}
+
+char *perf_name(int event_code)
+{
+    struct perf_event_def *def = perf_def(event_code);
+    return def == NULL ? "BAD_NAME" : def->name;
+}
+
+/**
+ * Find the perf code (index into the definitions) for a PAPI preset name, SW_* name or raw rNNNN code
+ *
+ * @return the code or -1 if the name is not known
+ */
+int perf_code(char *event_name)
+{
+    for (unsigned i = 0; i < PERF_NUM_EVENT_DEFS; i++) {
+        if (strcmp(PERF_EVENT_DEFS[i].name, event_name) == 0) {
+            return (int)i;
+        }
+    }
+    for (unsigned i = 0; i < perf_num_raw_defs; i++) {
+        if (strcmp(perf_raw_defs[i].name, event_name) == 0) {
+            return (int)(PERF_NUM_EVENT_DEFS + i);
+        }
+    }
+    char *end = NULL;
+    if (event_name[0] == 'r' && perf_num_raw_defs < MAX_PERF_RAW_EVENTS) {
+        unsigned long long raw_config = strtoull(&event_name[1], &end, 16);
+        if (end != &event_name[1] && *end == '\0') {
+            struct perf_event_def raw = { strdup(event_name), "Raw PMU event", 1,
+                                          {{PERF_TYPE_RAW, raw_config, 1}}, PERF_NO_TYPE, 0, false };
+            perf_raw_defs[perf_num_raw_defs] = raw;
+            return (int)(PERF_NUM_EVENT_DEFS + perf_num_raw_defs++);
+        }
+    }
+    ERROR("Failed to find a perf event for [%s]. Use a PAPI preset name, SW_* or rNNNN", event_name);
+    if (!config->papi_ignore) {
+        exit(1);
+    }
+    return -1;
+}
+
+/**
+ * @return the code of the software event counting the same as the fallback of def, -1 if there is none
+ */
+int perf_fallback_code(struct perf_event_def *def)
+{
+    for (unsigned i = 0; i < PERF_NUM_EVENT_DEFS; i++) {
+        struct perf_event_def *software = &PERF_EVENT_DEFS[i];
+        if (software->num_terms == 1 && software->terms[0].type == def->fallback_type
+            && software->terms[0].config == def->fallback_config) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+bool perf_is_intel()
+{
+    static int is_intel = -1;
+    if (is_intel < 0) {
+        is_intel = 0;
+        FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+        if (cpuinfo != NULL) {
+            char line[256];
+            while (fgets(line, sizeof(line), cpuinfo) != NULL) {
+                if (strncmp(line, "vendor_id", 9) == 0) {
+                    is_intel = strstr(line, "GenuineIntel") != NULL;
+                    break;
+                }
+            }
+            fclose(cpuinfo);
+        }
+    }
+    return is_intel == 1;
+}
+
+#ifdef __linux__
+/**
+ * Open a single counter on the calling thread
+ *
+ * @param group_fd leader of the group or -1 to make this counter the leader
+ * @return the file descriptor or -errno on failure
+ */
+int perf_open(unsigned type, unsigned long long config_value, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config_value;
+    attr.disabled = group_fd == -1 ? 1 : 0; // the members follow the leader
+    attr.exclude_kernel = 1; // user space only like the PAPI default domain (and paranoid level 2)
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+    return fd < 0 ? -errno : fd;
+}
+
+void perf_close(int fd)
+{
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void perf_ioctl_group(int fd, unsigned long request)
+{
+    if (fd >= 0) {
+        ioctl(fd, request, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+/**
+ * Read a counter scaled up for the time it was not scheduled on the PMU
+ *
+ * @param enabled if not null receives the time the counter was enabled (ns)
+ * @param running if not null receives the time the counter was actually counting (ns)
+ */
+long long perf_read_scaled(int fd, unsigned long long *enabled, unsigned long long *running)
+{
+    unsigned long long values[3] = {0, 0, 0}; // value, time_enabled, time_running
+    if (fd < 0 || read(fd, values, sizeof(values)) != sizeof(values)) {
+        return 0;
+    }
+    if (enabled != NULL) *enabled += values[1];
+    if (running != NULL) *running += values[2];
+    if (values[2] == 0) {
+        return 0; // never scheduled
+    }
+    if (values[2] < values[1]) {
+        return (long long)((double)values[0] * (double)values[1] / (double)values[2]);
+    }
+    return (long long)values[0];
+}
+
+/**
+ * Detect whether there is a hardware PMU at all (often not in containers or VMs)
+ */
+void init_perf()
+{
+    int fd = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (fd < 0) {
+        perf_no_pmu = true;
+        INFO("perf: no hardware PMU available (%s): hardware events will fall back to software events",
+             strerror(-fd));
+    }
+    else {
+        perf_close(fd);
+        INFO("perf_event_open backend initialized with hardware PMU");
+    }
+}
+#else
+int perf_open(unsigned type, unsigned long long config_value, int group_fd) { return -ENOSYS; }
+void perf_close(int fd) {}
+void perf_ioctl_group(int fd, unsigned long request) {}
+long long perf_read_scaled(int fd, unsigned long long *enabled, unsigned long long *running) { return 0; }
+void init_perf()
+{
+    perf_no_pmu = true;
+    INFO("perf_event_open is only available on Linux: all perf events will be reported as failed");
+}
+#define PERF_EVENT_IOC_ENABLE 0
+#define PERF_EVENT_IOC_DISABLE 0
+#define PERF_EVENT_IOC_RESET 0
+#endif
+
+/**
+ * Choose the counters for each event on the calling thread, falling back to software events
+ * where the hardware one cannot be opened, and record which fds make up each event.
+ */
+void perf_resolve_event_set(struct perf_event_set *set, int *event_codes, int *failed_codes)
+{
+    int leader = -1;
+    int probe_fds[MAX_PERF_FDS];
+    set->num_fds = 0;
+    for (unsigned i = 0; i < set->num_events; i++) {
+        unsigned pos = set->offset + i;
+        struct perf_event_def *def = perf_def(event_codes[pos]);
+        failed_codes[pos] = 0;
+        if (def == NULL) {
+            failed_codes[pos] = -EINVAL;
+            continue;
+        }
+        if (def->intel_only && !perf_is_intel()) {
+            failed_codes[pos] = -EOPNOTSUPP;
+        }
+        unsigned first_fd = set->num_fds;
+        for (unsigned t = 0; failed_codes[pos] == 0 && t < def->num_terms; t++) {
+            if (set->num_fds >= MAX_PERF_FDS) {
+                failed_codes[pos] = -E2BIG;
+                break;
+            }
+            int fd = perf_open(def->terms[t].type, def->terms[t].config, leader);
+            if (fd < 0) {
+                failed_codes[pos] = fd;
+                break;
+            }
+            if (leader < 0) leader = fd;
+            probe_fds[set->num_fds] = fd;
+            set->event_of_fd[set->num_fds] = (int)i;
+            set->weight_of_fd[set->num_fds] = def->terms[t].weight;
+            set->type_of_fd[set->num_fds] = def->terms[t].type;
+            set->config_of_fd[set->num_fds] = def->terms[t].config;
+            set->num_fds++;
+        }
+        if (failed_codes[pos] != 0) {
+            // drop any terms of a partially opened derived event
+            for (unsigned f = first_fd; f < set->num_fds; f++) {
+                perf_close(probe_fds[f]);
+            }
+            if (first_fd == 0) {
+                leader = -1;
+            }
+            set->num_fds = first_fd;
+            if (def->fallback_type != PERF_NO_TYPE && set->num_fds < MAX_PERF_FDS) {
+                int fd = perf_open(def->fallback_type, def->fallback_config, leader);
+                int fallback_code = perf_fallback_code(def);
+                if (fd >= 0 && fallback_code >= 0) {
+                    INFO("perf: counting %s with its software fallback %s (%s)", def->name,
+                         perf_name(fallback_code), strerror(-failed_codes[pos]));
+                    event_codes[pos] = fallback_code; // so the columns say what was counted
+                    failed_codes[pos] = PERF_FALLBACK;
+                    if (leader < 0) leader = fd;
+                    probe_fds[set->num_fds] = fd;
+                    set->event_of_fd[set->num_fds] = (int)i;
+                    set->weight_of_fd[set->num_fds] = 1;
+                    set->type_of_fd[set->num_fds] = def->fallback_type;
+                    set->config_of_fd[set->num_fds] = def->fallback_config;
+                    set->num_fds++;
+                }
+            }
+        }
+        if (failed_codes[pos] < 0) {
+            INFO("WARNING: Skipping perf event %s! Failed to open the %uth event: %s",
+                 def->name, pos, strerror(-failed_codes[pos]));
+        }
+    }
+    // the probes were opened on this thread, so keep them as this thread's counters
+    for (unsigned f = 0; f < set->num_fds; f++) {
+        set->fds[omp_get_thread_num()][f] = probe_fds[f];
+    }
+}
+
+/**
+ * Open the counters described by the set on the calling thread (same layout as the resolved set)
+ */
+void perf_open_thread_counters(struct perf_event_set *set, int thread)
+{
+    int leader = -1;
+    for (unsigned f = 0; f < set->num_fds; f++) {
+        int fd = perf_open(set->type_of_fd[f], set->config_of_fd[f], leader);
+        if (fd < 0) {
+            DEBUG("perf: thread %d failed to open counter %u: %s", thread, f, strerror(-fd));
+        }
+        if (f == 0) leader = fd;
+        set->fds[thread][f] = fd;
+    }
+}
+
+/**
+ * Opens the perf counters for a subset of the events on every OpenMP thread and returns a handle to them
+ *
+ * @param offset offset into the total event_code array
+ * @param num_events number of event codes to add
+ * @param event_codes array of perf event codes (see perf_code)
+ * @param failed_codes array to which we add the -errno of any failures per event (PERF_FALLBACK if substituted)
+ * @return handle for start_perf and stop_perf
+ */
+int init_perf_events(unsigned offset, unsigned num_events, int *event_codes, int *failed_codes)
+{
+    if (perf_num_event_sets >= MAX_PERF_EVENT_SETS) {
+        ERROR("Too many perf event subsets (max %d)", MAX_PERF_EVENT_SETS);
+        exit(1);
+    }
+    int event_set = perf_num_event_sets++;
+    if (perf_phase_set < 0) {
+        perf_phase_set = event_set;
+    }
+    struct perf_event_set *set = &perf_event_sets[event_set];
+    set->offset = offset;
+    set->num_events = num_events;
+    set->num_threads = MIN(omp_get_max_threads(), MAX_PERF_THREADS);
+
+    // open on every thread of the team that the kernels will use (libgomp keeps the same threads)
+#pragma omp parallel num_threads(set->num_threads)
+    {
+        int thread = omp_get_thread_num();
+#pragma omp master
+        perf_resolve_event_set(set, event_codes, failed_codes);
+#pragma omp barrier
+        if (thread != 0) {
+            perf_open_thread_counters(set, thread);
+        }
+    }
+    VERBOSE("perf opened %u counters for %u events on %d threads", set->num_fds, num_events, set->num_threads);
+    return event_set;
+}
+
+long long get_perf_time()
+{
+    return (long long)(omp_get_wtime() * 1000000);
+}
+
+long long start_perf(int event_set)
+{
+    struct perf_event_set *set = &perf_event_sets[event_set];
+    long long start_marker = get_perf_time();
+    for (int t = 0; t < set->num_threads && set->num_fds > 0; t++) {
+        perf_ioctl_group(set->fds[t][0], PERF_EVENT_IOC_RESET);
+        perf_ioctl_group(set->fds[t][0], PERF_EVENT_IOC_ENABLE);
+    }
+    if (event_set == perf_phase_set) {
+        perf_phases_active = true;
+    }
+    return start_marker;
+}
+
+void disable_perf(int event_set)
+{
+    struct perf_event_set *set = &perf_event_sets[event_set];
+    for (int t = 0; t < set->num_threads && set->num_fds > 0; t++) {
+        perf_ioctl_group(set->fds[t][0], PERF_EVENT_IOC_DISABLE);
+    }
+    if (event_set == perf_phase_set) {
+        perf_phases_active = false;
+    }
+}
+
+/**
+ * Sum the (stopped) counters over the threads into the results for this set and record
+ * the fraction of the enabled time that each event was really on the PMU in counter_confidence
+ */
+void read_perf(int event_set, unsigned offset, long long *all_event_results)
+{
+    struct perf_event_set *set = &perf_event_sets[event_set];
+    unsigned long long enabled[MAX_PAPI_CODES];
+    unsigned long long running[MAX_PAPI_CODES];
+    long long *event_results = &all_event_results[offset];
+    for (unsigned i = 0; i < set->num_events; i++) {
+        event_results[i] = 0;
+        enabled[i] = running[i] = 0;
+    }
+    for (int t = 0; t < set->num_threads; t++) {
+        for (unsigned i = 0; i < set->num_events; i++) {
+            perf_thread_results[t][offset + i] = 0;
+        }
+        for (unsigned f = 0; f < set->num_fds; f++) {
+            int event = set->event_of_fd[f];
+            long long value = perf_read_scaled(set->fds[t][f], &enabled[event], &running[event]);
+            event_results[event] += value * set->weight_of_fd[f];
+            perf_thread_results[t][offset + event] += value * set->weight_of_fd[f];
+        }
+    }
+    for (unsigned i = 0; i < set->num_events; i++) {
+        counter_confidence[offset + i] = enabled[i] == 0 ? 0 : (double)running[i] / (double)enabled[i];
+    }
+}
+
+/**
+ * Stop the counters and sum them over the threads into the results for this set
+ */
+long long stop_perf(int event_set, unsigned offset, long long *all_event_results)
+{
+    disable_perf(event_set);
+    long long stop_marker = get_perf_time();
+    read_perf(event_set, offset, all_event_results);
+    return stop_marker;
+}
+
+/**
+ * Start every event set together, so the kernel multiplexes all the groups over a single run
+ */
+long long start_perf_multiplexed()
+{
+    long long start_marker = get_perf_time();
+    for (int s = 0; s < perf_num_event_sets; s++) {
+        start_perf(s);
+    }
+    return start_marker;
+}
+
+long long stop_perf_multiplexed(long long *all_event_results)
+{
+    for (int s = 0; s < perf_num_event_sets; s++) {
+        disable_perf(s);
+    }
+    long long stop_marker = get_perf_time();
+    for (int s = 0; s < perf_num_event_sets; s++) {
+        read_perf(s, perf_event_sets[s].offset, all_event_results);
+    }
+    return stop_marker;
+}
+
+/**
+ * Close the counters of every event set and forget the per-thread and per-phase values, so the
+ * next run (another --compare implementation) opens its sets from the first one again
+ */
+void release_perf_events()
+{
+    for (int s = 0; s < perf_num_event_sets; s++) {
+        struct perf_event_set *set = &perf_event_sets[s];
+        for (int t = 0; t < set->num_threads; t++) {
+            for (unsigned f = 0; f < set->num_fds; f++) {
+                perf_close(set->fds[t][f]);
+            }
+        }
+    }
+    perf_num_event_sets = 0;
+    perf_phase_set = -1;
+    perf_phases_active = false;
+    memset(perf_phases, 0, sizeof(perf_phases));
+    memset(perf_thread_results, 0, sizeof(perf_thread_results));
+}
+
+/**
+ * Mark the start of a kernel phase on the calling thread. The counters of the phase event set
+ * are read, so this costs a read() per counter: the kernels only call it once per tile.
+ */
+void phase_begin(enum counter_phase phase)
+{
+    if (!config->thread_counters || !perf_phases_active) return;
+    int thread = omp_get_thread_num();
+    if (thread >= MAX_PERF_THREADS) return;
+    struct perf_thread_phases *phases = &perf_phases[thread];
+    struct perf_event_set *set = &perf_event_sets[perf_phase_set];
+    for (unsigned f = 0; f < set->num_fds; f++) {
+        phases->start[phase][f] = perf_read_scaled(set->fds[thread][f], NULL, NULL);
+    }
+    phases->start_time[phase] = omp_get_wtime();
+}
+
+void phase_end(enum counter_phase phase)
+{
+    if (!config->thread_counters || !perf_phases_active) return;
+    int thread = omp_get_thread_num();
+    if (thread >= MAX_PERF_THREADS) return;
+    struct perf_thread_phases *phases = &perf_phases[thread];
+    phases->seconds[phase] += omp_get_wtime() - phases->start_time[phase];
+    phases->calls[phase]++;
+    struct perf_event_set *set = &perf_event_sets[perf_phase_set];
+    for (unsigned f = 0; f < set->num_fds; f++) {
+        phases->values[phase][f] += perf_read_scaled(set->fds[thread][f], NULL, NULL) - phases->start[phase][f];
+    }
+}
+
+/**
+ * Load imbalance of an event over the threads: max / mean (1.0 = perfectly balanced)
+ */
+double thread_imbalance(unsigned event, int num_threads)
+{
+    long long max = 0;
+    double sum = 0;
+    for (int t = 0; t < num_threads; t++) {
+        max = MAX(max, perf_thread_results[t][event]);
+        sum += (double)perf_thread_results[t][event];
+    }
+    return sum == 0 ? 0 : (double)max / (sum / num_threads);
+}
+
+int perf_num_threads()
+{
+    return perf_phase_set >= 0 ? perf_event_sets[perf_phase_set].num_threads : 0;
+}
+
+/**
+ * Print the per-thread breakdown, the imbalance of each event and the per-phase totals
+ */
+void describe_thread_counters(size_t num_events, int event_codes[num_events])
+{
+    int num_threads = perf_num_threads();
+    printf("\nPer-thread counters (%d threads)\n", num_threads);
+    printf("%-8s", "thread");
+    for (size_t i = 0; i < num_events; i++) {
+        printf(" %16s", perf_name(event_codes[i]));
+    }
+    printf(" %12s\n", "kernel s");
+    for (int t = 0; t < num_threads; t++) {
+        printf("%-8d", t);
+        for (size_t i = 0; i < num_events; i++) {
+            printf(" %16lld", perf_thread_results[t][i]);
+        }
+        printf(" %12.4f\n", perf_phases[t].seconds[PHASE_KERNEL]);
+    }
+
+    printf("\nImbalance over threads\n");
+    printf("%-20s %10s %16s %16s %16s\n", "event", "max/mean", "min", "max", "(max-min)/mean");
+    for (size_t i = 0; i < num_events; i++) {
+        long long min = perf_thread_results[0][i];
+        long long max = perf_thread_results[0][i];
+        double sum = 0;
+        for (int t = 0; t < num_threads; t++) {
+            min = MIN(min, perf_thread_results[t][i]);
+            max = MAX(max, perf_thread_results[t][i]);
+            sum += (double)perf_thread_results[t][i];
+        }
+        double mean = num_threads > 0 ? sum / num_threads : 0;
+        printf("%-20s %10.3f %16lld %16lld %16.3f\n", perf_name(event_codes[i]),
+               thread_imbalance(i, num_threads), min, max, mean == 0 ? 0 : (double)(max - min) / mean);
+    }
+    double kernel_max = 0, kernel_sum = 0;
+    for (int t = 0; t < num_threads; t++) {
+        kernel_max = MAX(kernel_max, perf_phases[t].seconds[PHASE_KERNEL]);
+        kernel_sum += perf_phases[t].seconds[PHASE_KERNEL];
+    }
+    if (kernel_sum > 0) {
+        printf("%-20s %10.3f\n", "kernel time", kernel_max / (kernel_sum / num_threads));
+    }
+
+    // phases are counted with the first event set of the run only
+    if (perf_phase_set < 0) {
+        return;
+    }
+    struct perf_event_set *set = &perf_event_sets[perf_phase_set];
+    printf("\nPer-phase counters (all threads)\n");
+    printf("%-14s %10s %12s", "phase", "calls", "seconds");
+    for (unsigned i = 0; i < set->num_events; i++) {
+        printf(" %16s", perf_name(event_codes[set->offset + i]));
+    }
+    printf("\n");
+    for (int phase = 0; phase < NUM_PHASES; phase++) {
+        long calls = 0;
+        double seconds = 0;
+        long long values[MAX_PAPI_CODES];
+        for (unsigned i = 0; i < set->num_events; i++) {
+            values[i] = 0;
+        }
+        for (int t = 0; t < num_threads; t++) {
+            calls += perf_phases[t].calls[phase];
+            seconds += perf_phases[t].seconds[phase];
+            for (unsigned f = 0; f < set->num_fds; f++) {
+                values[set->event_of_fd[f]] += perf_phases[t].values[phase][f] * set->weight_of_fd[f];
+            }
+        }
+        if (calls == 0) continue; // this kernel has no such phase
+        printf("%-14s %10ld %12.4f", PHASE_NAMES[phase], calls, seconds);
+        for (unsigned i = 0; i < set->num_events; i++) {
+            printf(" %16lld", values[i]);
+        }
+        printf("\n");
+    }
+}
+
+void describe_perf_event(int event_code, long long event_value, int error, double confidence)
+{
+    struct perf_event_def *def = perf_def(event_code);
+    char *description = def == NULL ? "" : def->description;
+    char *code_name = perf_name(event_code);
+    if (error < 0) {
+        printf("perf counter [ %12s ] %-35s = %lld [WARN: OPEN FAILURE! %s]\n",
+               code_name, description, event_value, strerror(-error));
+    }
+    else if (error == PERF_FALLBACK) {
+        printf("perf counter [ %12s ] %-35s = %lld [software fallback for a hardware event: no PMU]\n",
+               code_name, description, event_value);
+    }
+    else if (config->multiplex && confidence < 1.0) {
+        printf("perf counter [ %12s ] %-35s = %lld [multiplexed: counted %.1f%% of the time, scaled]\n",
+               code_name, description, event_value, confidence * 100);
+    }
+    else {
+        printf("perf counter [ %12s ] %-35s = %lld\n", code_name, description, event_value);
+    }
+}
+
+// output events in long form to the terminal
+void describe_perf_events(size_t num_events, int event_codes[num_events],
+                          long long event_values[num_events], int failed_codes[num_events])
+{
+    printf("\n");
+    for (size_t i = 0; i < num_events; i++) {
+        describe_perf_event(event_codes[i], event_values[i], failed_codes[i], counter_confidence[i]);
+    }
+}
+
+// print the event names in a csv line
+void print_perf_headers(FILE *out, size_t num_events, int event_codes[num_events])
+{
+    if (num_events == 0) {
+        // just to have something after the comma
+        fprintf(out, "no-papi");
+    }
+    for (size_t i = 0; i < num_events; i++) {
+        fprintf(out, i > 0 ? ",%s" : "%s", perf_name(event_codes[i]));
+    }
+}
+
+#endif
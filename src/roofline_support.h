@@ -0,0 +1,206 @@
+#ifndef ROOFLINE_SUPPORT_LOCAL
+#define ROOFLINE_SUPPORT_LOCAL
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <omp.h>
+#include <immintrin.h>
+
+#include "matrix_config.h"
+
+/**
+ * Roofline report for --roofline
+ *
+ * Measures the machine peaks with two small micro-benchmarks on all the OpenMP threads:
+ *  - FMA throughput: independent chains of fused multiply-adds at the widest vector width
+ *    the compiler was allowed (-march=native), so no chain waits on the FMA latency
+ *  - memory bandwidth: a STREAM triad a[i] = b[i] + s * c[i] over arrays well beyond L3
+ *
+ * and places the run on the roofline: arithmetic intensity (FLOPs per byte of DRAM traffic),
+ * achieved fraction of the peak and of the roof at that intensity, and compute or memory bound.
+ *
+ * The DRAM traffic comes from PAPI_L3_TCM * 64 bytes when that counter was collected,
+ * otherwise from a model of the tile traffic of the blocked kernels.
+ */
+
+#define ROOFLINE_FMA_CHAINS 12 // > FMA latency x FMA ports, so the chains never stall
+#define ROOFLINE_FMA_LOOPS 4000000
+#define ROOFLINE_STREAM_BYTES ((size_t)4 * L3_CACHE_MIB * 1024 * 1024) // per array, STREAM rule: 4x the caches
+#define ROOFLINE_STREAM_TRIALS 5
+#define CACHE_LINE_BYTES 64
+
+/**
+ * @return FLOPs performed by one thread of the FMA benchmark
+ */
+double roofline_fma_thread()
+{
+    double flops;
+#if defined(__AVX512F__)
+    __m512d acc[ROOFLINE_FMA_CHAINS];
+    __m512d mul = _mm512_set1_pd(0.999999);
+    __m512d add = _mm512_set1_pd(0.000001);
+    for (int c = 0; c < ROOFLINE_FMA_CHAINS; c++) acc[c] = _mm512_set1_pd(c);
+    for (long i = 0; i < ROOFLINE_FMA_LOOPS; i++) {
+        for (int c = 0; c < ROOFLINE_FMA_CHAINS; c++) acc[c] = _mm512_fmadd_pd(acc[c], mul, add);
+    }
+    double sum = 0;
+    for (int c = 0; c < ROOFLINE_FMA_CHAINS; c++) sum += _mm512_reduce_add_pd(acc[c]);
+    flops = 2.0 * 8 * ROOFLINE_FMA_CHAINS * ROOFLINE_FMA_LOOPS;
+#elif defined(__FMA__)
+    __m256d acc[ROOFLINE_FMA_CHAINS];
+    __m256d mul = _mm256_set1_pd(0.999999);
+    __m256d add = _mm256_set1_pd(0.000001);
+    for (int c = 0; c < ROOFLINE_FMA_CHAINS; c++) acc[c] = _mm256_set1_pd(c);
+    for (long i = 0; i < ROOFLINE_FMA_LOOPS; i++) {
+        for (int c = 0; c < ROOFLINE_FMA_CHAINS; c++) acc[c] = _mm256_fmadd_pd(acc[c], mul, add);
+    }
+    double sum = 0;
+    for (int c = 0; c < ROOFLINE_FMA_CHAINS; c++) {
+        double lanes[4];
+        _mm256_storeu_pd(lanes, acc[c]);
+        sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    flops = 2.0 * 4 * ROOFLINE_FMA_CHAINS * ROOFLINE_FMA_LOOPS;
+#else
+    double acc[ROOFLINE_FMA_CHAINS];
+    for (int c = 0; c < ROOFLINE_FMA_CHAINS; c++) acc[c] = c;
+    for (long i = 0; i < ROOFLINE_FMA_LOOPS; i++) {
+        for (int c = 0; c < ROOFLINE_FMA_CHAINS; c++) acc[c] = fma(acc[c], 0.999999, 0.000001);
+    }
+    double sum = 0;
+    for (int c = 0; c < ROOFLINE_FMA_CHAINS; c++) sum += acc[c];
+    flops = 2.0 * ROOFLINE_FMA_CHAINS * ROOFLINE_FMA_LOOPS;
+#endif
+    if (sum == 42.0) printf(" "); // keep the result alive so the loop is not optimized away
+    return flops;
+}
+
+/**
+ * Peak floating point throughput of all the threads, in FLOP/s
+ */
+double measure_peak_flops()
+{
+    double flops = 0;
+    double start = omp_get_wtime();
+#pragma omp parallel reduction(+:flops)
+    flops += roofline_fma_thread();
+    double seconds = omp_get_wtime() - start;
+    return flops / seconds;
+}
+
+/**
+ * Sustainable memory bandwidth of all the threads (STREAM triad, best of several trials), in bytes/s
+ */
+double measure_peak_bandwidth()
+{
+    size_t length = ROOFLINE_STREAM_BYTES / sizeof(double);
+    double *a = malloc(ROOFLINE_STREAM_BYTES);
+    double *b = malloc(ROOFLINE_STREAM_BYTES);
+    double *c = malloc(ROOFLINE_STREAM_BYTES);
+    if (a == NULL || b == NULL || c == NULL) {
+        ERROR("Could not allocate the STREAM arrays for the roofline");
+        free(a); free(b); free(c);
+        return 0;
+    }
+    // first touch on the threads that will use each part of the arrays
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < length; i++) {
+        a[i] = 0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+    double best = 0;
+    for (int trial = 0; trial < ROOFLINE_STREAM_TRIALS; trial++) {
+        double start = omp_get_wtime();
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < length; i++) {
+            a[i] = b[i] + 3.0 * c[i];
+        }
+        double seconds = omp_get_wtime() - start;
+        best = MAX(best, 3.0 * ROOFLINE_STREAM_BYTES / seconds); // 2 reads + 1 write, as STREAM counts
+    }
+    if (a[length / 2] != 7.0) {
+        ERROR("STREAM triad validation failed");
+    }
+    free(a); free(b); free(c);
+    return best;
+}
+
+/**
+ * Model of the DRAM traffic when no L3 miss counter was collected.
+ *
+ * Blocked kernels move an A and a B tile for every tile product, (N/b)^3 products of 2 b^2 doubles,
+ * plus C in and out once; the unblocked loops reload a row or column for every inner product.
+ */
+double model_traffic_bytes(int block_size)
+{
+    double n = N;
+    if (block_size > 0) {
+        return sizeof(double) * (2.0 * n * n * n / block_size + 2.0 * n * n);
+    }
+    return sizeof(double) * (n * n * n + 3.0 * n * n);
+}
+
+/**
+ * Measure the machine peaks, once before the runs: they do not depend on the implementation
+ */
+struct roofline measure_roofline_peaks()
+{
+    struct roofline peaks = {0};
+    INFO("Measuring peak FMA throughput and STREAM bandwidth for the roofline");
+    peaks.peak_flops = measure_peak_flops();
+    peaks.peak_bytes = measure_peak_bandwidth();
+    peaks.ridge = peaks.peak_bytes > 0 ? peaks.peak_flops / peaks.peak_bytes : 0;
+    return peaks;
+}
+
+/**
+ * Place the run on the roofline of the machine peaks
+ *
+ * @param peaks from measure_roofline_peaks
+ * @param l3_misses PAPI_L3_TCM for the run or -1 if it was not collected
+ */
+void place_roofline(struct metrics *metrics, struct roofline *peaks, long long l3_misses)
+{
+    struct roofline roofline = *peaks;
+    roofline.traffic_measured = l3_misses > 0;
+    if (roofline.traffic_measured) {
+        roofline.traffic_bytes = (double)l3_misses * CACHE_LINE_BYTES;
+    }
+    else if (metrics->a_rows > 0 || metrics->b_cols > 0) {
+        roofline.traffic_bytes = general_bytes(); // the GEMV-like shapes stream their operands once
+    }
+    else {
+        roofline.traffic_bytes = model_traffic_bytes(metrics->block_size);
+    }
+    double flops = classical_flops(metrics);
+    roofline.arithmetic_intensity = flops / roofline.traffic_bytes;
+    double seconds = (double)metrics->total_micro_seconds / 1000000.0;
+    roofline.achieved_flops = seconds > 0 ? flops / seconds : 0;
+
+    double attainable = MIN(roofline.peak_flops, roofline.arithmetic_intensity * roofline.peak_bytes);
+    roofline.peak_fraction = roofline.peak_flops > 0 ? roofline.achieved_flops / roofline.peak_flops : 0;
+    roofline.roof_fraction = attainable > 0 ? roofline.achieved_flops / attainable : 0;
+    roofline.memory_bound = roofline.arithmetic_intensity < roofline.ridge;
+    metrics->roofline = roofline;
+}
+
+void describe_roofline(struct roofline *roofline)
+{
+    printf("\nRoofline\n");
+    printf("Peak FMA throughput  : %.2f GFLOP/s\n", roofline->peak_flops / 1e9);
+    printf("Peak bandwidth       : %.2f GB/s (STREAM triad)\n", roofline->peak_bytes / 1e9);
+    printf("Ridge point          : %.2f FLOPs/byte\n", roofline->ridge);
+    printf("DRAM traffic         : %.3f GB (%s)\n", roofline->traffic_bytes / 1e9,
+           roofline->traffic_measured ? "measured from PAPI_L3_TCM" : "traffic model");
+    printf("Arithmetic intensity : %.2f FLOPs/byte\n", roofline->arithmetic_intensity);
+    printf("Achieved             : %.2f GFLOP/s (classical FLOPs)\n", roofline->achieved_flops / 1e9);
+    printf("Fraction of peak     : %.1f%%\n", roofline->peak_fraction * 100);
+    printf("Fraction of roof     : %.1f%% of %.2f GFLOP/s attainable at this intensity\n",
+           roofline->roof_fraction * 100,
+           MIN(roofline->peak_flops, roofline->arithmetic_intensity * roofline->peak_bytes) / 1e9);
+    printf("Bound                : %s\n", roofline->memory_bound ? "memory" : "compute");
+}
+
+#endif
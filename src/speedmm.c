@@ -0,0 +1,363 @@
+#include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_epilogue.h"
+#include "matrix_plan.h"
+#include "speedmm.h"
+
+/*
+ * The libspeedmm API (speedmm.h) over the engine of the executables.
+ *
+ * A context owns a config like the one the driver makes from the command line, quiet, and each call
+ * points the global config at it for its duration. speedmm_multiply passes alpha and beta to the
+ * implementation as gemm_epilogue, the way the driver passes --alpha and --beta; the plans are the
+ * ones of --plan (matrix_plan.c).
+ */
+
+#define DEFAULT_LIBRARY_BLOCK_SIZE 64
+
+struct speedmm_context {
+    struct config config;
+    const struct implementation *implementation;
+    int threads; // 0 for the OpenMP default
+};
+
+struct speedmm_matrix {
+    double *data;
+    size_t rows;
+    size_t cols;
+    size_t ld;
+    bool owned;
+};
+
+// a copy of the config of the context, so that the plan outlives it
+struct speedmm_plan {
+    struct config config;
+    struct gemm_plan *plan;
+};
+
+/**
+ * Point the global config at the one of a context or a plan for a call
+ *
+ * @return the config to restore with leave_context
+ */
+static struct config *enter_config(struct config *settings)
+{
+    struct config *previous = config;
+    config = settings;
+    return previous;
+}
+
+static struct config *enter_context(speedmm_context *context)
+{
+    return enter_config(&context->config);
+}
+
+static void leave_context(struct config *previous)
+{
+    config = previous;
+}
+
+static int context_threads(const speedmm_context *context)
+{
+    return context->threads > 0 ? context->threads : omp_get_max_threads();
+}
+
+int speedmm_version(void)
+{
+    return SPEEDMM_VERSION;
+}
+
+const char *speedmm_status_name(int status)
+{
+    switch (status) {
+        case SPEEDMM_OK: return "ok";
+        case SPEEDMM_INVALID: return "invalid argument";
+        case SPEEDMM_NO_MEMORY: return "out of memory";
+        case SPEEDMM_FAILED: return "failed";
+        default: return "unknown status";
+    }
+}
+
+size_t speedmm_square_size(void)
+{
+    return N;
+}
+
+int speedmm_implementation_count(void)
+{
+    int count;
+    implementations(&count);
+    return count;
+}
+
+const char *speedmm_implementation_name(int index)
+{
+    int count;
+    const struct implementation *registry = implementations(&count);
+    return index >= 0 && index < count ? registry[index].name : NULL;
+}
+
+const char *speedmm_implementation_description(int index)
+{
+    int count;
+    const struct implementation *registry = implementations(&count);
+    return index >= 0 && index < count ? registry[index].description : NULL;
+}
+
+speedmm_context *speedmm_context_create(const char *implementation)
+{
+    const struct implementation *found = find_implementation(implementation != NULL ? implementation : "block");
+    if (found == NULL) {
+        return NULL;
+    }
+    speedmm_context *context = calloc(1, sizeof(speedmm_context));
+    if (context == NULL) {
+        return NULL;
+    }
+    context->config = new_config();
+    context->config.quiet = true;
+    context->config.silent = true;
+    context->config.sparse = SPARSE_DENSE;
+    context->config.block_size = DEFAULT_LIBRARY_BLOCK_SIZE;
+    context->implementation = found;
+    if (found->prepare != NULL) {
+        // once per process, so the products on the context do not pay for it
+        struct config *previous = enter_context(context);
+        found->prepare();
+        leave_context(previous);
+    }
+    return context;
+}
+
+int speedmm_context_set_threads(speedmm_context *context, int threads)
+{
+    if (context == NULL || threads < 0) {
+        return SPEEDMM_INVALID;
+    }
+    context->threads = threads;
+    return SPEEDMM_OK;
+}
+
+int speedmm_context_set_block_size(speedmm_context *context, int block_size)
+{
+    if (context == NULL || block_size < 1) {
+        return SPEEDMM_INVALID;
+    }
+    context->config.block_size = block_size;
+    return SPEEDMM_OK;
+}
+
+void speedmm_context_destroy(speedmm_context *context)
+{
+    free(context);
+}
+
+speedmm_matrix *speedmm_matrix_create(size_t rows, size_t cols)
+{
+    if (rows == 0 || cols == 0) {
+        return NULL;
+    }
+    speedmm_matrix *matrix = malloc(sizeof(speedmm_matrix));
+    double *data = malloc(rows * cols * sizeof(double));
+    if (matrix == NULL || data == NULL) {
+        free(matrix);
+        free(data);
+        return NULL;
+    }
+    speedmm_matrix created = { data, rows, cols, cols, true };
+    *matrix = created;
+    return matrix;
+}
+
+speedmm_matrix *speedmm_matrix_wrap(double *data, size_t rows, size_t cols, size_t ld)
+{
+    if (data == NULL || rows == 0 || cols == 0 || ld < cols) {
+        return NULL;
+    }
+    speedmm_matrix *matrix = malloc(sizeof(speedmm_matrix));
+    if (matrix == NULL) {
+        return NULL;
+    }
+    speedmm_matrix wrapped = { data, rows, cols, ld, false };
+    *matrix = wrapped;
+    return matrix;
+}
+
+double *speedmm_matrix_data(speedmm_matrix *matrix)
+{
+    return matrix != NULL ? matrix->data : NULL;
+}
+
+size_t speedmm_matrix_rows(const speedmm_matrix *matrix)
+{
+    return matrix != NULL ? matrix->rows : 0;
+}
+
+size_t speedmm_matrix_cols(const speedmm_matrix *matrix)
+{
+    return matrix != NULL ? matrix->cols : 0;
+}
+
+size_t speedmm_matrix_ld(const speedmm_matrix *matrix)
+{
+    return matrix != NULL ? matrix->ld : 0;
+}
+
+void speedmm_matrix_destroy(speedmm_matrix *matrix)
+{
+    if (matrix != NULL && matrix->owned) {
+        free(matrix->data);
+    }
+    free(matrix);
+}
+
+static bool square_matrix(const speedmm_matrix *matrix)
+{
+    return matrix != NULL && matrix->rows == N && matrix->cols == N && matrix->ld == N;
+}
+
+static bool has_shape(const speedmm_matrix *matrix, size_t rows, size_t cols)
+{
+    return matrix != NULL && matrix->rows == rows && matrix->cols == cols;
+}
+
+static struct tile_matrix matrix_view(const speedmm_matrix *matrix)
+{
+    struct tile_matrix view = { matrix->data, matrix->ld, 1 };
+    return view;
+}
+
+/**
+ * C = alpha A . B + beta C with the implementation of the context, on N x N contiguous matrices
+ *
+ * The implementations that multiply by B^T (the blocked ones) get a transposed copy of B.
+ */
+int speedmm_multiply(speedmm_context *context, double alpha, const speedmm_matrix *a, const speedmm_matrix *b,
+                     double beta, speedmm_matrix *c)
+{
+    if (context == NULL || alpha == 0 || !square_matrix(a) || !square_matrix(b) || !square_matrix(c)) {
+        return SPEEDMM_INVALID;
+    }
+    double (*matrix2)[N] = (double (*)[N])b->data;
+    if (context->implementation->transposed_b) {
+        matrix2 = malloc(N * N * sizeof(double));
+        if (matrix2 == NULL) {
+            return SPEEDMM_NO_MEMORY;
+        }
+#pragma omp parallel for schedule(static) num_threads(context_threads(context))
+        for (size_t i = 0; i < N; i++) {
+            for (size_t j = 0; j < N; j++) {
+                matrix2[j][i] = b->data[i * N + j];
+            }
+        }
+    }
+    struct config *previous_config = enter_context(context);
+    int previous_threads = omp_get_max_threads();
+    omp_set_num_threads(context_threads(context));
+    struct epilogue previous_epilogue = gemm_epilogue;
+    struct epilogue epilogue = { alpha, beta, beta / alpha, NULL, NULL, ACTIVATION_NONE };
+    gemm_epilogue = epilogue;
+    long flops = context->implementation->multiply(context->config.loop_order, (double (*)[N])a->data, matrix2,
+                                                   (double (*)[N])c->data);
+    gemm_epilogue = previous_epilogue;
+    omp_set_num_threads(previous_threads);
+    leave_context(previous_config);
+    if (matrix2 != (double (*)[N])b->data) {
+        free(matrix2);
+    }
+    return flops < 0 ? SPEEDMM_FAILED : SPEEDMM_OK;
+}
+
+static speedmm_plan *wrap_plan(speedmm_context *context, struct gemm_plan *plan)
+{
+    if (plan == NULL) {
+        return NULL;
+    }
+    speedmm_plan *wrapped = malloc(sizeof(speedmm_plan));
+    if (wrapped == NULL) {
+        plan_destroy(plan);
+        return NULL;
+    }
+    wrapped->config = context->config;
+    wrapped->plan = plan;
+    return wrapped;
+}
+
+speedmm_plan *speedmm_plan_create(speedmm_context *context, size_t m, size_t n, size_t k, enum speedmm_plan_mode mode)
+{
+    if (context == NULL || m == 0 || n == 0 || k == 0) {
+        return NULL;
+    }
+    struct config *previous = enter_context(context);
+    struct gemm_plan *plan = plan_gemm(m, n, k, context_threads(context),
+                                       mode == SPEEDMM_PLAN_ESTIMATE ? PLAN_ESTIMATE : PLAN_MEASURE);
+    leave_context(previous);
+    return wrap_plan(context, plan);
+}
+
+speedmm_plan *speedmm_plan_load(speedmm_context *context, const char *path, size_t m, size_t n, size_t k)
+{
+    if (context == NULL || path == NULL) {
+        return NULL;
+    }
+    struct config *previous = enter_context(context);
+    struct gemm_plan *plan = plan_load(path, m, n, k, context_threads(context));
+    leave_context(previous);
+    return wrap_plan(context, plan);
+}
+
+int speedmm_plan_save(const speedmm_plan *plan, const char *path)
+{
+    if (plan == NULL || path == NULL) {
+        return SPEEDMM_INVALID;
+    }
+    struct config settings = plan->config; // the plan is const
+    struct config *previous = enter_config(&settings);
+    bool saved = plan_save(plan->plan, path);
+    leave_context(previous);
+    return saved ? SPEEDMM_OK : SPEEDMM_FAILED;
+}
+
+int speedmm_plan_pack_b(speedmm_plan *plan, const speedmm_matrix *b)
+{
+    if (plan == NULL || !has_shape(b, plan->plan->k, plan->plan->n)) {
+        return SPEEDMM_INVALID;
+    }
+    struct config *previous = enter_config(&plan->config);
+    bool packed = plan_pack_b(plan->plan, matrix_view(b));
+    leave_context(previous);
+    return packed ? SPEEDMM_OK : SPEEDMM_NO_MEMORY;
+}
+
+/**
+ * C = alpha A . B + beta C on the plan
+ */
+int speedmm_execute(speedmm_plan *plan, double alpha, const speedmm_matrix *a, const speedmm_matrix *b,
+                    double beta, speedmm_matrix *c)
+{
+    if (plan == NULL || alpha == 0) {
+        return SPEEDMM_INVALID;
+    }
+    const struct gemm_plan *planned = plan->plan;
+    bool b_given = planned->packed_b != NULL || has_shape(b, planned->k, planned->n);
+    if (!has_shape(a, planned->m, planned->k) || !has_shape(c, planned->m, planned->n) || !b_given) {
+        return SPEEDMM_INVALID;
+    }
+    struct tile_matrix b_view = { NULL, planned->n, 1 };
+    if (planned->packed_b == NULL) {
+        b_view = matrix_view(b);
+    }
+    struct epilogue epilogue = { alpha, beta, beta / alpha, NULL, NULL, ACTIVATION_NONE };
+    struct config *previous = enter_config(&plan->config);
+    plan_execute(planned, matrix_view(a), b_view, matrix_view(c), &epilogue);
+    leave_context(previous);
+    return SPEEDMM_OK;
+}
+
+void speedmm_plan_destroy(speedmm_plan *plan)
+{
+    if (plan != NULL) {
+        plan_destroy(plan->plan);
+    }
+    free(plan);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * libspeedmm: the matrix multiplication engine of the matrix_N benchmarks as a static and shared library,
+ * for programs that multiply in process instead of running the executables on CSV files.
+ *
+ * A context holds the settings of the products (implementation, threads, block size). Matrices are row
+ * major doubles, owned by the library or wrapping memory of the caller with its leading dimension.
+ * Two ways to multiply:
+ *  - speedmm_multiply runs a registered implementation (speedmm_implementation_name) on square matrices
+ *    of the size the library was built for (speedmm_square_size), contiguous;
+ *  - a plan is made once for any m x n x k shape (timing the candidate kernels, or estimated), can be
+ *    saved and loaded, can pack a B that does not change, and then speedmm_execute runs it as many
+ *    times as needed with no setup. A plan keeps a copy of the settings of its context, which can be
+ *    destroyed before it.
+ * Both compute C = alpha A . B + beta C, with alpha not 0; beta 0 overwrites C without reading it.
+ *
+ * The library keeps the configuration of the running product in process wide state, like the
+ * executables: calls into it must not overlap, whatever the contexts.
+ *
+ * Only the functions declared here are global in the shared and in the static library, so neither clashes
+ * with the symbols of the program; SPEEDMM_VERSION changes when any of them does.
+ */
+
+#define SPEEDMM_VERSION 1
+
+#if defined(__GNUC__)
+#define SPEEDMM_API __attribute__((visibility("default")))
+#else
+#define SPEEDMM_API
+#endif
+
+// results of the calls that return an int
+enum speedmm_status {
+    SPEEDMM_OK = 0,
+    SPEEDMM_INVALID = -1,   // a NULL argument, an unknown name or a shape that does not fit
+    SPEEDMM_NO_MEMORY = -2,
+    SPEEDMM_FAILED = -3     // the implementation or the file operation failed
+};
+
+// speedmm_plan_create: time the candidates on a sample of the shape, or take the defaults
+enum speedmm_plan_mode { SPEEDMM_PLAN_MEASURE = 0, SPEEDMM_PLAN_ESTIMATE = 1 };
+
+typedef struct speedmm_context speedmm_context;
+typedef struct speedmm_matrix speedmm_matrix;
+typedef struct speedmm_plan speedmm_plan;
+
+SPEEDMM_API int speedmm_version(void);
+SPEEDMM_API const char *speedmm_status_name(int status);
+// rows and columns of the matrices of speedmm_multiply
+SPEEDMM_API size_t speedmm_square_size(void);
+SPEEDMM_API int speedmm_implementation_count(void);
+// NULL when index is out of range
+SPEEDMM_API const char *speedmm_implementation_name(int index);
+SPEEDMM_API const char *speedmm_implementation_description(int index);
+
+// NULL for an unknown implementation; NULL selects "block"
+SPEEDMM_API speedmm_context *speedmm_context_create(const char *implementation);
+// 0 for the OpenMP default
+SPEEDMM_API int speedmm_context_set_threads(speedmm_context *context, int threads);
+// must divide speedmm_square_size for the blocked implementations, default 64
+SPEEDMM_API int speedmm_context_set_block_size(speedmm_context *context, int block_size);
+SPEEDMM_API void speedmm_context_destroy(speedmm_context *context);
+
+SPEEDMM_API speedmm_matrix *speedmm_matrix_create(size_t rows, size_t cols);
+// a view of the caller's rows x cols matrix, row i at data + i * ld; the data is not freed with it
+SPEEDMM_API speedmm_matrix *speedmm_matrix_wrap(double *data, size_t rows, size_t cols, size_t ld);
+SPEEDMM_API double *speedmm_matrix_data(speedmm_matrix *matrix);
+SPEEDMM_API size_t speedmm_matrix_rows(const speedmm_matrix *matrix);
+SPEEDMM_API size_t speedmm_matrix_cols(const speedmm_matrix *matrix);
+SPEEDMM_API size_t speedmm_matrix_ld(const speedmm_matrix *matrix);
+SPEEDMM_API void speedmm_matrix_destroy(speedmm_matrix *matrix);
+
+SPEEDMM_API int speedmm_multiply(speedmm_context *context, double alpha, const speedmm_matrix *a,
+                                 const speedmm_matrix *b, double beta, speedmm_matrix *c);
+
+SPEEDMM_API speedmm_plan *speedmm_plan_create(speedmm_context *context, size_t m, size_t n, size_t k,
+                                              enum speedmm_plan_mode mode);
+// NULL when the file is missing or holds a plan for another shape, thread count or CPU
+SPEEDMM_API speedmm_plan *speedmm_plan_load(speedmm_context *context, const char *path, size_t m, size_t n,
+                                            size_t k);
+SPEEDMM_API int speedmm_plan_save(const speedmm_plan *plan, const char *path);
+// pack the k x n B once: speedmm_execute then ignores its b argument until the plan is destroyed
+SPEEDMM_API int speedmm_plan_pack_b(speedmm_plan *plan, const speedmm_matrix *b);
+// the m x k A, k x n B (NULL once packed) and m x n C of the plan
+SPEEDMM_API int speedmm_execute(speedmm_plan *plan, double alpha, const speedmm_matrix *a,
+                                const speedmm_matrix *b, double beta, speedmm_matrix *c);
+SPEEDMM_API void speedmm_plan_destroy(speedmm_plan *plan);
@@ -0,0 +1,215 @@
+#ifndef TRACE_SUPPORT_LOCAL
+#define TRACE_SUPPORT_LOCAL
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <omp.h>
+
+#include "matrix_config.h"
+
+/**
+ * Tile execution tracer for --trace FILE.json
+ *
+ * Each thread records the tiles it runs (when the task was created, when it started and
+ * finished, and the ii,jj,kk tile coordinates) in its own ring buffer, so recording is a
+ * couple of timer reads and a store with no locking. When the buffer is full the oldest
+ * tiles are overwritten.
+ *
+ * After the run the tiles are written as a Chrome trace (load in chrome://tracing or
+ * ui.perfetto.dev): one slice per tile on the thread that ran it, with the queueing delay
+ * in the args and flow arrows following the depend(inout: result...) chain of each C tile,
+ * which makes idle gaps, dependency stalls and straggler tiles visible.
+ */
+
+#define MAX_TRACE_THREADS 256
+#define TRACE_EVENTS_PER_THREAD (1 << 18)
+
+struct trace_event {
+    double created; // when the producer created the task (0 if not known)
+    double start;
+    double end;
+    int ii;
+    int jj;
+    int kk;
+};
+
+struct trace_ring {
+    struct trace_event *events;
+    unsigned long count; // total recorded: the ring holds the last TRACE_EVENTS_PER_THREAD
+    char padding[64];
+};
+
+static struct trace_ring trace_rings[MAX_TRACE_THREADS];
+static double trace_origin = 0;
+
+bool tracing()
+{
+    return config->trace_file != NULL;
+}
+
+/**
+ * Clear the buffers and restart the clock, called before each measured multiplication
+ */
+void trace_start()
+{
+    if (!tracing()) return;
+    for (int t = 0; t < MAX_TRACE_THREADS; t++) {
+        trace_rings[t].count = 0;
+    }
+    trace_origin = omp_get_wtime();
+}
+
+/**
+ * @return the current time for a tile timestamp, or 0 when not tracing
+ */
+double trace_now()
+{
+    return tracing() ? omp_get_wtime() : 0;
+}
+
+/**
+ * Record a finished tile on the calling thread's ring buffer
+ *
+ * @param created time the task was created (from trace_now() in the producer), or 0
+ * @param start time the tile started (from trace_now())
+ */
+void trace_tile(double created, double start, int ii, int jj, int kk)
+{
+    if (!tracing()) return;
+    int thread = omp_get_thread_num();
+    if (thread >= MAX_TRACE_THREADS) return;
+    struct trace_ring *ring = &trace_rings[thread];
+    if (ring->events == NULL) {
+        // first tile on this thread: allocate its ring (only this thread touches it)
+        ring->events = malloc(TRACE_EVENTS_PER_THREAD * sizeof(struct trace_event));
+        if (ring->events == NULL) return;
+    }
+    struct trace_event *event = &ring->events[ring->count % TRACE_EVENTS_PER_THREAD];
+    event->created = created;
+    event->start = start;
+    event->end = omp_get_wtime();
+    event->ii = ii;
+    event->jj = jj;
+    event->kk = kk;
+    ring->count++;
+}
+
+struct trace_ref {
+    struct trace_event *event;
+    int thread;
+};
+
+// order by C tile then kk, so each depend(inout) chain is contiguous
+int compare_trace_refs(const void *a, const void *b)
+{
+    const struct trace_event *x = ((const struct trace_ref *)a)->event;
+    const struct trace_event *y = ((const struct trace_ref *)b)->event;
+    if (x->ii != y->ii) return x->ii < y->ii ? -1 : 1;
+    if (x->jj != y->jj) return x->jj < y->jj ? -1 : 1;
+    if (x->kk != y->kk) return x->kk < y->kk ? -1 : 1;
+    return 0;
+}
+
+double trace_micros(double time)
+{
+    return (time - trace_origin) * 1000000.0;
+}
+
+/**
+ * Write text as a JSON string, escaping the quotes, backslashes and control characters
+ */
+void write_json_string(FILE *out, const char *text)
+{
+    fputc('"', out);
+    for (const unsigned char *c = (const unsigned char *)text; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        }
+        else if (*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        }
+        else {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/**
+ * Write the recorded tiles as a Chrome trace JSON file
+ *
+ * @param suffix inserted before the extension of the file name (trace.json -> trace.SUFFIX.json), or NULL
+ */
+void write_trace_file(char *trace_file_name, const char *suffix)
+{
+    char suffixed_name[PATH_MAX];
+    if (suffix != NULL) {
+        char *extension = strrchr(trace_file_name, '.');
+        int stem = extension != NULL && strchr(extension, '/') == NULL ?
+                   (int)(extension - trace_file_name) : (int)strlen(trace_file_name);
+        snprintf(suffixed_name, sizeof(suffixed_name), "%.*s.%s%s", stem, trace_file_name, suffix,
+                 trace_file_name + stem);
+        trace_file_name = suffixed_name;
+    }
+    FILE *out = fopen(trace_file_name, "w");
+    if (out == NULL) {
+        ERROR("Could not create the trace file at %s. Does the dir exist?", trace_file_name);
+        return;
+    }
+    unsigned long total = 0, dropped = 0;
+    for (int t = 0; t < MAX_TRACE_THREADS; t++) {
+        unsigned long kept = MIN(trace_rings[t].count, TRACE_EVENTS_PER_THREAD);
+        total += kept;
+        dropped += trace_rings[t].count - kept;
+    }
+    struct trace_ref *refs = malloc((total + 1) * sizeof(struct trace_ref));
+    unsigned long num_refs = 0;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"size\":%d,\"block_size\":%d,\"dropped_tiles\":%lu},\n",
+            N, config->block_size, dropped);
+    fprintf(out, "\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":");
+    write_json_string(out, config->label);
+    fprintf(out, "}}");
+    for (int t = 0; t < MAX_TRACE_THREADS; t++) {
+        struct trace_ring *ring = &trace_rings[t];
+        if (ring->count == 0) continue;
+        fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"omp thread %d\"}}",
+                t, t);
+        unsigned long kept = MIN(ring->count, TRACE_EVENTS_PER_THREAD);
+        for (unsigned long e = 0; e < kept; e++) {
+            struct trace_event *event = &ring->events[e];
+            double queued = event->created > 0 ? (event->start - event->created) * 1000000.0 : 0;
+            fprintf(out, ",\n{\"name\":\"tile %d,%d\",\"cat\":\"tile\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                         "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"ii\":%d,\"jj\":%d,\"kk\":%d,\"queued_us\":%.3f}}",
+                    event->ii, event->jj, t, trace_micros(event->start), (event->end - event->start) * 1000000.0,
+                    event->ii, event->jj, event->kk, queued);
+            refs[num_refs].event = event;
+            refs[num_refs].thread = t;
+            num_refs++;
+        }
+    }
+
+    // flow arrows from each tile to the next kk tile of the same C tile (the inout dependency)
+    qsort(refs, num_refs, sizeof(struct trace_ref), compare_trace_refs);
+    unsigned long flow_id = 0;
+    for (unsigned long r = 1; r < num_refs; r++) {
+        struct trace_event *from = refs[r - 1].event;
+        struct trace_event *to = refs[r].event;
+        if (from->ii != to->ii || from->jj != to->jj) continue;
+        flow_id++;
+        fprintf(out, ",\n{\"name\":\"depend\",\"cat\":\"depend\",\"ph\":\"s\",\"id\":%lu,\"pid\":1,\"tid\":%d,\"ts\":%.3f}",
+                flow_id, refs[r - 1].thread, trace_micros(from->end) - 0.001);
+        fprintf(out, ",\n{\"name\":\"depend\",\"cat\":\"depend\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%lu,\"pid\":1,\"tid\":%d,"
+                     "\"ts\":%.3f}", flow_id, refs[r].thread, trace_micros(to->start));
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    free(refs);
+    INFO("Wrote %lu tiles to trace %s (%lu older tiles dropped from full ring buffers)",
+         total, trace_file_name, dropped);
+}
+
+#endif
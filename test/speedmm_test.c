@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../src/speedmm.h"
+
+/*
+ * Checks the libspeedmm API against a naive product, linked like a program using the library would.
+ *
+ *   speedmm_test NAME  speedmm_multiply with the NAME implementation, on sampled elements of C
+ *   speedmm_test plan  plans of odd shapes, packed and not, saved and loaded, on every element of C
+ */
+
+#define SAMPLES 256
+#define TOLERANCE 1e-9
+
+static int failures = 0;
+
+static void check(int condition, const char *what)
+{
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static void fill(speedmm_matrix *matrix, int seed)
+{
+    double *data = speedmm_matrix_data(matrix);
+    size_t rows = speedmm_matrix_rows(matrix), cols = speedmm_matrix_cols(matrix), ld = speedmm_matrix_ld(matrix);
+    for (size_t i = 0; i < rows; i++) {
+        for (size_t j = 0; j < cols; j++) {
+            data[i * ld + j] = (double)((i * 31 + j * 17 + seed) % 23) / 23.0 - 0.5;
+        }
+    }
+}
+
+/**
+ * @return (A . B)[i][j], the naive way
+ */
+static double naive_element(speedmm_matrix *a, speedmm_matrix *b, size_t i, size_t j)
+{
+    double *a_data = speedmm_matrix_data(a), *b_data = speedmm_matrix_data(b);
+    size_t k_size = speedmm_matrix_cols(a), lda = speedmm_matrix_ld(a), ldb = speedmm_matrix_ld(b);
+    double sum = 0;
+    for (size_t k = 0; k < k_size; k++) {
+        sum += a_data[i * lda + k] * b_data[k * ldb + j];
+    }
+    return sum;
+}
+
+/**
+ * @return max over the elements (all, or SAMPLES of them) of |C - (alpha A . B + beta c0)| relative to k
+ */
+static double max_error(speedmm_matrix *a, speedmm_matrix *b, speedmm_matrix *c, double alpha, double beta,
+                        double c0, int sampled)
+{
+    size_t rows = speedmm_matrix_rows(c), cols = speedmm_matrix_cols(c), ldc = speedmm_matrix_ld(c);
+    double *c_data = speedmm_matrix_data(c);
+    size_t count = sampled ? SAMPLES : rows * cols;
+    double error = 0;
+    for (size_t s = 0; s < count; s++) {
+        // the corners, then spread over the matrix
+        size_t i = sampled ? (s < 2 ? s * (rows - 1) : (s * 2654435761u) % rows) : s / cols;
+        size_t j = sampled ? (s < 2 ? s * (cols - 1) : (s * 40503u + 7) % cols) : s % cols;
+        double expected = alpha * naive_element(a, b, i, j) + beta * c0;
+        error = fmax(error, fabs(c_data[i * ldc + j] - expected));
+    }
+    return error / (double)speedmm_matrix_cols(a);
+}
+
+static void set_all(speedmm_matrix *matrix, double value)
+{
+    double *data = speedmm_matrix_data(matrix);
+    for (size_t i = 0; i < speedmm_matrix_rows(matrix) * speedmm_matrix_ld(matrix); i++) {
+        data[i] = value;
+    }
+}
+
+static void test_multiply(const char *implementation)
+{
+    size_t n = speedmm_square_size();
+    speedmm_context *context = speedmm_context_create(implementation);
+    check(context != NULL, "speedmm_context_create");
+    if (context == NULL) {
+        return;
+    }
+    speedmm_matrix *a = speedmm_matrix_create(n, n), *b = speedmm_matrix_create(n, n), *c = speedmm_matrix_create(n, n);
+    fill(a, 1);
+    fill(b, 2);
+
+    // beta 0 overwrites C, whatever is in it
+    set_all(c, NAN);
+    check(speedmm_multiply(context, 1, a, b, 0, c) == SPEEDMM_OK, "speedmm_multiply alpha 1 beta 0");
+    double error = max_error(a, b, c, 1, 0, 0, 1);
+    printf("%s: C = A.B max error %.3e\n", implementation, error);
+    check(error < TOLERANCE, "C = A.B");
+
+    set_all(c, 1.0);
+    check(speedmm_multiply(context, 2, a, b, 0.5, c) == SPEEDMM_OK, "speedmm_multiply alpha 2 beta 0.5");
+    error = max_error(a, b, c, 2, 0.5, 1.0, 1);
+    printf("%s: C = 2 A.B + 0.5 C max error %.3e\n", implementation, error);
+    check(error < TOLERANCE, "C = 2 A.B + 0.5 C");
+
+    speedmm_matrix *small = speedmm_matrix_create(n / 2, n);
+    check(speedmm_multiply(context, 1, small, b, 0, c) == SPEEDMM_INVALID, "speedmm_multiply of a wrong shape");
+    check(speedmm_multiply(context, 0, a, b, 0, c) == SPEEDMM_INVALID, "speedmm_multiply with alpha 0");
+
+    speedmm_matrix_destroy(small);
+    speedmm_matrix_destroy(a);
+    speedmm_matrix_destroy(b);
+    speedmm_matrix_destroy(c);
+    speedmm_context_destroy(context);
+}
+
+static void test_plan_shape(speedmm_context *context, size_t m, size_t n, size_t k, enum speedmm_plan_mode mode)
+{
+    // A and B are views into larger matrices, so the leading dimensions are not the widths
+    speedmm_matrix *a_storage = speedmm_matrix_create(m, k + 3), *b_storage = speedmm_matrix_create(k, n + 5);
+    speedmm_matrix *a = speedmm_matrix_wrap(speedmm_matrix_data(a_storage), m, k, k + 3);
+    speedmm_matrix *b = speedmm_matrix_wrap(speedmm_matrix_data(b_storage), k, n, n + 5);
+    speedmm_matrix *c = speedmm_matrix_create(m, n);
+    fill(a, 3);
+    fill(b, 4);
+    char what[100];
+    sprintf(what, "plan %zu x %zu x %zu", m, n, k);
+
+    speedmm_plan *plan = speedmm_plan_create(context, m, n, k, mode);
+    check(plan != NULL, what);
+    if (plan == NULL) {
+        return;
+    }
+    set_all(c, NAN);
+    check(speedmm_execute(plan, 1, a, b, 0, c) == SPEEDMM_OK, what);
+    double error = max_error(a, b, c, 1, 0, 0, 0);
+
+    check(speedmm_plan_save(plan, "speedmm_test.plan") == SPEEDMM_OK, "speedmm_plan_save");
+    speedmm_plan *loaded = speedmm_plan_load(context, "speedmm_test.plan", m, n, k);
+    check(loaded != NULL, "speedmm_plan_load");
+    check(speedmm_plan_load(context, "speedmm_test.plan", m + 1, n, k) == NULL, "speedmm_plan_load of another shape");
+    if (loaded != NULL) {
+        check(speedmm_plan_pack_b(loaded, b) == SPEEDMM_OK, "speedmm_plan_pack_b");
+        set_all(c, 1.0);
+        check(speedmm_execute(loaded, 3, a, NULL, -1, c) == SPEEDMM_OK, what);
+        error = fmax(error, max_error(a, b, c, 3, -1, 1.0, 0));
+        speedmm_matrix *wrong = speedmm_matrix_create(m + 1, k);
+        check(speedmm_execute(loaded, 1, wrong, NULL, 0, c) == SPEEDMM_INVALID, "speedmm_execute of a wrong shape");
+        speedmm_matrix_destroy(wrong);
+        speedmm_plan_destroy(loaded);
+    }
+    printf("%s: max error %.3e\n", what, error);
+    check(error < TOLERANCE, what);
+
+    speedmm_plan_destroy(plan);
+    speedmm_matrix_destroy(a);
+    speedmm_matrix_destroy(b);
+    speedmm_matrix_destroy(c);
+    speedmm_matrix_destroy(a_storage);
+    speedmm_matrix_destroy(b_storage);
+}
+
+static void test_plans()
+{
+    speedmm_context *context = speedmm_context_create(NULL);
+    check(context != NULL, "speedmm_context_create(NULL)");
+    check(speedmm_context_create("no such implementation") == NULL, "speedmm_context_create of an unknown name");
+    test_plan_shape(context, 1, 1, 1, SPEEDMM_PLAN_ESTIMATE);
+    test_plan_shape(context, 7, 13, 5, SPEEDMM_PLAN_ESTIMATE);
+    test_plan_shape(context, 129, 65, 33, SPEEDMM_PLAN_MEASURE);
+    test_plan_shape(context, 300, 250, 200, SPEEDMM_PLAN_ESTIMATE);
+    remove("speedmm_test.plan");
+    speedmm_context_destroy(context);
+
+    // a plan outlives its context
+    context = speedmm_context_create(NULL);
+    speedmm_plan *plan = speedmm_plan_create(context, 40, 30, 20, SPEEDMM_PLAN_ESTIMATE);
+    speedmm_context_destroy(context);
+    check(plan != NULL, "speedmm_plan_create");
+    if (plan != NULL) {
+        speedmm_matrix *a = speedmm_matrix_create(40, 20), *b = speedmm_matrix_create(20, 30);
+        speedmm_matrix *c = speedmm_matrix_create(40, 30);
+        fill(a, 5);
+        fill(b, 6);
+        set_all(c, NAN);
+        check(speedmm_execute(plan, 1, a, b, 0, c) == SPEEDMM_OK, "speedmm_execute after speedmm_context_destroy");
+        check(max_error(a, b, c, 1, 0, 0, 0) < TOLERANCE, "speedmm_execute after speedmm_context_destroy");
+        speedmm_plan_destroy(plan);
+        speedmm_matrix_destroy(a);
+        speedmm_matrix_destroy(b);
+        speedmm_matrix_destroy(c);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: speedmm_test IMPLEMENTATION|plan\n");
+        return 2;
+    }
+    printf("libspeedmm %d, %zu x %zu\n", speedmm_version(), speedmm_square_size(), speedmm_square_size());
+    if (strcmp(argv[1], "plan") == 0) {
+        test_plans();
+    }
+    else {
+        test_multiply(argv[1]);
+    }
+    printf("%s\n", failures == 0 ? "passed" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}